@@ -34,6 +34,9 @@
 #include <errno.h>
 
 static gboolean bitlbee_io_new_client( gpointer data, gint fd, b_input_condition condition );
+static gboolean bitlbee_pool_refill( gpointer data, gint fd, b_input_condition cond );
+
+static gint pool_refill_id = 0;
 
 static gboolean try_listen( struct addrinfo *res )
 {
@@ -117,7 +120,7 @@ int bitlbee_daemon_init()
 	
 	freeaddrinfo( addrinfo_bind );
 
-	i = listen( global.listen_socket, 10 );
+	i = listen( global.listen_socket, SOMAXCONN );
 	if( i == -1 )
 	{
 		log_error( "listen" );
@@ -153,7 +156,12 @@ int bitlbee_daemon_init()
 #endif
 	
 	if( global.conf->runmode == RUNMODE_FORKDAEMON )
+	{
 		ipc_master_load_state( getenv( "_BITLBEE_RESTART_STATE" ) );
+		
+		if( global.conf->fork_pool > 0 )
+			pool_refill_id = b_timeout_add( 0, bitlbee_pool_refill, NULL );
+	}
 
 	if( global.conf->runmode == RUNMODE_DAEMON || global.conf->runmode == RUNMODE_FORKDAEMON )
 		ipc_master_listen_socket();
@@ -246,13 +254,12 @@ gboolean bitlbee_io_current_client_write( gpointer data, gint fd, b_input_condit
 {
 	irc_t *irc = data;
 	int st, size;
-	char *temp;
 
 	if( irc->sendbuffer == NULL )
 		return FALSE;
 	
-	size = strlen( irc->sendbuffer );
-	st = write( irc->fd, irc->sendbuffer, size );
+	size = irc->sendbuffer->len;
+	st = write( irc->fd, irc->sendbuffer->str, size );
 	
 	if( st == 0 || ( st < 0 && !sockerr_again() ) )
 	{
@@ -272,7 +279,7 @@ gboolean bitlbee_io_current_client_write( gpointer data, gint fd, b_input_condit
 		}
 		else
 		{
-			g_free( irc->sendbuffer );
+			g_string_free( irc->sendbuffer, TRUE );
 			irc->sendbuffer = NULL;
 			irc->w_watch_source_id = 0;
 		}
@@ -281,86 +288,150 @@ gboolean bitlbee_io_current_client_write( gpointer data, gint fd, b_input_condit
 	}
 	else
 	{
-		temp = g_strdup( irc->sendbuffer + st );
-		g_free( irc->sendbuffer );
-		irc->sendbuffer = temp;
+		g_string_erase( irc->sendbuffer, 0, st );
 		
 		return TRUE;
 	}
 }
 
-static gboolean bitlbee_io_new_client( gpointer data, gint fd, b_input_condition condition )
+#ifndef _WIN32
+/* Fork a child process for a new connection. With new_socket == -1 it
+   becomes an idle child for the pool instead, which waits for the master
+   to pass it a connection. Like fork(), returns 0 in the child, -1 if
+   something went wrong. */
+static int bitlbee_fork_child( int new_socket )
 {
-	socklen_t size = sizeof( struct sockaddr_in );
-	struct sockaddr_in conn_info;
-	int new_socket = accept( global.listen_socket, (struct sockaddr *) &conn_info, &size );
+	pid_t client_pid = 0;
+	int fds[2];
 	
-	if( new_socket == -1 )
+	if( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) == -1 )
 	{
-		log_message( LOGLVL_WARNING, "Could not accept new connection: %s", strerror( errno ) );
-		return TRUE;
+		log_message( LOGLVL_WARNING, "Could not create IPC socket for client: %s", strerror( errno ) );
+		fds[0] = fds[1] = -1;
+		
+		/* Idle children are no use without one. */
+		if( new_socket == -1 )
+			return -1;
 	}
 	
-#ifndef _WIN32
-	if( global.conf->runmode == RUNMODE_FORKDAEMON )
+	sock_make_nonblocking( fds[0] );
+	sock_make_nonblocking( fds[1] );
+	
+	client_pid = fork();
+	
+	if( client_pid > 0 && fds[0] != -1 )
 	{
-		pid_t client_pid = 0;
-		int fds[2];
+		struct bitlbee_child *child;
+		
+		/* TODO: Stuff like this belongs in ipc.c. */
+		child = g_new0( struct bitlbee_child, 1 );
+		child->pid = client_pid;
+		child->ipc_fd = fds[0];
+		child->ipc_inpa = b_input_add( child->ipc_fd, B_EV_IO_READ, ipc_master_read, child );
+		child->to_fd = -1;
+		child_list = g_slist_append( child_list, child );
 		
-		if( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) == -1 )
+		if( new_socket == -1 )
 		{
-			log_message( LOGLVL_WARNING, "Could not create IPC socket for client: %s", strerror( errno ) );
-			fds[0] = fds[1] = -1;
+			log_message( LOGLVL_INFO, "Creating idle subprocess with pid %d.", (int) client_pid );
+			ipc_master_pool_add( child );
 		}
-		
-		sock_make_nonblocking( fds[0] );
-		sock_make_nonblocking( fds[1] );
-		
-		client_pid = fork();
-		
-		if( client_pid > 0 && fds[0] != -1 )
+		else
 		{
-			struct bitlbee_child *child;
-			
-			/* TODO: Stuff like this belongs in ipc.c. */
-			child = g_new0( struct bitlbee_child, 1 );
-			child->pid = client_pid;
-			child->ipc_fd = fds[0];
-			child->ipc_inpa = b_input_add( child->ipc_fd, B_EV_IO_READ, ipc_master_read, child );
-			child->to_fd = -1;
-			child_list = g_slist_append( child_list, child );
-			
 			log_message( LOGLVL_INFO, "Creating new subprocess with pid %d.", (int) client_pid );
 			
 			/* Close some things we don't need in the parent process. */
 			close( new_socket );
-			close( fds[1] );
 		}
-		else if( client_pid == 0 )
-		{
-			irc_t *irc;
-			
-			/* Since we're fork()ing here, let's make sure we won't
-			   get the same random numbers as the parent/siblings. */
-			srand( time( NULL ) ^ getpid() );
-			
-			b_main_init();
-			
-			/* Close the listening socket, we're a client. */
-			close( global.listen_socket );
-			b_event_remove( global.listen_watch_source_id );
-			
-			/* Make the connection. */
+		close( fds[1] );
+	}
+	else if( client_pid == 0 )
+	{
+		irc_t *irc = NULL;
+		
+		/* Since we're fork()ing here, let's make sure we won't
+		   get the same random numbers as the parent/siblings. */
+		srand( time( NULL ) ^ getpid() );
+		
+		b_main_init();
+		
+		/* Close the listening socket, we're a client. */
+		close( global.listen_socket );
+		b_event_remove( global.listen_watch_source_id );
+		if( pool_refill_id > 0 )
+			b_event_remove( pool_refill_id );
+		pool_refill_id = 0;
+		
+		/* Make the connection, unless we're going to wait for one. */
+		if( new_socket != -1 )
 			irc = irc_new( new_socket );
-			
-			/* We can store the IPC fd there now. */
-			global.listen_socket = fds[1];
-			global.listen_watch_source_id = b_input_add( fds[1], B_EV_IO_READ, ipc_child_read, irc );
-			
-			close( fds[0] );
-			
-			ipc_master_free_all();
-		}
+		
+		/* We can store the IPC fd there now. */
+		global.listen_socket = fds[1];
+		global.listen_watch_source_id = b_input_add( fds[1], B_EV_IO_READ, ipc_child_read, irc );
+		
+		close( fds[0] );
+		
+		ipc_master_free_all();
+	}
+	else
+	{
+		log_message( LOGLVL_WARNING, "Could not fork() a new subprocess: %s", strerror( errno ) );
+		
+		close( fds[0] );
+		close( fds[1] );
+		if( new_socket != -1 )
+			close( new_socket );
+	}
+	
+	return client_pid;
+}
+
+/* Add one idle child to the pool per call, so accept()ing new connections
+   doesn't have to wait for all of them. */
+static gboolean bitlbee_pool_refill( gpointer data, gint fd, b_input_condition cond )
+{
+	pid_t pid = 1;
+	
+	if( ipc_master_pool_size() < global.conf->fork_pool )
+		pid = bitlbee_fork_child( -1 );
+	
+	/* The new child removed this timer already. */
+	if( pid == 0 )
+		return FALSE;
+	else if( pid > 0 && ipc_master_pool_size() < global.conf->fork_pool )
+		return TRUE;
+	
+	pool_refill_id = 0;
+	return FALSE;
+}
+#endif
+
+static gboolean bitlbee_io_new_client( gpointer data, gint fd, b_input_condition condition )
+{
+	socklen_t size = sizeof( struct sockaddr_in );
+	struct sockaddr_in conn_info;
+	int new_socket = accept( global.listen_socket, (struct sockaddr *) &conn_info, &size );
+	
+	if( new_socket == -1 )
+	{
+		log_message( LOGLVL_WARNING, "Could not accept new connection: %s", strerror( errno ) );
+		return TRUE;
+	}
+	
+#ifndef _WIN32
+	if( global.conf->runmode == RUNMODE_FORKDAEMON )
+	{
+		/* Hand it to an idle child if we have one, which we'll
+		   replace later. */
+		if( ipc_master_pool_take( new_socket ) )
+			log_message( LOGLVL_INFO, "Passed new connection to idle subprocess." );
+		else if( bitlbee_fork_child( new_socket ) == 0 )
+			return TRUE;
+		
+		if( pool_refill_id == 0 && global.conf->fork_pool > 0 &&
+		    ipc_master_pool_size() < global.conf->fork_pool )
+			pool_refill_id = b_timeout_add( 0, bitlbee_pool_refill, NULL );
 	}
 	else
 #endif
@@ -52,6 +52,8 @@ conf_t *conf_load( int argc, char *argv[] )
 	conf->primary_storage = g_strdup( "xml" );
 	conf->migrate_storage = g_strsplit( "text", ",", -1 );
 	conf->runmode = RUNMODE_INETD;
+	conf->fork_pool = 0;
+	conf->otr_keygen_workers = 0;
 	conf->authmode = AUTHMODE_OPEN;
 	conf->auth_pass = NULL;
 	conf->oper_pass = NULL;
@@ -208,6 +210,24 @@ static int conf_loadini( conf_t *conf, char *file )
 				else
 					conf->runmode = RUNMODE_INETD;
 			}
+			else if( g_strcasecmp( ini->key, "forkpool" ) == 0 )
+			{
+				if( sscanf( ini->value, "%d", &i ) != 1 || i < 0 )
+				{
+					fprintf( stderr, "Invalid %s value: %s\n", ini->key, ini->value );
+					return 0;
+				}
+				conf->fork_pool = i;
+			}
+			else if( g_strcasecmp( ini->key, "otrkeygenworkers" ) == 0 )
+			{
+				if( sscanf( ini->value, "%d", &i ) != 1 || i < 0 )
+				{
+					fprintf( stderr, "Invalid %s value: %s\n", ini->key, ini->value );
+					return 0;
+				}
+				conf->otr_keygen_workers = i;
+			}
 			else if( g_strcasecmp( ini->key, "pidfile" ) == 0 )
 			{
 				g_free( conf->pidfile );
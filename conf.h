@@ -36,6 +36,8 @@ typedef struct conf
 	int nofork;
 	int verbose;
 	runmode_t runmode;
+	int fork_pool;
+	int otr_keygen_workers;
 	authmode_t authmode;
 	char *auth_pass;
 	char *oper_pass;
@@ -33,10 +33,17 @@
 #endif
 
 GSList *child_list = NULL;
+static GSList *child_pool = NULL;
+struct ipc_stats ipc_stats;
 static int ipc_child_recv_fd = -1;
 
 static void ipc_master_takeover_fail( struct bitlbee_child *child, gboolean both );
-static gboolean ipc_send_fd( int fd, int send_fd );
+static int ipc_send_fd( int fd, int send_fd );
+static struct ipc_buf *ipc_buf_new( char *data, int len );
+static void ipc_buf_unref( struct ipc_buf *buf );
+static gboolean ipc_master_send( struct bitlbee_child *child, struct ipc_buf *buf );
+static gboolean ipc_master_send_str( struct bitlbee_child *child, const char *str );
+static gboolean ipc_master_send_fd( struct bitlbee_child *child, int send_fd );
 
 /* On Solaris and possibly other systems passing FDs between processes is
  * not possible (or at least not using the method used in this file.
@@ -170,7 +177,7 @@ void ipc_master_cmd_identify( irc_t *data, char **cmd )
 		resp = "TAKEOVER NO\r\n";
 	}
 	
-	if( write( child->ipc_fd, resp, strlen( resp ) ) != strlen( resp ) )
+	if( !ipc_master_send_str( child, resp ) )
 		ipc_master_free_one( child );
 }
 
@@ -200,11 +207,15 @@ void ipc_master_cmd_takeover( irc_t *data, char **cmd )
 		    strcmp( child->password, child->to_child->password ) == 0 &&
 		    strcmp( child->password, cmd[3] ) == 0 )
 		{
-			ipc_send_fd( child->to_child->ipc_fd, child->to_fd );
+			struct bitlbee_child *old = child->to_child;
 			
 			fwd = irc_build_line( cmd );
-			if( write( child->to_child->ipc_fd, fwd, strlen( fwd ) ) != strlen( fwd ) )
-				ipc_master_free_one( child );
+			/* If old can't take it, only this takeover fails. The
+			   old session stays, its own IPC handler will notice
+			   if the connection is really gone. */
+			if( !ipc_master_send_fd( old, child->to_fd ) ||
+			    !ipc_master_send_str( old, fwd ) )
+				ipc_master_takeover_fail( child, TRUE );
 			g_free( fwd );
 		}
 		else
@@ -213,7 +224,7 @@ void ipc_master_cmd_takeover( irc_t *data, char **cmd )
 	else if( strcmp( cmd[1], "DONE" ) == 0 || strcmp( cmd[1], "FAIL" ) == 0 )
 	{
 		/* Old connection -> Master */
-		int fd;
+		struct bitlbee_child *other = child->to_child;
 		
 		/* The copy was successful (or not), we don't need it anymore. */
 		closesocket( child->to_fd );
@@ -221,15 +232,53 @@ void ipc_master_cmd_takeover( irc_t *data, char **cmd )
 		
 		/* Pass it through to the other party, and flush all state. */
 		fwd = irc_build_line( cmd );
-		fd = child->to_child->ipc_fd;
-		child->to_child->to_child = NULL;
+		other->to_child = NULL;
 		child->to_child = NULL;
-		if( write( fd, fwd, strlen( fwd ) ) != strlen( fwd ) )
-			ipc_master_free_one( child );
+		if( !ipc_master_send_str( other, fwd ) )
+			ipc_master_free_one( other );
 		g_free( fwd );
 	}
 }
 
+static void ipc_master_cmd_stats( irc_t *data, char **cmd )
+{
+	struct bitlbee_child *child = (void*) data;
+	GSList *lines, *l;
+	GString *reply;
+	
+	/* Only for clients of the IPC socket, they get the answer. */
+	if( child == NULL )
+		return;
+	
+	if( cmd[1] && g_strcasecmp( cmd[1], "on" ) == 0 )
+		b_event_profile_enable( TRUE );
+	else if( cmd[1] && g_strcasecmp( cmd[1], "off" ) == 0 )
+		b_event_profile_enable( FALSE );
+	else if( cmd[1] && g_strcasecmp( cmd[1], "reset" ) == 0 )
+		b_event_profile_reset();
+	
+	reply = g_string_new( "" );
+	g_string_append_printf( reply, "STATS :IPC: %llu messages sent, %llu deferred, "
+	                        "%d bytes queued (max. %d per child), %llu children dropped\r\n",
+	                        (unsigned long long) ipc_stats.sent,
+	                        (unsigned long long) ipc_stats.deferred,
+	                        ipc_stats.queued, ipc_stats.max_queued,
+	                        (unsigned long long) ipc_stats.dropped );
+	
+	lines = b_event_profile_report( 20 );
+	for( l = lines; l; l = l->next )
+	{
+		g_string_append_printf( reply, "STATS :%s\r\n", (char*) l->data );
+		g_free( l->data );
+	}
+	g_slist_free( lines );
+	g_string_append( reply, "STATS END\r\n" );
+	
+	if( !ipc_master_send_str( child, reply->str ) )
+		ipc_master_free_one( child );
+	g_string_free( reply, TRUE );
+}
+
 static const command_t ipc_master_commands[] = {
 	{ "client",     3, ipc_master_cmd_client,     0 },
 	{ "hello",      0, ipc_master_cmd_client,     0 },
@@ -244,6 +293,7 @@ static const command_t ipc_master_commands[] = {
 	{ "restart",    0, ipc_master_cmd_restart,    0 },
 	{ "identify",   2, ipc_master_cmd_identify,   0 },
 	{ "takeover",   1, ipc_master_cmd_takeover,   0 },
+	{ "stats",      0, ipc_master_cmd_stats,      0 },
 	{ NULL }
 };
 
@@ -436,6 +486,32 @@ static void ipc_child_cmd_takeover_no( void *data )
 	cmd_identify_finish( data, 0, 0 );
 }
 
+/* Only a few commands make sense for idle children in the pool. */
+static void ipc_idle_cmd_die( irc_t *irc, char **cmd )
+{
+	b_main_quit();
+}
+
+static void ipc_idle_cmd_accept( irc_t *irc, char **cmd )
+{
+	if( ipc_child_recv_fd == -1 )
+	{
+		/* Can't do much without a connection. */
+		b_main_quit();
+		return;
+	}
+	
+	irc_new( ipc_child_recv_fd );
+	ipc_child_recv_fd = -1;
+}
+
+static const command_t ipc_idle_commands[] = {
+	{ "die",        0, ipc_idle_cmd_die,          0 },
+	{ "rehash",     0, ipc_child_cmd_rehash,      0 },
+	{ "accept",     0, ipc_idle_cmd_accept,       0 },
+	{ NULL }
+};
+
 static const command_t ipc_child_commands[] = {
 	{ "die",        0, ipc_child_cmd_die,         0 },
 	{ "wallops",    1, ipc_child_cmd_wallops,     0 },
@@ -453,7 +529,7 @@ gboolean ipc_child_identify( irc_t *irc )
 	if( global.conf->runmode == RUNMODE_FORKDAEMON )
 	{
 #ifndef NO_FD_PASSING
-		if( !ipc_send_fd( global.listen_socket, irc->fd ) )
+		if( ipc_send_fd( global.listen_socket, irc->fd ) != 6 )
 			ipc_child_disable();
 	
 		ipc_to_master_str( "IDENTIFY %s :%s\r\n", irc->user->nick, irc->password );
@@ -503,7 +579,7 @@ static void ipc_master_takeover_fail( struct bitlbee_child *child, gboolean both
 	{
 		/* Send this error only to the new connection, which can be
 		   recognised by to_fd being set. */
-		if( write( child->ipc_fd, "TAKEOVER FAIL\r\n", 15 ) != 15 )
+		if( !ipc_master_send_str( child, "TAKEOVER FAIL\r\n" ) )
 		{
 			ipc_master_free_one( child );
 			return;
@@ -539,34 +615,16 @@ static void ipc_command_exec( void *data, char **cmd, const command_t *commands
 		}
 }
 
-/* Return just one line. Returns NULL if something broke, an empty string
-   on temporary "errors" (EAGAIN and friends). */
-static char *ipc_readline( int fd, int *recv_fd )
+/* Read whatever is available into buf, plus any fds passed along. Returns
+   the number of bytes read, 0 if there's nothing there right now, and -1
+   if the connection is broken. */
+static int ipc_recv( int fd, char *buf, int size, int *recv_fd )
 {
 	struct msghdr msg;
 	struct iovec iov;
-	char ccmsg[CMSG_SPACE(sizeof(recv_fd))];
+	char ccmsg[CMSG_SPACE(sizeof(int) * IPC_MAX_FDS)];
 	struct cmsghdr *cmsg;
-	char buf[513], *eol;
-	int size;
-	
-	/* Because this is internal communication, it should be pretty safe
-	   to just peek at the message, find its length (by searching for the
-	   end-of-line) and then just read that message. With internal
-	   sockets and limites message length, messages should always be
-	   complete. Saves us quite a lot of code and buffering. */
-	size = recv( fd, buf, sizeof( buf ) - 1, MSG_PEEK );
-	if( size == 0 || ( size < 0 && !sockerr_again() ) )
-		return NULL;
-	else if( size < 0 ) /* && sockerr_again() */
-		return( g_strdup( "" ) );
-	else
-		buf[size] = 0;
-	
-	if( ( eol = strstr( buf, "\r\n" ) ) == NULL )
-		return NULL;
-	else
-		size = eol - buf + 2;
+	int st;
 	
 	iov.iov_base = buf;
 	iov.iov_len = size;
@@ -579,71 +637,163 @@ static char *ipc_readline( int fd, int *recv_fd )
 	msg.msg_controllen = sizeof( ccmsg );
 #endif
 	
-	if( recvmsg( fd, &msg, 0 ) != size )
-		return NULL;
+	st = recvmsg( fd, &msg, 0 );
+	if( st == 0 || ( st < 0 && !( errno == EAGAIN || errno == EWOULDBLOCK || sockerr_again() ) ) )
+		return -1;
+	else if( st < 0 )
+		return 0;
 	
 #ifndef NO_FD_PASSING
-	if( recv_fd )
-		for( cmsg = CMSG_FIRSTHDR( &msg ); cmsg; cmsg = CMSG_NXTHDR( &msg, cmsg ) )
-			if( cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS )
+	/* The kernel won't return data sent after a passed fd in the same
+	   call, so the fd belongs with the last line read here. */
+	for( cmsg = CMSG_FIRSTHDR( &msg ); cmsg; cmsg = CMSG_NXTHDR( &msg, cmsg ) )
+		if( cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS )
+		{
+			int *fds = (int*) CMSG_DATA( cmsg );
+			int i, n = ( cmsg->cmsg_len - CMSG_LEN( 0 ) ) / sizeof( int );
+			
+			/* Getting more than one shouldn't happen but if it does,
+			   make sure we don't leave them around. */
+			for( i = 0; i < n; i ++ )
 			{
-				/* Getting more than one shouldn't happen but if it does,
-				   make sure we don't leave them around. */
 				if( *recv_fd != -1 )
 					close( *recv_fd );
 				
-				*recv_fd = *(int*) CMSG_DATA( cmsg );
-				/*
-				fprintf( stderr, "pid %d received fd %d\n", (int) getpid(), *recv_fd );
-				*/
+				*recv_fd = fds[i];
 			}
+		}
 #endif
 	
-	/*
-	fprintf( stderr, "pid %d received: %s", (int) getpid(), buf );
-	*/
-	return g_strndup( buf, size - 2 );
+	return st;
+}
+
+/* Returns the next complete line from buf (and cuts it off), or NULL. */
+static char *ipc_getline( char *buf, int *pos, int len )
+{
+	char *line = buf + *pos, *s;
+	
+	for( s = line; ( s = memchr( s, '\r', buf + len - s ) ); s ++ )
+		if( s + 1 < buf + len && s[1] == '\n' )
+		{
+			*s = 0;
+			*pos = s + 2 - buf;
+			return line;
+		}
+	
+	return NULL;
 }
 
+/* Children can be freed by the commands they send, this is how we find
+   out. ipc_master_free_one() resets it. */
+static struct bitlbee_child *ipc_master_reading;
+
 gboolean ipc_master_read( gpointer data, gint source, b_input_condition cond )
 {
 	struct bitlbee_child *child = data;
-	char *buf, **cmd;
+	char *buf, *line, **cmd;
+	int st, len, pos = 0;
+	
+	if( child->in_buf == NULL )
+		child->in_buf = g_malloc( IPC_READ_SIZE );
 	
-	if( ( buf = ipc_readline( source, &child->to_fd ) ) )
+	st = ipc_recv( source, child->in_buf + child->in_len,
+	               IPC_READ_SIZE - child->in_len, &child->to_fd );
+	if( st < 0 )
 	{
-		cmd = irc_parse_line( buf );
+		ipc_master_free_one( child );
+		return TRUE;
+	}
+	
+	/* Hold on to the buffer ourselves, the child may go away. */
+	buf = child->in_buf;
+	len = child->in_len + st;
+	child->in_buf = NULL;
+	
+	ipc_master_reading = child;
+	while( ipc_master_reading && ( line = ipc_getline( buf, &pos, len ) ) )
+	{
+		cmd = irc_parse_line( line );
 		if( cmd )
 		{
 			ipc_command_exec( child, cmd, ipc_master_commands );
 			g_free( cmd );
 		}
+	}
+	
+	if( ipc_master_reading == NULL )
+	{
 		g_free( buf );
 	}
+	else if( len - pos == IPC_READ_SIZE )
+	{
+		/* That's not a line, that's garbage. */
+		g_free( buf );
+		ipc_master_free_one( child );
+	}
 	else
 	{
-		ipc_master_free_fd( source );
+		memmove( buf, buf + pos, len - pos );
+		child->in_buf = buf;
+		child->in_len = len - pos;
 	}
+	ipc_master_reading = NULL;
 	
 	return TRUE;
 }
 
+/* data is the IRC connection, or NULL for idle children that get it
+   from an ACCEPT command later. */
 gboolean ipc_child_read( gpointer data, gint source, b_input_condition cond )
 {
-	char *buf, **cmd;
+	static char buf[IPC_READ_SIZE];
+	static int len = 0;
+	irc_t *irc = data;
+	char *line, **cmd;
+	int st, pos = 0;
+	
+	st = ipc_recv( source, buf + len, sizeof( buf ) - len, &ipc_child_recv_fd );
+	if( st < 0 )
+	{
+		len = 0;
+		ipc_child_disable();
+		
+		/* An idle child without a master has no reason to live. */
+		if( irc_connection_list == NULL )
+			b_main_quit();
+		
+		return TRUE;
+	}
+	len += st;
 	
-	if( ( buf = ipc_readline( source, &ipc_child_recv_fd ) ) )
+	while( global.listen_socket == source && ( line = ipc_getline( buf, &pos, len ) ) )
 	{
-		cmd = irc_parse_line( buf );
+		if( irc == NULL && irc_connection_list )
+			irc = irc_connection_list->data;
+		
+		/* Stop if a command freed our (only) IRC connection. */
+		if( irc && !g_slist_find( irc_connection_list, irc ) )
+			break;
+		
+		cmd = irc_parse_line( line );
 		if( cmd )
 		{
-			ipc_command_exec( data, cmd, ipc_child_commands );
+			ipc_command_exec( irc, cmd, irc ? ipc_child_commands : ipc_idle_commands );
 			g_free( cmd );
 		}
-		g_free( buf );
 	}
-	else
+	
+	if( global.listen_socket != source )
 	{
+		len = 0;
+		return TRUE;
+	}
+	
+	memmove( buf, buf + pos, len - pos );
+	len -= pos;
+	
+	if( len == sizeof( buf ) )
+	{
+		len = 0;
 		ipc_child_disable();
 	}
 	
@@ -730,17 +880,22 @@ void ipc_to_children_str( char *format, ... )
 	}
 	else if( global.conf->runmode == RUNMODE_FORKDAEMON )
 	{
-		int msg_len = strlen( msg_buf );
+		struct ipc_buf *buf = ipc_buf_new( msg_buf, strlen( msg_buf ) );
 		GSList *l, *next;
 		
+		/* The buffer is the queues' now. */
+		msg_buf = NULL;
+		
 		for( l = child_list; l; l = next )
 		{
 			struct bitlbee_child *c = l->data;
 			
 			next = l->next;
-			if( write( c->ipc_fd, msg_buf, msg_len ) <= 0 )
+			if( !ipc_master_send( c, buf ) )
 				ipc_master_free_one( c );
 		}
+		
+		ipc_buf_unref( buf );
 	}
 	else if( global.conf->runmode == RUNMODE_DAEMON )
 	{
@@ -757,7 +912,9 @@ void ipc_to_children_str( char *format, ... )
 	g_free( msg_buf );
 }
 
-static gboolean ipc_send_fd( int fd, int send_fd )
+/* Returns what sendmsg() returns. The fd goes out with the first byte, so
+   a short write can be finished with a normal write(). */
+static int ipc_send_fd( int fd, int send_fd )
 {
 	struct msghdr msg;
 	struct iovec iov;
@@ -781,16 +938,216 @@ static gboolean ipc_send_fd( int fd, int send_fd )
 	msg.msg_controllen = cmsg->cmsg_len;
 #endif
 	
-	return sendmsg( fd, &msg, 0 ) == 6;
+	return sendmsg( fd, &msg, 0 );
+}
+
+/* Takes over data, which should be g_malloc()ed. */
+static struct ipc_buf *ipc_buf_new( char *data, int len )
+{
+	struct ipc_buf *buf = g_new0( struct ipc_buf, 1 );
+	
+	buf->ref = 1;
+	buf->data = data;
+	buf->len = len;
+	buf->send_fd = -1;
+	
+	return buf;
+}
+
+static void ipc_buf_unref( struct ipc_buf *buf )
+{
+	if( --buf->ref > 0 )
+		return;
+	
+	if( buf->send_fd != -1 )
+		close( buf->send_fd );
+	g_free( buf->data );
+	g_free( buf );
+}
+
+/* Write as much of the queue as the child will take. Returns FALSE if
+   the connection is broken. */
+static gboolean ipc_master_flush( struct bitlbee_child *c )
+{
+	while( c->out_len > 0 )
+	{
+		struct ipc_buf *buf = g_queue_peek_head( c->out );
+		int st;
+		
+		if( buf->send_fd != -1 && c->out_pos == 0 )
+		{
+			/* If this comes up short, the rest is written below
+			   and the fd doesn't need to be sent again. */
+			st = ipc_send_fd( c->ipc_fd, buf->send_fd );
+		}
+		else
+		{
+			st = write( c->ipc_fd, buf->data + c->out_pos, buf->len - c->out_pos );
+		}
+		
+		if( st < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK || sockerr_again() ) )
+			return TRUE;
+		else if( st <= 0 )
+			return FALSE;
+		
+		c->out_pos += st;
+		c->out_len -= st;
+		ipc_stats.queued -= st;
+		
+		if( c->out_pos == buf->len )
+		{
+			g_queue_pop_head( c->out );
+			ipc_buf_unref( buf );
+			c->out_pos = 0;
+		}
+	}
+	
+	return TRUE;
+}
+
+static gboolean ipc_master_write( gpointer data, gint source, b_input_condition cond )
+{
+	struct bitlbee_child *c = data;
+	
+	if( !ipc_master_flush( c ) )
+	{
+		ipc_master_free_one( c );
+		return FALSE;
+	}
+	else if( c->out_len > 0 )
+	{
+		return TRUE;
+	}
+	
+	c->out_inpa = 0;
+	return FALSE;
+}
+
+/* Queue a message and send as much as possible right away. Returns FALSE
+   if the child should be dropped (broken connection or a full queue). */
+static gboolean ipc_master_send( struct bitlbee_child *c, struct ipc_buf *buf )
+{
+	if( c->out_len + buf->len > IPC_MAX_QUEUED )
+	{
+		log_message( LOGLVL_WARNING, "IPC queue for child %d is full, disconnecting it", (int) c->pid );
+		ipc_stats.dropped ++;
+		return FALSE;
+	}
+	
+	if( c->out == NULL )
+		c->out = g_queue_new();
+	
+	buf->ref ++;
+	g_queue_push_tail( c->out, buf );
+	c->out_len += buf->len;
+	ipc_stats.queued += buf->len;
+	
+	if( !ipc_master_flush( c ) )
+		return FALSE;
+	
+	if( c->out_len == 0 )
+	{
+		ipc_stats.sent ++;
+		return TRUE;
+	}
+	
+	ipc_stats.deferred ++;
+	if( c->out_len > ipc_stats.max_queued )
+		ipc_stats.max_queued = c->out_len;
+	
+	if( c->out_inpa == 0 )
+		c->out_inpa = b_input_add( c->ipc_fd, B_EV_IO_WRITE, ipc_master_write, c );
+	
+	return TRUE;
+}
+
+static gboolean ipc_master_send_str( struct bitlbee_child *c, const char *str )
+{
+	struct ipc_buf *buf = ipc_buf_new( g_strdup( str ), strlen( str ) );
+	gboolean st = ipc_master_send( c, buf );
+	
+	ipc_buf_unref( buf );
+	return st;
+}
+
+/* The fd is dup()ed since it may be closed before the message goes out. */
+static gboolean ipc_master_send_fd( struct bitlbee_child *c, int send_fd )
+{
+	struct ipc_buf *buf;
+	gboolean st;
+	
+	if( ( send_fd = dup( send_fd ) ) == -1 )
+		return FALSE;
+	
+	buf = ipc_buf_new( g_strdup( "0x90\r\n" ), 6 );
+	buf->send_fd = send_fd;
+	st = ipc_master_send( c, buf );
+	
+	ipc_buf_unref( buf );
+	return st;
+}
+
+void ipc_master_pool_add( struct bitlbee_child *child )
+{
+	child->idle = TRUE;
+	child_pool = g_slist_prepend( child_pool, child );
+}
+
+/* Pass a new connection to an idle child, if there's one. Returns FALSE
+   (and leaves the fd alone) if there isn't. */
+gboolean ipc_master_pool_take( int fd )
+{
+	while( child_pool )
+	{
+		struct bitlbee_child *child = child_pool->data;
+		
+		child_pool = g_slist_remove( child_pool, child );
+		child->idle = FALSE;
+		
+		if( ipc_master_send_fd( child, fd ) &&
+		    ipc_master_send_str( child, "ACCEPT\r\n" ) )
+		{
+			close( fd );
+			return TRUE;
+		}
+		
+		ipc_master_free_one( child );
+	}
+	
+	return FALSE;
+}
+
+int ipc_master_pool_size()
+{
+	return g_slist_length( child_pool );
 }
 
 void ipc_master_free_one( struct bitlbee_child *c )
 {
 	GSList *l;
 	
+	if( c->idle )
+		child_pool = g_slist_remove( child_pool, c );
+	
 	b_event_remove( c->ipc_inpa );
+	if( c->out_inpa > 0 )
+		b_event_remove( c->out_inpa );
 	closesocket( c->ipc_fd );
 	
+	if( ipc_master_reading == c )
+		ipc_master_reading = NULL;
+	g_free( c->in_buf );
+	
+	if( c->out )
+	{
+		struct ipc_buf *buf;
+		
+		while( ( buf = g_queue_pop_head( c->out ) ) )
+			ipc_buf_unref( buf );
+		g_queue_free( c->out );
+		ipc_stats.queued -= c->out_len;
+	}
+	
 	if( c->to_fd != -1 )
 		close( c->to_fd );
 	
@@ -861,6 +1218,15 @@ char *ipc_master_save_state()
 	/* This is more convenient now. */
 	fp = fdopen( fd, "w" );
 	
+	/* Idle children can just go, the new master will fork its own. */
+	while( child_pool )
+	{
+		struct bitlbee_child *c = child_pool->data;
+		
+		if( write( c->ipc_fd, "DIE\r\n", 5 ) != 5 ) {}
+		ipc_master_free_one( c );
+	}
+	
 	for( l = child_list, i = 0; l; l = l->next )
 		i ++;
 	
@@ -895,6 +1261,8 @@ static gboolean new_ipc_client( gpointer data, gint serversock, b_input_conditio
 		log_message( LOGLVL_WARNING, "Unable to accept connection on UNIX domain socket: %s", strerror(errno) );
 		return TRUE;
 	}
+	
+	sock_make_nonblocking( child->ipc_fd );
 		
 	child->ipc_inpa = b_input_add( child->ipc_fd, B_EV_IO_READ, ipc_master_read, child );
 	
@@ -982,6 +1350,7 @@ int ipc_master_load_state( char *statefile )
 			fclose( fp );
 			return 0;
 		}
+		sock_make_nonblocking( child->ipc_fd );
 		child->ipc_inpa = b_input_add( child->ipc_fd, B_EV_IO_READ, ipc_master_read, child );
 		child->to_fd = -1;
 		
@@ -42,6 +42,46 @@ struct bitlbee_child
 	/* For takeovers: */
 	struct bitlbee_child *to_child;
 	int to_fd;
+	
+	/* Pre-forked, waiting for a connection. */
+	gboolean idle;
+	
+	/* Partial line read from the child, if any. */
+	char *in_buf;
+	int in_len;
+	
+	/* Messages (struct ipc_buf) the child didn't read yet. */
+	GQueue *out;
+	int out_pos;
+	int out_len;
+	gint out_inpa;
+};
+
+/* Messages to children are queued and written when the socket is ready.
+   Broadcasts use a single buffer shared by all queues. */
+struct ipc_buf
+{
+	int ref;
+	int len;
+	char *data;
+	int send_fd;            /* Passed along with the message, or -1. */
+};
+
+/* Lines are at most 512 bytes, read some more at once. */
+#define IPC_READ_SIZE 4096
+#define IPC_MAX_FDS 4
+
+/* A child with more than this much data in its queue isn't reading its
+   messages and will be disconnected. */
+#define IPC_MAX_QUEUED ( 256 * 1024 )
+
+struct ipc_stats
+{
+	guint64 sent;           /* Messages written right away, */
+	guint64 deferred;       /* and the ones that had to wait. */
+	guint64 dropped;        /* Children disconnected for not reading. */
+	int queued;             /* Bytes in all queues now, */
+	int max_queued;         /* and the most in one queue so far. */
 };
 
 
@@ -64,8 +104,14 @@ void ipc_to_children_str( char *format, ... ) G_GNUC_PRINTF( 1, 2 );
 /* We need this function in inetd mode, so let's just make it non-static. */
 void ipc_master_cmd_rehash( irc_t *data, char **cmd );
 
+/* The pool of idle ForkDaemon children. */
+void ipc_master_pool_add( struct bitlbee_child *child );
+gboolean ipc_master_pool_take( int fd );
+int ipc_master_pool_size();
+
 char *ipc_master_save_state();
 int ipc_master_load_state( char *statefile );
 int ipc_master_listen_socket();
 
 extern GSList *child_list;
+extern struct ipc_stats ipc_stats;
@@ -28,6 +28,7 @@
 #include "dcc.h"
 
 GSList *irc_connection_list;
+struct irc_charset_stats irc_charset_stats;
 GSList *irc_plugins;
 
 static gboolean irc_userping( gpointer _irc, gint fd, b_input_condition cond );
@@ -274,7 +275,8 @@ void irc_free( irc_t * irc )
 	if( irc->oconv != (GIConv) -1 )
 		g_iconv_close( irc->oconv );
 	
-	g_free( irc->sendbuffer );
+	if( irc->sendbuffer )
+		g_string_free( irc->sendbuffer, TRUE );
 	g_free( irc->readbuffer );
 	g_free( irc->password );
 	
@@ -325,6 +327,24 @@ static char *set_eval_password( set_t *set, char *value )
 
 static char **irc_splitlines( char *buffer );
 
+/* Most lines are plain ASCII, check that eight bytes at a time and only
+   leave the rest to the real UTF-8 validator. */
+static gboolean irc_utf8_validate( const char *s )
+{
+	const guint64 high = G_GINT64_CONSTANT( 0x8080808080808080U );
+	size_t len = strlen( s ), i;
+	guint64 w;
+	
+	for( i = 0; i + sizeof( w ) <= len; i += sizeof( w ) )
+	{
+		memcpy( &w, s + i, sizeof( w ) );
+		if( w & high )
+			break;
+	}
+	
+	return g_utf8_validate( s + i, len - i, NULL );
+}
+
 void irc_process( irc_t *irc )
 {
 	char **lines, *temp, **cmd;
@@ -349,14 +369,26 @@ void irc_process( irc_t *irc )
 				break;
 			}
 			
-			if( irc->iconv != (GIConv) -1 )
+			if( irc->utf8 || irc->iconv != (GIConv) -1 )
 			{
 				gsize bytes_read, bytes_written;
+				gboolean ok;
 				
-				conv = g_convert_with_iconv( lines[i], -1, irc->iconv,
-				                             &bytes_read, &bytes_written, NULL );
+				if( irc->utf8 )
+				{
+					/* Nothing to convert, just check it. */
+					ok = irc_utf8_validate( lines[i] );
+					irc_charset_stats.in_fast ++;
+				}
+				else
+				{
+					conv = g_convert_with_iconv( lines[i], -1, irc->iconv,
+					                             &bytes_read, &bytes_written, NULL );
+					ok = conv != NULL && bytes_read == strlen( lines[i] );
+					irc_charset_stats.in_iconv ++;
+				}
 				
-				if( conv == NULL || bytes_read != strlen( lines[i] ) )
+				if( !ok )
 				{
 					/* GLib can do strange things if things are not in the expected charset,
 					   so let's be a little bit paranoid here: */
@@ -385,7 +417,9 @@ void irc_process( irc_t *irc )
 								*temp = '?';
 					}
 				}
-				lines[i] = conv;
+				
+				if( conv || !ok )
+					lines[i] = conv;
 			}
 			
 			if( lines[i] && ( cmd = irc_parse_line( lines[i] ) ) )
@@ -574,8 +608,10 @@ void irc_write_all( int now, char *format, ... )
 		
 		if( now )
 		{
-			g_free( irc->sendbuffer );
-			irc->sendbuffer = g_strdup( "\r\n" );
+			if( irc->sendbuffer )
+				g_string_assign( irc->sendbuffer, "\r\n" );
+			else
+				irc->sendbuffer = g_string_new( "\r\n" );
 		}
 		irc_vawrite( temp->data, format, params );
 		if( now )
@@ -591,42 +627,43 @@ void irc_write_all( int now, char *format, ... )
 
 void irc_vawrite( irc_t *irc, char *format, va_list params )
 {
-	int size;
 	char line[IRC_MAX_LINE+1];
 		
 	/* Don't try to write anything new anymore when shutting down. */
 	if( irc->status & USTATUS_SHUTDOWN )
 		return;
 	
-	memset( line, 0, sizeof( line ) );
 	g_vsnprintf( line, IRC_MAX_LINE - 2, format, params );
 	strip_newlines( line );
 	
-	if( irc->oconv != (GIConv) -1 )
+	/* Everything's UTF-8 internally, so nothing to do in that case. */
+	if( irc->utf8 )
+	{
+		irc_charset_stats.out_fast ++;
+	}
+	else if( irc->oconv != (GIConv) -1 )
 	{
 		gsize bytes_read, bytes_written;
 		char *conv;
 		
+		irc_charset_stats.out_iconv ++;
+		
 		conv = g_convert_with_iconv( line, -1, irc->oconv,
 		                             &bytes_read, &bytes_written, NULL );
 
 		if( bytes_read == strlen( line ) )
+		{
 			strncpy( line, conv, IRC_MAX_LINE - 2 );
+			line[IRC_MAX_LINE-2] = '\0';
+		}
 		
 		g_free( conv );
 	}
 	g_strlcat( line, "\r\n", IRC_MAX_LINE + 1 );
 	
-	if( irc->sendbuffer != NULL )
-	{
-		size = strlen( irc->sendbuffer ) + strlen( line );
-		irc->sendbuffer = g_renew ( char, irc->sendbuffer, size + 1 );
-		strcpy( ( irc->sendbuffer + strlen( irc->sendbuffer ) ), line );
-	}
-	else
-	{
-		irc->sendbuffer = g_strdup(line);
-	}
+	if( irc->sendbuffer == NULL )
+		irc->sendbuffer = g_string_sized_new( IRC_MAX_LINE + 1 );
+	g_string_append( irc->sendbuffer, line );
 	
 	if( irc->w_watch_source_id == 0 )
 	{
@@ -654,10 +691,10 @@ void irc_flush( irc_t *irc )
 	if( irc->sendbuffer == NULL )
 		return;
 	
-	len = strlen( irc->sendbuffer );
-	if( ( n = send( irc->fd, irc->sendbuffer, len, 0 ) ) == len )
+	len = irc->sendbuffer->len;
+	if( ( n = send( irc->fd, irc->sendbuffer->str, len, 0 ) ) == len )
 	{
-		g_free( irc->sendbuffer );
+		g_string_free( irc->sendbuffer, TRUE );
 		irc->sendbuffer = NULL;
 		
 		b_event_remove( irc->w_watch_source_id );
@@ -665,9 +702,7 @@ void irc_flush( irc_t *irc )
 	}
 	else if( n > 0 )
 	{
-		char *s = g_strdup( irc->sendbuffer + n );
-		g_free( irc->sendbuffer );
-		irc->sendbuffer = s;
+		g_string_erase( irc->sendbuffer, 0, n );
 	}
 	/* Otherwise something went wrong and we don't currently care
 	   what the error was. We may or may not succeed later, we
@@ -685,7 +720,7 @@ void irc_switch_fd( irc_t *irc, int fd )
 	{
 		b_event_remove( irc->w_watch_source_id );
 		irc->w_watch_source_id = 0;
-		g_free( irc->sendbuffer );
+		g_string_free( irc->sendbuffer, TRUE );
 		irc->sendbuffer = NULL;
 	}
 	
@@ -896,6 +931,19 @@ static char *set_eval_charset( set_t *set, char *value )
 
 	if( g_strcasecmp( value, "none" ) == 0 )
 		value = g_strdup( "utf-8" );
+	
+	/* Same as what we use internally: skip iconv completely. */
+	if( g_strcasecmp( value, "utf-8" ) == 0 || g_strcasecmp( value, "utf8" ) == 0 )
+	{
+		if( irc->iconv != (GIConv) -1 )
+			g_iconv_close( irc->iconv );
+		if( irc->oconv != (GIConv) -1 )
+			g_iconv_close( irc->oconv );
+		
+		irc->iconv = irc->oconv = (GIConv) -1;
+		irc->utf8 = TRUE;
+		return value;
+	}
 
 	if( ( oc = g_iconv_open( value, "utf-8" ) ) == (GIConv) -1 )
 	{
@@ -928,6 +976,7 @@ static char *set_eval_charset( set_t *set, char *value )
 	
 	irc->iconv = ic;
 	irc->oconv = oc;
+	irc->utf8 = FALSE;
 
 	return value;
 }
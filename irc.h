@@ -69,9 +69,10 @@ typedef struct irc
 	irc_status_t status;
 	double last_pong;
 	int pinging;
-	char *sendbuffer;
+	GString *sendbuffer;
 	char *readbuffer;
 	GIConv iconv, oconv;
+	gboolean utf8; /* charset is UTF-8: no iconv needed, just validation. */
 
 	struct irc_user *root;
 	struct irc_user *user;
@@ -95,6 +96,9 @@ typedef struct irc
 	gint ping_source_id;
 	gint login_source_id; /* To slightly delay some events at login time. */
 	
+	int mode_batch; /* See irc_send_mode_batch(). */
+	GSList *mode_pending;
+	
 	struct otr *otr; /* OTR state and book keeping, used by the OTR plugin.
 	                    TODO: Some mechanism for plugindata. */
 	
@@ -263,6 +267,14 @@ extern GSList *irc_plugins; /* struct irc_plugin */
 /* irc.c */
 extern GSList *irc_connection_list;
 
+/* How many lines went in/out with/without going through iconv. */
+struct irc_charset_stats
+{
+	guint64 in_fast, in_iconv;
+	guint64 out_fast, out_iconv;
+};
+extern struct irc_charset_stats irc_charset_stats;
+
 irc_t *irc_new( int fd );
 void irc_abort( irc_t *irc, int immed, char *format, ... ) G_GNUC_PRINTF( 3, 4 );
 void irc_free( irc_t *irc );
@@ -334,6 +346,7 @@ void irc_send_msg_f( irc_user_t *iu, const char *type, const char *dst, const ch
 void irc_send_nick( irc_user_t *iu, const char *new_nick );
 void irc_send_channel_user_mode_diff( irc_channel_t *ic, irc_user_t *iu,
                                       irc_channel_user_flags_t old_flags, irc_channel_user_flags_t new_flags );
+void irc_send_mode_batch( irc_t *irc, gboolean start );
 void irc_send_invite( irc_user_t *iu, irc_channel_t *ic );
 
 /* irc_user.c */
@@ -139,6 +139,11 @@ static gboolean bee_irc_user_status( bee_t *bee, bee_user_t *bu, bee_user_t *old
 	return TRUE;
 }
 
+static void bee_irc_user_status_batch( bee_t *bee, gboolean start )
+{
+	irc_send_mode_batch( bee->ui_data, start );
+}
+
 void bee_irc_channel_update( irc_t *irc, irc_channel_t *ic, irc_user_t *iu )
 {
 	GSList *l;
@@ -237,17 +242,13 @@ static gboolean bee_irc_user_msg( bee_t *bee, bee_user_t *bu, const char *msg_,
 		}
 	}
 	
+	/* msg is our own copy by now, so this can be done in-place. */
 	if( ( g_strcasecmp( set_getstr( &bee->set, "strip_html" ), "always" ) == 0 ) ||
 	    ( ( bu->ic->flags & OPT_DOES_HTML ) && set_getbool( &bee->set, "strip_html" ) ) )
-	{
-		char *s = g_strdup( msg );
-		strip_html( s );
-		g_free( msg );
-		msg = s;
-	}
+		strip_html( msg );
 	
-	wrapped = word_wrap( msg, 425 );
-	irc_send_msg( iu, "PRIVMSG", dst, wrapped, prefix );
+	wrapped = strlen( msg ) > 425 ? word_wrap( msg, 425 ) : NULL;
+	irc_send_msg( iu, "PRIVMSG", dst, wrapped ? wrapped : msg, prefix );
 	
 	g_free( wrapped );
 	g_free( prefix );
@@ -1080,6 +1081,7 @@ const struct bee_ui_funcs irc_ui_funcs = {
 	bee_irc_user_nick_hint,
 	bee_irc_user_group,
 	bee_irc_user_status,
+	bee_irc_user_status_batch,
 	bee_irc_user_msg,
 	bee_irc_user_typing,
 	bee_irc_user_action_response,
@@ -319,43 +319,34 @@ void irc_send_who( irc_t *irc, GSList *l, const char *channel )
 
 void irc_send_msg( irc_user_t *iu, const char *type, const char *dst, const char *msg, const char *prefix )
 {
-	char last = 0;
-	const char *s = msg, *line = msg;
-	char raw_msg[strlen(msg)+1024];
+	const char *line = msg, *end;
+	gboolean can_act = ( !prefix || !*prefix ) && g_strcasecmp( type, "PRIVMSG" ) == 0;
+	int len;
 	
-	while( !last )
+	if( prefix == NULL )
+		prefix = "";
+	
+	/* One line per line of the message, formatted straight into the
+	   output buffer. A trailing newline doesn't count as an empty line. */
+	while( 1 )
 	{
-		if( *s == '\r' && *(s+1) == '\n' )
-			s++;
-		if( *s == '\n' )
-		{
-			last = s[1] == 0;
-		}
+		if( ( end = strchr( line, '\n' ) ) )
+			len = end - line;
 		else
-		{
-			last = s[0] == 0;
-		}
-		if( *s == 0 || *s == '\n' )
-		{
-			if( g_strncasecmp( line, "/me ", 4 ) == 0 && ( !prefix || !*prefix ) &&
-			    g_strcasecmp( type, "PRIVMSG" ) == 0 )
-			{
-				strcpy( raw_msg, "\001ACTION " );
-				strncat( raw_msg, line + 4, s - line - 4 );
-				strcat( raw_msg, "\001" );
-				irc_send_msg_raw( iu, type, dst, raw_msg );
-			}
-			else
-			{
-				*raw_msg = '\0';
-				if( prefix && *prefix )
-					strcpy( raw_msg, prefix );
-				strncat( raw_msg, line, s - line );
-				irc_send_msg_raw( iu, type, dst, raw_msg );
-			}
-			line = s + 1;
-		}
-		s ++;
+			len = strlen( line );
+		
+		if( can_act && g_strncasecmp( line, "/me ", 4 ) == 0 )
+			irc_write( iu->irc, ":%s!%s@%s %s %s :\001ACTION %.*s\001",
+			           iu->nick, iu->user, iu->host, type, dst, len - 4, line + 4 );
+		else if( *prefix || len > 0 )
+			irc_write( iu->irc, ":%s!%s@%s %s %s :%s%.*s",
+			           iu->nick, iu->user, iu->host, type, dst, prefix, len, line );
+		else
+			irc_send_msg_raw( iu, type, dst, NULL );
+		
+		if( end == NULL || end[1] == '\0' )
+			break;
+		line = end + 1;
 	}
 }
 
@@ -384,54 +375,156 @@ void irc_send_nick( irc_user_t *iu, const char *new )
 	           iu->nick, iu->user, iu->host, new );
 }
 
+/* Max. number of user mode changes to put in one MODE line. */
+#define IRC_MODE_BATCH_MAX 6
+
+struct irc_mode_change
+{
+	irc_channel_t *ic;
+	char *nick;
+	irc_channel_user_flags_t old, new;
+};
+
+static const struct
+{
+	irc_channel_user_flags_t flag;
+	char mode;
+} irc_channel_user_modes[] = {
+	{ IRC_CHANNEL_USER_OP, 'o' },
+	{ IRC_CHANNEL_USER_HALFOP, 'h' },
+	{ IRC_CHANNEL_USER_VOICE, 'v' },
+};
+
+static void irc_send_mode_line( irc_channel_t *ic, GString *modes, GString *nicks )
+{
+	irc_t *irc = ic->irc;
+	
+	if( set_getbool( &irc->b->set, "simulate_netsplit" ) )
+		irc_write( irc, ":%s MODE %s %s%s", irc->root->host, ic->name, modes->str, nicks->str );
+	else
+		irc_write( irc, ":%s!%s@%s MODE %s %s%s", irc->root->nick, irc->root->user,
+		           irc->root->host, ic->name, modes->str, nicks->str );
+}
+
+/* Send a list of struct irc_mode_change for one channel, as few lines as
+   possible. */
+static void irc_send_mode_changes( irc_channel_t *ic, GSList *changes )
+{
+	GString *modes = g_string_sized_new( 2 * IRC_MODE_BATCH_MAX );
+	GString *nicks = g_string_sized_new( 128 );
+	char sign = 0;
+	int i, n = 0;
+	
+	for( ; changes; changes = changes->next )
+	{
+		struct irc_mode_change *c = changes->data;
+		
+		for( i = 0; i < sizeof( irc_channel_user_modes ) / sizeof( irc_channel_user_modes[0] ); i ++ )
+		{
+			irc_channel_user_flags_t flag = irc_channel_user_modes[i].flag;
+			char s = c->new & flag ? '+' : '-';
+			
+			if( ( c->old & flag ) == ( c->new & flag ) )
+				continue;
+			
+			if( n == IRC_MODE_BATCH_MAX )
+			{
+				irc_send_mode_line( ic, modes, nicks );
+				g_string_truncate( modes, 0 );
+				g_string_truncate( nicks, 0 );
+				sign = 0;
+				n = 0;
+			}
+			
+			if( s != sign )
+				g_string_append_c( modes, sign = s );
+			g_string_append_c( modes, irc_channel_user_modes[i].mode );
+			g_string_append_printf( nicks, " %s", c->nick );
+			n ++;
+		}
+	}
+	
+	if( n > 0 )
+		irc_send_mode_line( ic, modes, nicks );
+	
+	g_string_free( modes, TRUE );
+	g_string_free( nicks, TRUE );
+}
+
+static void irc_mode_change_free( struct irc_mode_change *c )
+{
+	g_free( c->nick );
+	g_free( c );
+}
+
 /* Send an update of a user's mode inside a channel, compared to what it was. */
 void irc_send_channel_user_mode_diff( irc_channel_t *ic, irc_user_t *iu,
 	irc_channel_user_flags_t old, irc_channel_user_flags_t new )
 {
-	char changes[3*(5+strlen(iu->nick))];
-	char from[strlen(ic->irc->root->nick)+strlen(ic->irc->root->user)+strlen(ic->irc->root->host)+3];
-	int n;
+	struct irc_mode_change *c = g_new0( struct irc_mode_change, 1 );
+	GSList l = { c, NULL };
 	
-	*changes = '\0'; n = 0;
-	if( ( old & IRC_CHANNEL_USER_OP ) != ( new & IRC_CHANNEL_USER_OP ) )
-	{
-		n ++;
-		if( new & IRC_CHANNEL_USER_OP )
-			strcat( changes, "+o" );
-		else
-			strcat( changes, "-o" );
-	}
-	if( ( old & IRC_CHANNEL_USER_HALFOP ) != ( new & IRC_CHANNEL_USER_HALFOP ) )
-	{
-		n ++;
-		if( new & IRC_CHANNEL_USER_HALFOP )
-			strcat( changes, "+h" );
-		else
-			strcat( changes, "-h" );
-	}
-	if( ( old & IRC_CHANNEL_USER_VOICE ) != ( new & IRC_CHANNEL_USER_VOICE ) )
+	c->ic = ic;
+	c->nick = g_strdup( iu->nick );
+	c->old = old;
+	c->new = new;
+	
+	if( ic->irc->mode_batch > 0 )
 	{
-		n ++;
-		if( new & IRC_CHANNEL_USER_VOICE )
-			strcat( changes, "+v" );
-		else
-			strcat( changes, "-v" );
+		ic->irc->mode_pending = g_slist_prepend( ic->irc->mode_pending, c );
+		return;
 	}
-	while( n )
+	
+	irc_send_mode_changes( ic, &l );
+	irc_mode_change_free( c );
+}
+
+/* Between a start and an end call, channel user mode changes are held back
+   and then sent as a few combined MODE lines per channel. Only use this
+   around code that won't also send other (PART/QUIT/NICK) updates for the
+   same users, since those would go out before the MODEs. */
+void irc_send_mode_batch( irc_t *irc, gboolean start )
+{
+	GSList *pending;
+	
+	if( start )
 	{
-		strcat( changes, " " );
-		strcat( changes, iu->nick );
-		n --;
+		irc->mode_batch ++;
+		return;
 	}
 	
-	if( set_getbool( &ic->irc->b->set, "simulate_netsplit" ) )
-		g_snprintf( from, sizeof( from ), "%s", ic->irc->root->host );
-	else
-		g_snprintf( from, sizeof( from ), "%s!%s@%s", ic->irc->root->nick,
-		            ic->irc->root->user, ic->irc->root->host );
+	if( irc->mode_batch == 0 || -- irc->mode_batch > 0 )
+		return;
 	
-	if( *changes )
-		irc_write( ic->irc, ":%s MODE %s %s", from, ic->name, changes );
+	pending = g_slist_reverse( irc->mode_pending );
+	irc->mode_pending = NULL;
+	
+	while( pending )
+	{
+		irc_channel_t *ic = ( (struct irc_mode_change *) pending->data )->ic;
+		GSList *mine = NULL, *rest = NULL, *l;
+		
+		for( l = pending; l; l = l->next )
+		{
+			struct irc_mode_change *c = l->data;
+			
+			if( c->ic == ic )
+				mine = g_slist_prepend( mine, c );
+			else
+				rest = g_slist_prepend( rest, c );
+		}
+		g_slist_free( pending );
+		mine = g_slist_reverse( mine );
+		pending = g_slist_reverse( rest );
+		
+		/* Just in case the channel disappeared in the meantime. */
+		if( g_slist_find( irc->channels, ic ) && ( ic->flags & IRC_CHANNEL_JOINED ) )
+			irc_send_mode_changes( ic, mine );
+		
+		for( l = mine; l; l = l->next )
+			irc_mode_change_free( l->data );
+		g_slist_free( mine );
+	}
 }
 
 void irc_send_invite( irc_user_t *iu, irc_channel_t *ic )
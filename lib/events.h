@@ -84,4 +84,24 @@ G_MODULE_EXPORT void b_event_remove(gint id);
    done (the caller is expected to do so but may miss it sometimes). */
 G_MODULE_EXPORT void closesocket(int fd);
 
+/* Optional profiling of the event loop (events_profile.c), off by default.
+   The backends call handlers through B_EV_CALL() and tell the profiler when
+   they go to sleep/wake up, so when it's disabled all it costs is a check
+   of b_event_profiling. */
+extern gboolean b_event_profiling;
+
+#define B_EV_CALL( func, data, fd, cond ) \
+	( b_event_profiling ? b_event_profile_call( func, data, fd, cond ) : (func)( data, fd, cond ) )
+
+G_MODULE_EXPORT gboolean b_event_profile_call(b_event_handler func, gpointer data, gint fd, b_input_condition cond);
+G_MODULE_EXPORT void b_event_profile_wake();
+G_MODULE_EXPORT void b_event_profile_sleep();
+
+G_MODULE_EXPORT void b_event_profile_enable(gboolean enable);
+G_MODULE_EXPORT void b_event_profile_reset();
+
+/* Human-readable report as a list of g_malloc()ed lines, listing at most
+   max_sites handlers (the ones that took most time). */
+G_MODULE_EXPORT GSList *b_event_profile_report(int max_sites);
+
 #endif /* _EVENTS_H_ */
@@ -0,0 +1,623 @@
+  /********************************************************************\
+  * BitlBee -- An IRC to other IM-networks gateway                     *
+  *                                                                    *
+  * Copyright 2002-2012 Wilmer van der Gaast and others                *
+  \********************************************************************/
+
+/*
+ * Event handling (using epoll directly, Linux only)
+ */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License with
+  the Debian GNU/Linux distribution in /usr/share/common-licenses/GPL;
+  if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+  Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Every fd with a handler is in epoll, edge-triggered and only for the
+   directions that have a handler. When a handler goes away and the fd
+   still has another one, the extra direction stays registered until it
+   fires once, so the write watch that's added and removed for every line
+   costs one syscall instead of two. An fd is taken out of epoll as soon
+   as its last handler is removed (or the fd is closed through
+   closesocket()): closing an fd doesn't take it out of epoll if a forked
+   child still has it open, and a stale registration would get events
+   meant for some other fd with the same number later on.
+
+   The rest of BitlBee expects level-triggered behaviour though: handlers
+   don't necessarily read everything available, and a new handler for a
+   socket that's readable already should get called. Registering an fd
+   again (EPOLL_CTL_MOD, or _ADD if it's not in there yet) makes the
+   kernel check it and report it if it's ready, so that's done for every
+   new handler and after every handler that wants to be called again.
+   If the kernel disagrees about the fd being in there (it got closed
+   behind our back and reused), the other operation is tried.
+
+   Timers are kept in a heap, with a timerfd for the first one due. */
+
+#define BITLBEE_CORE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "proxy.h"
+
+#define B_EPOLL_BATCH 128
+
+struct b_event_data
+{
+	gint id;
+	gint fd;                /* -1 for timers. */
+	b_input_condition flags;
+	b_event_handler function;
+	gpointer data;
+
+	gint timeout;           /* Timers only, from here. */
+	gint64 due;
+	gint heap_idx;
+};
+
+struct b_fd_state
+{
+	struct b_event_data *r, *w;
+	guint8 ready;           /* B_EV_IO_* we believe the fd is ready for. */
+	guint8 armed;           /* B_EV_IO_* registered with epoll. */
+	guint8 queued;          /* On the dispatch list already? */
+};
+
+static int epfd = -1;
+static int timer_fd = -1;
+static gint64 timer_armed; /* Due time the timerfd is set to, or 0. */
+
+static struct b_fd_state *fds;
+static gint fds_size;
+static GArray *dispatch; /* fds with events to handle. */
+
+static GHashTable *id_hash;
+static gint id_next = 1; /* Next ID to be allocated to an event handler. */
+static gint id_cur = 0; /* Event ID that we're currently handling. */
+static gboolean id_dead; /* Set if b_event_remove removes id_cur. */
+
+static struct b_event_data **heap;
+static gint heap_len, heap_size;
+
+static int quitting = 0; /* Prepare to quit, stop handling events. */
+static int restarted = 0; /* b_main_init() was called from a handler. */
+
+static gint64 b_now()
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (gint64) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void b_main_init()
+{
+	struct epoll_event ev;
+
+	if( epfd >= 0 )
+	{
+		/* This happens in ForkDaemon children. All events of the old
+		   loop are dead now, and the epoll instance is shared with
+		   the parent so we need a new one. */
+		close( epfd );
+		close( timer_fd );
+		g_hash_table_destroy( id_hash );
+
+		g_free( fds );
+		fds = NULL;
+		fds_size = 0;
+		g_free( heap );
+		heap = NULL;
+		heap_len = heap_size = 0;
+		g_array_set_size( dispatch, 0 );
+
+		restarted = 1;
+	}
+	else
+	{
+		dispatch = g_array_new( FALSE, FALSE, sizeof( gint ) );
+	}
+
+	/* The records of the old loop are leaked, like with libevent, since
+	   we can't know what's still pointing at them. */
+	id_hash = g_hash_table_new( g_direct_hash, g_direct_equal );
+
+	if( ( epfd = epoll_create1( EPOLL_CLOEXEC ) ) < 0 ||
+	    ( timer_fd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC ) ) < 0 )
+		g_error( "Couldn't set up epoll: %s", strerror( errno ) );
+
+	memset( &ev, 0, sizeof( ev ) );
+	ev.events = EPOLLIN;
+	ev.data.fd = timer_fd;
+	epoll_ctl( epfd, EPOLL_CTL_ADD, timer_fd, &ev );
+	timer_armed = 0;
+}
+
+static struct b_fd_state *b_fd_state( gint fd )
+{
+	if( fd >= fds_size )
+	{
+		gint new_size = fds_size ? fds_size : 64;
+
+		while( new_size <= fd )
+			new_size *= 2;
+
+		fds = g_renew( struct b_fd_state, fds, new_size );
+		memset( fds + fds_size, 0, ( new_size - fds_size ) * sizeof( struct b_fd_state ) );
+		fds_size = new_size;
+	}
+
+	return &fds[fd];
+}
+
+static void b_fd_queue( gint fd )
+{
+	struct b_fd_state *st = &fds[fd];
+
+	if( !st->queued )
+	{
+		st->queued = 1;
+		g_array_append_val( dispatch, fd );
+	}
+}
+
+/* (Re)register the fd for the directions it has handlers for, which
+   makes the kernel report it once more if it's ready already. */
+static void b_fd_arm( gint fd )
+{
+	struct b_fd_state *st = &fds[fd];
+	struct epoll_event ev;
+	int op = st->armed ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
+	memset( &ev, 0, sizeof( ev ) );
+	ev.events = EPOLLET;
+	if( st->r )
+		ev.events |= EPOLLIN | EPOLLRDHUP;
+	if( st->w )
+		ev.events |= EPOLLOUT;
+	ev.data.fd = fd;
+
+	st->armed = ( st->r ? B_EV_IO_READ : 0 ) | ( st->w ? B_EV_IO_WRITE : 0 );
+
+	/* If the kernel disagrees with what we think is registered, try
+	   the other one. */
+	if( epoll_ctl( epfd, op, fd, &ev ) == 0 )
+		return;
+	else if( op == EPOLL_CTL_ADD && errno == EEXIST )
+		op = EPOLL_CTL_MOD;
+	else if( op == EPOLL_CTL_MOD && errno == ENOENT )
+		op = EPOLL_CTL_ADD;
+	else
+		op = -1;
+
+	if( op == -1 || epoll_ctl( epfd, op, fd, &ev ) < 0 )
+		event_debug( "epoll_ctl( %d ) failed: %s ", fd, strerror( errno ) );
+}
+
+static void b_fd_unregister( gint fd )
+{
+	struct epoll_event ev;
+
+	/* Not there anymore is fine. (The event argument is unused, but
+	   old kernels want one.) */
+	memset( &ev, 0, sizeof( ev ) );
+	epoll_ctl( epfd, EPOLL_CTL_DEL, fd, &ev );
+	fds[fd].ready = 0;
+	fds[fd].armed = 0;
+}
+
+/* Timer heap, ordered by due time. */
+
+static void b_heap_set( gint i, struct b_event_data *b_ev )
+{
+	heap[i] = b_ev;
+	b_ev->heap_idx = i;
+}
+
+static void b_heap_up( gint i )
+{
+	struct b_event_data *b_ev = heap[i];
+
+	while( i > 0 && heap[(i-1)/2]->due > b_ev->due )
+	{
+		b_heap_set( i, heap[(i-1)/2] );
+		i = ( i - 1 ) / 2;
+	}
+	b_heap_set( i, b_ev );
+}
+
+static void b_heap_down( gint i )
+{
+	struct b_event_data *b_ev = heap[i];
+
+	while( i * 2 + 1 < heap_len )
+	{
+		gint c = i * 2 + 1;
+
+		if( c + 1 < heap_len && heap[c+1]->due < heap[c]->due )
+			c ++;
+		if( heap[c]->due >= b_ev->due )
+			break;
+
+		b_heap_set( i, heap[c] );
+		i = c;
+	}
+	b_heap_set( i, b_ev );
+}
+
+static void b_heap_insert( struct b_event_data *b_ev )
+{
+	if( heap_len == heap_size )
+	{
+		heap_size = heap_size ? heap_size * 2 : 64;
+		heap = g_renew( struct b_event_data*, heap, heap_size );
+	}
+
+	b_heap_set( heap_len ++, b_ev );
+	b_heap_up( heap_len - 1 );
+}
+
+static void b_heap_remove( struct b_event_data *b_ev )
+{
+	gint i = b_ev->heap_idx;
+
+	if( --heap_len > i )
+	{
+		b_heap_set( i, heap[heap_len] );
+		b_heap_up( i );
+		b_heap_down( heap[i]->heap_idx );
+	}
+	b_ev->heap_idx = -1;
+}
+
+/* Point the timerfd at the first timer due, if that changed. */
+static void b_timer_arm()
+{
+	struct itimerspec its;
+	gint64 due = heap_len > 0 ? heap[0]->due : 0;
+
+	if( due == timer_armed )
+		return;
+
+	memset( &its, 0, sizeof( its ) );
+	if( due > 0 )
+	{
+		/* 0 would disarm the timer. */
+		its.it_value.tv_sec = due / 1000;
+		its.it_value.tv_nsec = ( due % 1000 ) * 1000000 + 1;
+	}
+
+	timerfd_settime( timer_fd, TFD_TIMER_ABSTIME, &its, NULL );
+	timer_armed = due;
+}
+
+/* Call a handler and clean up after it like the other backends do.
+   Returns TRUE if the handler is still there. */
+static gboolean b_event_call( struct b_event_data *b_ev, gint fd, b_input_condition cond )
+{
+	gboolean st;
+
+	event_debug( "b_event_call( %d, %d ) (%d)\n", fd, cond, b_ev->id );
+
+	/* Since the called function might cancel this handler already
+	   (which free()s b_ev), we have to remember the ID here. */
+	id_cur = b_ev->id;
+	id_dead = FALSE;
+
+	st = B_EV_CALL( b_ev->function, b_ev->data, fd, cond );
+	if( id_dead || restarted )
+	{
+		/* This event was killed already, don't touch it! */
+		return FALSE;
+	}
+	else if( ( !st && !( b_ev->flags & B_EV_FLAG_FORCE_REPEAT ) ) ||
+	         ( b_ev->flags & B_EV_FLAG_FORCE_ONCE ) )
+	{
+		event_debug( "Handler returned FALSE: " );
+		b_event_remove( id_cur );
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void b_run_timers()
+{
+	gint64 now = b_now();
+	GSList *due = NULL, *l;
+
+	/* Collect them first, so timers that are re-added (with a short
+	   timeout) don't run again right away. */
+	while( heap_len > 0 && heap[0]->due <= now )
+	{
+		struct b_event_data *b_ev = heap[0];
+
+		b_heap_remove( b_ev );
+		due = g_slist_prepend( due, GINT_TO_POINTER( b_ev->id ) );
+	}
+	due = g_slist_reverse( due );
+
+	for( l = due; l && !quitting && !restarted; l = l->next )
+	{
+		struct b_event_data *b_ev = g_hash_table_lookup( id_hash, l->data );
+
+		/* Removed by one of the other timers? */
+		if( b_ev == NULL )
+			continue;
+
+		if( b_event_call( b_ev, -1, 0 ) )
+		{
+			b_ev->due = b_now() + b_ev->timeout;
+			b_heap_insert( b_ev );
+		}
+	}
+	g_slist_free( due );
+}
+
+static void b_dispatch_fd( gint fd )
+{
+	struct b_fd_state *st = &fds[fd];
+	b_input_condition ready = st->ready;
+	struct b_event_data *b_ev;
+	gboolean again = FALSE;
+
+	st->queued = 0;
+	st->ready = 0;
+
+	if( ( ready & B_EV_IO_READ ) && ( b_ev = st->r ) )
+	{
+		b_input_condition cond = B_EV_IO_READ;
+
+		/* One handler for both directions gets called just once. */
+		if( b_ev == st->w && ( ready & B_EV_IO_WRITE ) )
+		{
+			cond |= B_EV_IO_WRITE;
+			ready &= ~B_EV_IO_WRITE;
+		}
+
+		/* Still there afterwards? Then it may not have read
+		   everything, so it has to be reported again if it's still
+		   ready. */
+		again = b_event_call( b_ev, fd, cond );
+
+		if( restarted )
+			return;
+	}
+
+	if( ( ready & B_EV_IO_WRITE ) && fd < fds_size && ( b_ev = fds[fd].w ) )
+		again |= b_event_call( b_ev, fd, B_EV_IO_WRITE );
+
+	if( again && !restarted && fd < fds_size && ( fds[fd].r || fds[fd].w ) )
+		b_fd_arm( fd );
+}
+
+static void b_main_iteration()
+{
+	struct epoll_event evs[B_EPOLL_BATCH];
+	gint i, n, timeout = -1;
+
+	if( dispatch->len > 0 )
+		timeout = 0;
+
+	if( b_event_profiling )
+		b_event_profile_sleep();
+
+	n = epoll_wait( epfd, evs, B_EPOLL_BATCH, timeout );
+
+	if( b_event_profiling )
+		b_event_profile_wake();
+	if( n < 0 && errno != EINTR )
+		g_error( "epoll_wait() failed: %s", strerror( errno ) );
+
+	for( i = 0; i < n; i ++ )
+	{
+		gint fd = evs[i].data.fd;
+		struct b_fd_state *st;
+		guint64 exp;
+
+		if( fd == timer_fd )
+		{
+			/* Just clear it, b_run_timers() checks the clock. */
+			if( read( timer_fd, &exp, sizeof( exp ) ) < 0 ) {}
+			timer_armed = 0;
+			continue;
+		}
+
+		if( fd >= fds_size )
+			continue;
+
+		st = &fds[fd];
+		if( evs[i].events & ( EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR ) )
+			st->ready |= B_EV_IO_READ;
+		if( evs[i].events & ( EPOLLOUT | EPOLLHUP | EPOLLERR ) )
+			st->ready |= B_EV_IO_WRITE;
+
+		if( st->ready & ( ( st->r ? B_EV_IO_READ : 0 ) | ( st->w ? B_EV_IO_WRITE : 0 ) ) )
+		{
+			b_fd_queue( fd );
+		}
+		else
+		{
+			/* A direction nobody's interested in anymore, stop
+			   listening for it. */
+			st->ready = 0;
+			if( st->r || st->w )
+				b_fd_arm( fd );
+		}
+	}
+
+	/* Handlers may add more fds to the list, those will wait for the
+	   next round. */
+	n = dispatch->len;
+	for( i = 0; i < n && !quitting && !restarted; i ++ )
+		b_dispatch_fd( g_array_index( dispatch, gint, i ) );
+
+	if( !restarted )
+		g_array_remove_range( dispatch, 0, MIN( n, dispatch->len ) );
+
+	if( !quitting && !restarted )
+		b_run_timers();
+
+	if( !restarted )
+		b_timer_arm();
+}
+
+void b_main_run()
+{
+	while( !quitting )
+	{
+		if( restarted )
+		{
+			event_debug( "New event loop.\n" );
+			restarted = 0;
+			b_timer_arm();
+		}
+
+		b_main_iteration();
+	}
+
+	/* Like with GLib, the loop can be started again after quitting. */
+	quitting = 0;
+}
+
+void b_main_quit()
+{
+	quitting = 1;
+}
+
+gint b_input_add( gint fd, b_input_condition condition, b_event_handler function, gpointer data )
+{
+	struct b_fd_state *st;
+	struct b_event_data *b_ev;
+
+	event_debug( "b_input_add( %d, %d, 0x%x, 0x%x ) ", fd, condition, function, data );
+
+	st = b_fd_state( fd );
+
+	/* Like with libevent there's only one handler per fd-condition,
+	   a new one replaces the old one. */
+	if( condition & B_EV_IO_READ && st->r )
+		b_event_remove( st->r->id );
+	if( condition & B_EV_IO_WRITE && st->w )
+		b_event_remove( st->w->id );
+
+	b_ev = g_new0( struct b_event_data, 1 );
+	b_ev->id = id_next++;
+	b_ev->fd = fd;
+	b_ev->flags = condition;
+	b_ev->function = function;
+	b_ev->data = data;
+	b_ev->heap_idx = -1;
+
+	if( condition & B_EV_IO_READ )
+		st->r = b_ev;
+	if( condition & B_EV_IO_WRITE )
+		st->w = b_ev;
+
+	g_hash_table_insert( id_hash, GINT_TO_POINTER( b_ev->id ), b_ev );
+
+	/* It may well be ready already, with no edge to tell us. If the fd
+	   was closed without us knowing, b_fd_arm() finds out. */
+	b_fd_arm( fd );
+
+	event_debug( "= %d\n", b_ev->id );
+
+	return b_ev->id;
+}
+
+gint b_timeout_add( gint timeout, b_event_handler function, gpointer data )
+{
+	struct b_event_data *b_ev = g_new0( struct b_event_data, 1 );
+
+	b_ev->id = id_next++;
+	b_ev->fd = -1;
+	b_ev->timeout = timeout;
+	b_ev->function = function;
+	b_ev->data = data;
+	b_ev->due = b_now() + timeout;
+
+	b_heap_insert( b_ev );
+	g_hash_table_insert( id_hash, GINT_TO_POINTER( b_ev->id ), b_ev );
+
+	event_debug( "b_timeout_add( %d, 0x%x, 0x%x ) = %d\n", timeout, function, data, b_ev->id );
+
+	return b_ev->id;
+}
+
+void b_event_remove( gint id )
+{
+	struct b_event_data *b_ev = g_hash_table_lookup( id_hash, GINT_TO_POINTER( id ) );
+
+	event_debug( "b_event_remove( %d )\n", id );
+	if( b_ev )
+	{
+		if( id == id_cur )
+			id_dead = TRUE;
+
+		g_hash_table_remove( id_hash, GINT_TO_POINTER( id ) );
+
+		if( b_ev->fd >= 0 )
+		{
+			struct b_fd_state *st = &fds[b_ev->fd];
+
+			if( st->r == b_ev )
+				st->r = NULL;
+			if( st->w == b_ev )
+				st->w = NULL;
+			if( st->r == NULL && st->w == NULL )
+				b_fd_unregister( b_ev->fd );
+		}
+		else if( b_ev->heap_idx >= 0 )
+		{
+			b_heap_remove( b_ev );
+		}
+
+		g_free( b_ev );
+	}
+	else
+	{
+		event_debug( "Already removed?\n" );
+	}
+}
+
+void closesocket( int fd )
+{
+	if( fd >= 0 && fd < fds_size )
+	{
+		struct b_fd_state *st = &fds[fd];
+
+		if( st->r )
+		{
+			event_debug( "Warning: fd %d still had a read event handler when shutting down.\n", fd );
+			b_event_remove( st->r->id );
+		}
+		if( st->w )
+		{
+			event_debug( "Warning: fd %d still had a write event handler when shutting down.\n", fd );
+			b_event_remove( st->w->id );
+		}
+
+		/* Closing it isn't enough if a child process still has it
+		   open. (Removing the last handler did this already.) */
+		b_fd_unregister( fd );
+	}
+
+	close( fd );
+}
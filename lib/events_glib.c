@@ -52,11 +52,33 @@ typedef struct _GaimIOClosure {
 } GaimIOClosure;
 
 static GMainLoop *loop = NULL;
+static GPollFunc poll_func = NULL;
+
+/* Only here so the profiler can see when GLib goes to sleep. */
+static gint b_main_poll(GPollFD *ufds, guint nfds, gint timeout)
+{
+	gint st;
+	
+	if (b_event_profiling)
+		b_event_profile_sleep();
+	
+	st = poll_func(ufds, nfds, timeout);
+	
+	if (b_event_profiling)
+		b_event_profile_wake();
+	
+	return st;
+}
 
 void b_main_init()
 {
 	if( loop == NULL )
+	{
 		loop = g_main_new( FALSE );
+		
+		poll_func = g_main_context_get_poll_func( NULL );
+		g_main_context_set_poll_func( NULL, b_main_poll );
+	}
 }
 
 void b_main_run()
@@ -85,7 +107,7 @@ static gboolean gaim_io_invoke(GIOChannel *source, GIOCondition condition, gpoin
 	
 	event_debug( "gaim_io_invoke( %d, %d, 0x%x )\n", g_io_channel_unix_get_fd(source), condition, data );
 
-	st = closure->function(closure->data, g_io_channel_unix_get_fd(source), gaim_cond);
+	st = B_EV_CALL(closure->function, closure->data, g_io_channel_unix_get_fd(source), gaim_cond);
 	
 	if( !st )
 		event_debug( "Returned FALSE, cancelling.\n" );
@@ -130,12 +152,35 @@ gint b_input_add(gint source, b_input_condition condition, b_event_handler funct
 	return st;
 }
 
+static gboolean gaim_timeout_invoke(gpointer data)
+{
+	GaimIOClosure *closure = data;
+	
+	return b_event_profile_call(closure->function, closure->data, -1, 0);
+}
+
 gint b_timeout_add(gint timeout, b_event_handler func, gpointer data)
 {
-	/* GSourceFunc and the BitlBee event handler function aren't
-	   really the same, but they're "compatible". ;-) It will do
-	   for now, BitlBee only looks at the "data" argument. */
-	gint st = g_timeout_add(timeout, (GSourceFunc) func, data);
+	gint st;
+	
+	if (b_event_profiling)
+	{
+		/* Timers have to be wrapped to be seen by the profiler, so
+		   only the ones added while it's enabled will be. */
+		GaimIOClosure *closure = g_new0(GaimIOClosure, 1);
+		
+		closure->function = func;
+		closure->data = data;
+		st = g_timeout_add_full(G_PRIORITY_DEFAULT, timeout, gaim_timeout_invoke,
+		                        closure, gaim_io_destroy);
+	}
+	else
+	{
+		/* GSourceFunc and the BitlBee event handler function aren't
+		   really the same, but they're "compatible". ;-) It will do
+		   for now, BitlBee only looks at the "data" argument. */
+		st = g_timeout_add(timeout, (GSourceFunc) func, data);
+	}
 	
 	event_debug( "b_timeout_add( %d, %d, %d ) = %d\n", timeout, func, data, st );
 	
@@ -36,18 +36,17 @@
 #include "proxy.h"
 
 static void b_main_restart();
-static guint id_next = 1; /* Next ID to be allocated to an event handler. */
 static guint id_cur = 0; /* Event ID that we're currently handling. */
 static guint id_dead; /* Set to 1 if b_event_remove removes id_cur. */
-static GHashTable *id_hash;
 static int quitting = 0; /* Prepare to quit, stop handling events. */
 
 /* Since libevent doesn't handle two event handlers for one fd-condition
    very well (which happens sometimes when BitlBee changes event handlers
    for a combination), let's buid some indexes so we can delete them here
-   already, just in time. */
-static GHashTable *read_hash;
-static GHashTable *write_hash;
+   already, just in time. Indexed by fd. */
+static struct b_event_data **read_fds;
+static struct b_event_data **write_fds;
+static gint fds_size;
 
 struct event_base *leh;
 struct event_base *old_leh;
@@ -60,41 +59,216 @@ struct b_event_data
 	b_event_handler function;
 	void *data;
 	guint flags;
+	
+	/* Timers on the wheel (see below) don't use evinfo. */
+	gboolean wheel;
+	gint slot;              /* -1 if not on the wheel (anymore). */
+	guint rounds;           /* Full turns left before it's due. */
+	struct b_event_data *prev, *next;
+	
+	gboolean live;
 };
 
+/* Event records come from slabs that are never freed, and go on a free
+   list when they're removed, so adding and removing handlers doesn't
+   malloc()/free() all the time. Event IDs are handed out in increasing
+   order like they always were, and looked up in one hash table: BitlBee
+   calls b_event_remove() with stale IDs all the time, so an ID must never
+   come back while it may still be in use somewhere. */
+#define B_EV_SLAB_SIZE 256
+
+static struct b_event_data **ev_slabs;
+static guint ev_slab_count;
+static struct b_event_data *ev_free_head, *ev_free_tail;
+static GHashTable *ev_ids;
+static guint id_next = 1;
+
+/* Most timers (pings, keepalives, reconnects) are seconds or minutes long
+   and don't care much about precision, so instead of giving each of them
+   a libevent timer, they go on a hashed timer wheel driven by a single
+   libevent timer: WHEEL_SLOTS lists of timers, one of which is handled
+   every WHEEL_TICK ms. Timers longer than one turn wait for their rounds
+   counter to run out. Adding/removing a timer is O(1). Shorter timeouts
+   (usually "do this right after returning to the main loop") still get
+   a precise libevent timer. */
+#define WHEEL_TICK 100
+#define WHEEL_SLOTS 512
+#define WHEEL_MIN_TIMEOUT 1000
+
+/* One extra list for the slot that is being handled at the moment. */
+static struct b_event_data *wheel[WHEEL_SLOTS+1];
+static gint wheel_cur;
+static gint64 wheel_time; /* Time (ms) of the last tick handled. */
+static gint wheel_count;
+static gboolean wheel_armed;
+static struct event wheel_ev;
+
+static void b_wheel_arm();
+
 void b_main_init()
 {
 	if( leh != NULL )
 	{
-		/* Clean up the hash tables? */
-		
 		b_main_restart();
 		old_leh = leh;
 	}
 	
 	leh = event_init();
 	
-	id_hash = g_hash_table_new( g_int_hash, g_int_equal );
-	read_hash = g_hash_table_new( g_int_hash, g_int_equal );
-	write_hash = g_hash_table_new( g_int_hash, g_int_equal );
+	if( old_leh != NULL )
+	{
+		guint i;
+		
+		/* Forget about all events of the old loop. The records stay
+		   out of the free list since the old event base may still
+		   point at them. */
+		for( i = 0; i < ev_slab_count * B_EV_SLAB_SIZE; i ++ )
+			ev_slabs[i/B_EV_SLAB_SIZE][i%B_EV_SLAB_SIZE].live = FALSE;
+		
+		g_hash_table_destroy( ev_ids );
+		ev_ids = NULL;
+		
+		if( fds_size > 0 )
+		{
+			memset( read_fds, 0, fds_size * sizeof( struct b_event_data* ) );
+			memset( write_fds, 0, fds_size * sizeof( struct b_event_data* ) );
+		}
+		
+		memset( wheel, 0, sizeof( wheel ) );
+		wheel_count = 0;
+		wheel_armed = FALSE;
+	}
+}
+
+/* Give the record a new ID, the old one won't match anymore. */
+static void b_event_new_id( struct b_event_data *b_ev )
+{
+	if( ev_ids == NULL )
+		ev_ids = g_hash_table_new( g_direct_hash, g_direct_equal );
+	
+	if( b_ev->id > 0 )
+		g_hash_table_remove( ev_ids, GUINT_TO_POINTER( b_ev->id ) );
+	
+	/* IDs have to be > 0 and fit in a gint. Only after a wraparound
+	   could the next one still be in use. */
+	while( id_next == 0 || id_next > G_MAXINT ||
+	       g_hash_table_lookup( ev_ids, GUINT_TO_POINTER( id_next ) ) )
+		id_next = id_next == 0 || id_next > G_MAXINT ? 1 : id_next + 1;
+	
+	b_ev->id = id_next ++;
+	g_hash_table_insert( ev_ids, GUINT_TO_POINTER( b_ev->id ), b_ev );
+}
+
+static struct b_event_data *b_event_alloc()
+{
+	struct b_event_data *b_ev;
+	
+	if( ev_free_head == NULL )
+	{
+		struct b_event_data *slab;
+		guint i;
+		
+		slab = g_new0( struct b_event_data, B_EV_SLAB_SIZE );
+		ev_slabs = g_renew( struct b_event_data*, ev_slabs, ev_slab_count + 1 );
+		ev_slabs[ev_slab_count] = slab;
+		
+		for( i = 0; i < B_EV_SLAB_SIZE; i ++ )
+			slab[i].next = i + 1 < B_EV_SLAB_SIZE ? &slab[i+1] : NULL;
+		ev_free_head = slab;
+		ev_free_tail = &slab[B_EV_SLAB_SIZE-1];
+		ev_slab_count ++;
+	}
+	
+	b_ev = ev_free_head;
+	if( ( ev_free_head = b_ev->next ) == NULL )
+		ev_free_tail = NULL;
+	
+	memset( b_ev, 0, sizeof( struct b_event_data ) );
+	b_event_new_id( b_ev );
+	b_ev->live = TRUE;
+	
+	return b_ev;
+}
+
+static void b_event_free( struct b_event_data *b_ev )
+{
+	g_hash_table_remove( ev_ids, GUINT_TO_POINTER( b_ev->id ) );
+	b_ev->id = 0;
+	b_ev->live = FALSE;
+	b_ev->next = NULL;
+	
+	if( ev_free_tail )
+		ev_free_tail->next = b_ev;
+	else
+		ev_free_head = b_ev;
+	ev_free_tail = b_ev;
+}
+
+static struct b_event_data *b_event_find( gint id )
+{
+	struct b_event_data *b_ev;
+	
+	if( id <= 0 || ev_ids == NULL )
+		return NULL;
+	
+	b_ev = g_hash_table_lookup( ev_ids, GINT_TO_POINTER( id ) );
+	
+	return b_ev && b_ev->live ? b_ev : NULL;
+}
+
+static struct b_event_data *b_fd_get( struct b_event_data **fds, gint fd )
+{
+	return fd >= 0 && fd < fds_size ? fds[fd] : NULL;
+}
+
+static void b_fd_set( struct b_event_data ***fds, gint fd, struct b_event_data *b_ev )
+{
+	if( fd < 0 )
+		return;
+	
+	if( fd >= fds_size )
+	{
+		gint new_size = fds_size ? fds_size : 64;
+		
+		while( new_size <= fd )
+			new_size *= 2;
+		
+		read_fds = g_renew( struct b_event_data*, read_fds, new_size );
+		write_fds = g_renew( struct b_event_data*, write_fds, new_size );
+		memset( read_fds + fds_size, 0, ( new_size - fds_size ) * sizeof( struct b_event_data* ) );
+		memset( write_fds + fds_size, 0, ( new_size - fds_size ) * sizeof( struct b_event_data* ) );
+		fds_size = new_size;
+	}
+	
+	(*fds)[fd] = b_ev;
 }
 
 void b_main_run()
 {
-	/* This while loop is necessary to exit the event loop and start a
-	   different one (necessary for ForkDaemon mode). */
-	while( event_base_dispatch( leh ) == 0 && !quitting )
+	/* One iteration at a time, so we can switch to a different event
+	   loop (necessary for ForkDaemon mode), and so the profiler can see
+	   where one iteration ends. */
+	while( !quitting )
 	{
+		if( b_event_profiling )
+			b_event_profile_sleep();
+		
+		if( event_base_loop( leh, EVLOOP_ONCE ) != 0 )
+			break;
+		
 		if( old_leh != NULL )
 		{
 			/* For some reason this just isn't allowed...
 			   Possibly a bug in older versions, will see later.
 			event_base_free( old_leh ); */
 			old_leh = NULL;
+			
+			event_debug( "New event loop.\n" );
 		}
-		
-		event_debug( "New event loop.\n" );
 	}
+	
+	/* Like with GLib, the loop can be started again after quitting. */
+	quitting = 0;
 }
 
 static void b_main_restart()
@@ -144,7 +318,12 @@ static void b_event_passthrough( int fd, short event, void *data )
 		return;
 	}
 	
-	st = b_ev->function( b_ev->data, fd, cond );
+	/* libevent doesn't tell us when it wakes up, so the first handler
+	   called in an iteration marks the start of it. */
+	if( b_event_profiling )
+		b_event_profile_wake();
+	
+	st = B_EV_CALL( b_ev->function, b_ev->data, fd, cond );
 	if( id_dead )
 	{
 		/* This event was killed already, don't touch it! */
@@ -174,26 +353,24 @@ gint b_input_add( gint fd, b_input_condition condition, b_event_handler function
 	
 	event_debug( "b_input_add( %d, %d, 0x%x, 0x%x ) ", fd, condition, function, data );
 	
-	if( ( condition & B_EV_IO_READ  && ( b_ev = g_hash_table_lookup( read_hash,  &fd ) ) ) ||
-	    ( condition & B_EV_IO_WRITE && ( b_ev = g_hash_table_lookup( write_hash, &fd ) ) ) )
+	if( ( condition & B_EV_IO_READ  && ( b_ev = b_fd_get( read_fds,  fd ) ) ) ||
+	    ( condition & B_EV_IO_WRITE && ( b_ev = b_fd_get( write_fds, fd ) ) ) )
 	{
 		/* We'll stick with this libevent entry, but give it a new BitlBee id. */
-		g_hash_table_remove( id_hash, &b_ev->id );
+		event_debug( "(replacing old handler (id = %d)) ", b_ev->id );
 		
-		event_debug( "(replacing old handler (id = %d)) = %d\n", b_ev->id, id_next );
-		
-		b_ev->id = id_next++;
+		b_event_new_id( b_ev );
 		b_ev->function = function;
 		b_ev->data = data;
+		
+		event_debug( "= %d\n", b_ev->id );
 	}
 	else
 	{
 		GIOCondition out_cond;
 		
-		event_debug( "(new) = %d\n", id_next );
-		
-		b_ev = g_new0( struct b_event_data, 1 );
-		b_ev->id = id_next++;
+		b_ev = b_event_alloc();
+		b_ev->slot = -1;
 		b_ev->function = function;
 		b_ev->data = data;
 		
@@ -207,43 +384,193 @@ gint b_input_add( gint fd, b_input_condition condition, b_event_handler function
 		event_add( &b_ev->evinfo, NULL );
 		
 		if( out_cond & EV_READ )
-			g_hash_table_insert( read_hash, &b_ev->evinfo.ev_fd, b_ev );
+			b_fd_set( &read_fds, fd, b_ev );
 		if( out_cond & EV_WRITE )
-			g_hash_table_insert( write_hash, &b_ev->evinfo.ev_fd, b_ev );
+			b_fd_set( &write_fds, fd, b_ev );
+		
+		event_debug( "(new) = %d\n", b_ev->id );
 	}
 	
 	b_ev->flags = condition;
-	g_hash_table_insert( id_hash, &b_ev->id, b_ev );
 	return b_ev->id;
 }
 
-/* TODO: Persistence for timers! */
+static gint64 b_wheel_now()
+{
+	struct timeval tv;
+	
+	gettimeofday( &tv, NULL );
+	return (gint64) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static void b_wheel_link( struct b_event_data *b_ev, gint slot )
+{
+	b_ev->slot = slot;
+	b_ev->prev = NULL;
+	b_ev->next = wheel[slot];
+	if( wheel[slot] )
+		wheel[slot]->prev = b_ev;
+	wheel[slot] = b_ev;
+}
+
+static void b_wheel_unlink( struct b_event_data *b_ev )
+{
+	if( b_ev->slot < 0 )
+		return;
+	
+	if( b_ev->prev )
+		b_ev->prev->next = b_ev->next;
+	else
+		wheel[b_ev->slot] = b_ev->next;
+	if( b_ev->next )
+		b_ev->next->prev = b_ev->prev;
+	
+	b_ev->slot = -1;
+	b_ev->prev = b_ev->next = NULL;
+	wheel_count --;
+}
+
+static void b_wheel_insert( struct b_event_data *b_ev )
+{
+	gint64 now = b_wheel_now();
+	guint ticks;
+	
+	if( wheel_count == 0 && !wheel_armed )
+		wheel_time = now;
+	
+	/* Count from the last tick, which may be a bit in the past. */
+	ticks = ( now - wheel_time + b_ev->timeout + WHEEL_TICK - 1 ) / WHEEL_TICK;
+	if( ticks == 0 )
+		ticks = 1;
+	
+	b_ev->rounds = ( ticks - 1 ) / WHEEL_SLOTS;
+	b_wheel_link( b_ev, ( wheel_cur + ticks ) % WHEEL_SLOTS );
+	wheel_count ++;
+	
+	b_wheel_arm();
+}
+
+static void b_wheel_fire( struct b_event_data *b_ev )
+{
+	gboolean st;
+	
+	event_debug( "b_wheel_fire( 0x%x ) (%d)\n", (int) b_ev, b_ev->id );
+	
+	id_cur = b_ev->id;
+	id_dead = 0;
+	
+	st = B_EV_CALL( b_ev->function, b_ev->data, -1, 0 );
+	if( id_dead )
+	{
+		/* This event was killed already, don't touch it! */
+		return;
+	}
+	else if( !st && !( b_ev->flags & B_EV_FLAG_FORCE_REPEAT ) )
+	{
+		event_debug( "Handler returned FALSE: " );
+		b_event_remove( id_cur );
+	}
+	else
+	{
+		b_wheel_insert( b_ev );
+	}
+}
+
+static void b_wheel_tick( int fd, short event, void *data )
+{
+	gint64 now = b_wheel_now();
+	struct b_event_data *b_ev;
+	
+	wheel_armed = FALSE;
+	
+	if( b_event_profiling )
+		b_event_profile_wake();
+	
+	while( wheel_count > 0 && wheel_time + WHEEL_TICK <= now && !quitting )
+	{
+		wheel_time += WHEEL_TICK;
+		wheel_cur = ( wheel_cur + 1 ) % WHEEL_SLOTS;
+		
+		/* Move the slot out of the way first, repeating timers with
+		   a timeout of exactly one turn go right back into it. */
+		wheel[WHEEL_SLOTS] = wheel[wheel_cur];
+		wheel[wheel_cur] = NULL;
+		for( b_ev = wheel[WHEEL_SLOTS]; b_ev; b_ev = b_ev->next )
+			b_ev->slot = WHEEL_SLOTS;
+		
+		while( ( b_ev = wheel[WHEEL_SLOTS] ) )
+		{
+			b_wheel_unlink( b_ev );
+			
+			if( b_ev->rounds > 0 )
+			{
+				b_ev->rounds --;
+				b_wheel_link( b_ev, wheel_cur );
+				wheel_count ++;
+			}
+			else
+			{
+				b_wheel_fire( b_ev );
+			}
+		}
+	}
+	
+	b_wheel_arm();
+}
+
+/* Make sure the libevent timer is set if there's anything on the wheel. */
+static void b_wheel_arm()
+{
+	struct timeval tv;
+	gint64 wait;
+	
+	if( wheel_armed || wheel_count == 0 || quitting )
+		return;
+	
+	wait = wheel_time + WHEEL_TICK - b_wheel_now();
+	if( wait < 0 )
+		wait = 0;
+	
+	tv.tv_sec = wait / 1000;
+	tv.tv_usec = ( wait % 1000 ) * 1000;
+	
+	evtimer_set( &wheel_ev, b_wheel_tick, NULL );
+	evtimer_add( &wheel_ev, &tv );
+	wheel_armed = TRUE;
+}
+
 gint b_timeout_add( gint timeout, b_event_handler function, gpointer data )
 {
-	struct b_event_data *b_ev = g_new0( struct b_event_data, 1 );
+	struct b_event_data *b_ev = b_event_alloc();
 	struct timeval tv;
 	
-	b_ev->id = id_next++;
 	b_ev->timeout = timeout;
 	b_ev->function = function;
 	b_ev->data = data;
+	b_ev->slot = -1;
 	
-	tv.tv_sec = timeout / 1000;
-	tv.tv_usec = ( timeout % 1000 ) * 1000;
-	
-	evtimer_set( &b_ev->evinfo, b_event_passthrough, b_ev );
-	evtimer_add( &b_ev->evinfo, &tv );
+	if( timeout >= WHEEL_MIN_TIMEOUT )
+	{
+		b_ev->wheel = TRUE;
+		b_wheel_insert( b_ev );
+	}
+	else
+	{
+		tv.tv_sec = timeout / 1000;
+		tv.tv_usec = ( timeout % 1000 ) * 1000;
+		
+		evtimer_set( &b_ev->evinfo, b_event_passthrough, b_ev );
+		evtimer_add( &b_ev->evinfo, &tv );
+	}
 	
 	event_debug( "b_timeout_add( %d, 0x%x, 0x%x ) = %d\n", timeout, function, data, b_ev->id );
 	
-	g_hash_table_insert( id_hash, &b_ev->id, b_ev );
-	
 	return b_ev->id;
 }
 
 void b_event_remove( gint id )
 {
-	struct b_event_data *b_ev = g_hash_table_lookup( id_hash, &id );
+	struct b_event_data *b_ev = b_event_find( id );
 	
 	event_debug( "b_event_remove( %d )\n", id );
 	if( b_ev )
@@ -251,17 +578,22 @@ void b_event_remove( gint id )
 		if( id == id_cur )
 			id_dead = TRUE;
 		
-		g_hash_table_remove( id_hash, &b_ev->id );
-		if( b_ev->evinfo.ev_fd >= 0 )
+		if( b_ev->wheel )
+		{
+			b_wheel_unlink( b_ev );
+			b_event_free( b_ev );
+			return;
+		}
+		else if( b_ev->evinfo.ev_fd >= 0 )
 		{
 			if( b_ev->evinfo.ev_events & EV_READ )
-				g_hash_table_remove( read_hash, &b_ev->evinfo.ev_fd );
+				b_fd_set( &read_fds, b_ev->evinfo.ev_fd, NULL );
 			if( b_ev->evinfo.ev_events & EV_WRITE )
-				g_hash_table_remove( write_hash, &b_ev->evinfo.ev_fd );
+				b_fd_set( &write_fds, b_ev->evinfo.ev_fd, NULL );
 		}
 		
 		event_del( &b_ev->evinfo );
-		g_free( b_ev );
+		b_event_free( b_ev );
 	}
 	else
 	{
@@ -279,12 +611,12 @@ void closesocket( int fd )
 	   get a little bit messed up. So this little function will remove the handlers
 	   properly before closing a socket. */
 	
-	if( ( b_ev = g_hash_table_lookup( read_hash, &fd ) ) )
+	if( ( b_ev = b_fd_get( read_fds, fd ) ) )
 	{
 		event_debug( "Warning: fd %d still had a read event handler when shutting down.\n", fd );
 		b_event_remove( b_ev->id );
 	}
-	if( ( b_ev = g_hash_table_lookup( write_hash, &fd ) ) )
+	if( ( b_ev = b_fd_get( write_fds, fd ) ) )
 	{
 		event_debug( "Warning: fd %d still had a write event handler when shutting down.\n", fd );
 		b_event_remove( b_ev->id );
@@ -0,0 +1,237 @@
+  /********************************************************************\
+  * BitlBee -- An IRC to other IM-networks gateway                     *
+  *                                                                    *
+  * Copyright 2002-2012 Wilmer van der Gaast and others                *
+  \********************************************************************/
+
+/*
+ * Event loop profiling: which handlers take up most of the loop's time,
+ * and how long the loop is busy (unable to respond) per iteration.
+ */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License with
+  the Debian GNU/Linux distribution in /usr/share/common-licenses/GPL;
+  if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+  Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* For dladdr(). */
+#endif
+#define BITLBEE_CORE
+#include "bitlbee.h"
+#include <sys/time.h>
+#ifdef HAVE_DLADDR
+#include <dlfcn.h>
+#endif
+
+gboolean b_event_profiling = FALSE;
+
+struct b_event_site
+{
+	b_event_handler function;
+	guint calls;
+	gint64 total;           /* All times in microseconds. */
+	gint64 max;
+};
+
+/* Upper bounds of the iteration time histogram buckets, the last bucket
+   has everything longer than that. */
+static const gint64 b_event_buckets[] = { 100, 1000, 10000, 100000, 1000000 };
+#define B_EV_BUCKETS ( sizeof( b_event_buckets ) / sizeof( b_event_buckets[0] ) + 1 )
+
+static GHashTable *b_event_sites;
+static guint b_event_hist[B_EV_BUCKETS];
+static guint b_event_iterations;
+static gint64 b_event_busy_max;
+static gint64 b_event_woke; /* 0 if we're not in an iteration. */
+static time_t b_event_since;
+
+static gint64 b_event_profile_now()
+{
+	struct timeval tv;
+
+	gettimeofday( &tv, NULL );
+	return (gint64) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+gboolean b_event_profile_call( b_event_handler func, gpointer data, gint fd, b_input_condition cond )
+{
+	struct b_event_site *site;
+	gint64 start, took;
+	gboolean st;
+
+	start = b_event_profile_now();
+	st = func( data, fd, cond );
+	took = b_event_profile_now() - start;
+
+	/* Profiling may have been turned off by this very handler. */
+	if( b_event_sites == NULL )
+		return st;
+
+	if( ( site = g_hash_table_lookup( b_event_sites, (gpointer) func ) ) == NULL )
+	{
+		site = g_new0( struct b_event_site, 1 );
+		site->function = func;
+		g_hash_table_insert( b_event_sites, (gpointer) func, site );
+	}
+
+	site->calls ++;
+	site->total += took;
+	if( took > site->max )
+		site->max = took;
+
+	return st;
+}
+
+/* Can be called more than once per iteration, only the first call counts. */
+void b_event_profile_wake()
+{
+	if( b_event_woke == 0 )
+		b_event_woke = b_event_profile_now();
+}
+
+void b_event_profile_sleep()
+{
+	gint64 busy;
+	int i;
+
+	if( b_event_woke == 0 )
+		return;
+
+	busy = b_event_profile_now() - b_event_woke;
+	b_event_woke = 0;
+
+	for( i = 0; i < B_EV_BUCKETS - 1; i ++ )
+		if( busy < b_event_buckets[i] )
+			break;
+
+	b_event_hist[i] ++;
+	b_event_iterations ++;
+	if( busy > b_event_busy_max )
+		b_event_busy_max = busy;
+}
+
+static gboolean b_event_profile_drop( gpointer key, gpointer value, gpointer data )
+{
+	return TRUE;
+}
+
+void b_event_profile_reset()
+{
+	if( b_event_sites )
+		g_hash_table_foreach_remove( b_event_sites, b_event_profile_drop, NULL );
+
+	memset( b_event_hist, 0, sizeof( b_event_hist ) );
+	b_event_iterations = 0;
+	b_event_busy_max = 0;
+	b_event_woke = 0;
+	b_event_since = time( NULL );
+}
+
+void b_event_profile_enable( gboolean enable )
+{
+	if( enable && b_event_sites == NULL )
+	{
+		b_event_sites = g_hash_table_new_full( g_direct_hash, g_direct_equal, NULL, g_free );
+		b_event_profile_reset();
+	}
+	else if( !enable && b_event_sites )
+	{
+		g_hash_table_destroy( b_event_sites );
+		b_event_sites = NULL;
+	}
+
+	b_event_profiling = enable;
+}
+
+/* Try to get a name for a handler. Only works for exported symbols (the
+   binary is linked with --export-dynamic), otherwise give an address that
+   can be fed to addr2line. */
+static char *b_event_profile_name( b_event_handler func )
+{
+#ifdef HAVE_DLADDR
+	Dl_info info;
+
+	if( dladdr( (void*) func, &info ) && info.dli_fname )
+	{
+		const char *file = strrchr( info.dli_fname, '/' );
+
+		if( info.dli_sname && info.dli_saddr == (void*) func )
+			return g_strdup( info.dli_sname );
+
+		return g_strdup_printf( "%s+0x%lx", file ? file + 1 : info.dli_fname,
+		                        (unsigned long) ( (char*) func - (char*) info.dli_fbase ) );
+	}
+#endif
+
+	return g_strdup_printf( "%p", (void*) func );
+}
+
+static void b_event_profile_collect( gpointer key, gpointer value, gpointer data )
+{
+	GSList **sites = data;
+
+	*sites = g_slist_prepend( *sites, value );
+}
+
+static gint b_event_profile_cmp( gconstpointer a_, gconstpointer b_ )
+{
+	const struct b_event_site *a = a_, *b = b_;
+
+	return a->total < b->total ? 1 : a->total > b->total ? -1 : 0;
+}
+
+GSList *b_event_profile_report( int max_sites )
+{
+	GSList *ret = NULL, *sites = NULL, *l;
+	GString *hist;
+	int i;
+
+	if( b_event_sites == NULL )
+		return g_slist_append( ret, g_strdup( "Event loop profiling is disabled" ) );
+
+	ret = g_slist_append( ret, g_strdup_printf( "Event loop profile of the last %d seconds: "
+	                      "%u iterations, longest %.1f ms",
+	                      (int) ( time( NULL ) - b_event_since ), b_event_iterations,
+	                      b_event_busy_max / 1000.0 ) );
+
+	hist = g_string_new( "Busy time per iteration:" );
+	for( i = 0; i < B_EV_BUCKETS; i ++ )
+	{
+		gint64 bound = b_event_buckets[i < B_EV_BUCKETS - 1 ? i : i - 1];
+
+		g_string_append_printf( hist, " %s%g ms: %u", i < B_EV_BUCKETS - 1 ? "<" : ">=",
+		                        bound / 1000.0, b_event_hist[i] );
+	}
+	ret = g_slist_append( ret, g_string_free( hist, FALSE ) );
+
+	g_hash_table_foreach( b_event_sites, b_event_profile_collect, &sites );
+	sites = g_slist_sort( sites, b_event_profile_cmp );
+
+	for( l = sites, i = 0; l && i < max_sites; l = l->next, i ++ )
+	{
+		struct b_event_site *site = l->data;
+		char *name = b_event_profile_name( site->function );
+
+		ret = g_slist_append( ret, g_strdup_printf( "%s: %u calls, %.1f ms total, "
+		                      "%.3f ms avg, %.1f ms max", name, site->calls,
+		                      site->total / 1000.0, site->total / 1000.0 / site->calls,
+		                      site->max / 1000.0 ) );
+		g_free( name );
+	}
+	g_slist_free( sites );
+
+	return ret;
+}
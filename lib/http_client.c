@@ -28,46 +28,64 @@
 
 #include "http_client.h"
 #include "url.h"
+#include "misc.h"
 #include "sock.h"
 
+/* Idle keep-alive connections are kept around per (host, port, ssl) for
+   a while, so periodic requests (Twitter timelines, MSN SOAP calls) don't
+   have to go through a TCP/TLS handshake every time. */
+#define HTTP_POOL_MAX_PER_HOST 4        /* Connections per host, busy or idle. */
+#define HTTP_POOL_IDLE_TIMEOUT 120      /* Seconds */
+
+struct http_pool_conn
+{
+	char *host;
+	int port;
+	int use_ssl;
+	
+	void *ssl;
+	int fd;
+	
+	int inpa;
+	int timeout;
+};
+
+static GSList *http_pool;       /* Idle connections, most recent first. */
+static GSList *http_busy;       /* Keep-alive requests owning a connection. */
+static GSList *http_queue;      /* Keep-alive requests waiting for one. */
+static struct http_pool_stats http_stats;
 
 static gboolean http_connected( gpointer data, int source, b_input_condition cond );
 static gboolean http_ssl_connected( gpointer data, int returncode, void *source, b_input_condition cond );
 static gboolean http_incoming_data( gpointer data, int source, b_input_condition cond );
+static gboolean http_start( struct http_request *req );
+static void http_release( struct http_request *req, gboolean reuse );
+static void http_finish( struct http_request *req );
 static void http_free( struct http_request *req );
 
 
 struct http_request *http_dorequest( char *host, int port, int ssl, char *request, http_input_function func, gpointer data )
 {
 	struct http_request *req;
-	int error = 0;
 	
 	req = g_new0( struct http_request, 1 );
-	
-	if( ssl )
-	{
-		req->ssl = ssl_connect( host, port, TRUE, http_ssl_connected, req );
-		if( req->ssl == NULL )
-			error = 1;
-	}
-	else
-	{
-		req->fd = proxy_connect( host, port, http_connected, req );
-		if( req->fd < 0 )
-			error = 1;
-	}
-	
-	if( error )
-	{
-		http_free( req );
-		return NULL;
-	}
+	req->fd = -1;
+	req->host = g_strdup( host );
+	req->port = port;
+	req->use_ssl = ssl;
 	
 	req->func = func;
 	req->data = data;
 	req->request = g_strdup( request );
 	req->request_length = strlen( request );
 	req->redir_ttl = 3;
+	req->keepalive = http_request_keepalive( req->request );
+	
+	if( !http_start( req ) )
+	{
+		http_free( req );
+		return NULL;
+	}
 	
 	if( getenv( "BITLBEE_DEBUG" ) )
 		printf( "About to send HTTP request:\n%s\n", req->request );
@@ -93,9 +111,8 @@ struct http_request *http_dorequest_url( char *url_string, http_input_function f
 		return NULL;
 	}
 	
-	request = g_strdup_printf( "GET %s HTTP/1.0\r\n"
+	request = g_strdup_printf( "GET %s HTTP/1.1\r\n"
 	                           "Host: %s\r\n"
-	                           "Connection: close\r\n"
 	                           "User-Agent: BitlBee " BITLBEE_VERSION " " ARCH "/" CPU "\r\n"
 	                           "\r\n", url->file, url->host );
 	
@@ -107,6 +124,325 @@ struct http_request *http_dorequest_url( char *url_string, http_input_function f
 	return ret;
 }
 
+/* Only HTTP/1.1 requests that don't ask for Connection: close are allowed
+   to leave their connection open afterwards. */
+int http_request_keepalive( const char *request )
+{
+	const char *eol = strstr( request, "\r\n" );
+	char *s;
+	int ret;
+	
+	if( eol == NULL || eol - request < 8 || strncmp( eol - 8, "HTTP/1.1", 8 ) != 0 )
+		return 0;
+	
+	s = get_rfc822_header( (char*) request, "Connection", 0 );
+	ret = s == NULL || g_strcasecmp( s, "close" ) != 0;
+	g_free( s );
+	
+	return ret;
+}
+
+const struct http_pool_stats *http_pool_get_stats( void )
+{
+	return &http_stats;
+}
+
+void http_flush_bytes( struct http_request *req, size_t len )
+{
+	if( len == 0 || len > (size_t) req->body_size )
+		return;
+	
+	req->body_size -= len;
+	memmove( req->reply_body, req->reply_body + len, req->body_size );
+	req->reply_body[req->body_size] = 0;
+}
+
+void http_close( struct http_request *req )
+{
+	if( req->flags & HTTPC_IN_CALLBACK )
+	{
+		/* The caller of the callback will clean up. */
+		req->flags |= HTTPC_CLOSED;
+		return;
+	}
+	
+	http_queue = g_slist_remove( http_queue, req );
+	http_release( req, FALSE );
+	http_free( req );
+}
+
+static gboolean http_same_host( struct http_request *req, const char *host, int port, int use_ssl )
+{
+	return req->port == port && req->use_ssl == use_ssl &&
+	       g_strcasecmp( req->host, host ) == 0;
+}
+
+static void http_conn_close( struct http_request *req )
+{
+	if( req->ssl )
+		ssl_disconnect( req->ssl );
+	else if( req->fd >= 0 )
+		closesocket( req->fd );
+	
+	req->ssl = NULL;
+	req->fd = -1;
+}
+
+static void http_pool_conn_free( struct http_pool_conn *c, gboolean close )
+{
+	if( c->inpa > 0 )
+		b_event_remove( c->inpa );
+	if( c->timeout > 0 )
+		b_event_remove( c->timeout );
+	
+	if( close && c->ssl )
+		ssl_disconnect( c->ssl );
+	else if( close )
+		closesocket( c->fd );
+	
+	http_pool = g_slist_remove( http_pool, c );
+	http_stats.idle --;
+	
+	g_free( c->host );
+	g_free( c );
+}
+
+/* Servers close idle connections whenever they feel like it, so anything
+   readable on an idle connection (EOF, usually) means it's dead. */
+static gboolean http_pool_conn_dead( gpointer data, int source, b_input_condition cond )
+{
+	struct http_pool_conn *c = data;
+	
+	c->inpa = 0;
+	
+	if( c->ssl )
+	{
+		char buf[1];
+		
+		/* Could be just TLS housekeeping (session tickets and such). */
+		if( ssl_read( c->ssl, buf, sizeof( buf ) ) < 0 && ssl_errno == SSL_AGAIN )
+		{
+			c->inpa = b_input_add( c->fd, ssl_getdirection( c->ssl ),
+			                       http_pool_conn_dead, c );
+			return FALSE;
+		}
+	}
+	
+	http_pool_conn_free( c, TRUE );
+	return FALSE;
+}
+
+static gboolean http_pool_conn_expire( gpointer data, int source, b_input_condition cond )
+{
+	struct http_pool_conn *c = data;
+	
+	c->timeout = 0;
+	http_pool_conn_free( c, TRUE );
+	return FALSE;
+}
+
+/* Connections to the request's host, in use or idle in the pool. The one
+   the request has itself (if any) isn't counted. */
+static int http_host_conns( struct http_request *req )
+{
+	GSList *l;
+	int n = 0;
+	
+	for( l = http_pool; l; l = l->next )
+	{
+		struct http_pool_conn *c = l->data;
+		if( http_same_host( req, c->host, c->port, c->use_ssl ) )
+			n ++;
+	}
+	
+	for( l = http_busy; l; l = l->next )
+	{
+		struct http_request *busy = l->data;
+		if( busy != req && http_same_host( req, busy->host, busy->port, busy->use_ssl ) )
+			n ++;
+	}
+	
+	return n;
+}
+
+/* Hand the request's connection over to the pool. */
+static void http_pool_put( struct http_request *req )
+{
+	struct http_pool_conn *c;
+	
+	if( http_host_conns( req ) >= HTTP_POOL_MAX_PER_HOST )
+	{
+		http_conn_close( req );
+		return;
+	}
+	
+	c = g_new0( struct http_pool_conn, 1 );
+	c->host = g_strdup( req->host );
+	c->port = req->port;
+	c->use_ssl = req->use_ssl;
+	c->ssl = req->ssl;
+	c->fd = req->fd;
+	c->inpa = b_input_add( c->fd, B_EV_IO_READ, http_pool_conn_dead, c );
+	c->timeout = b_timeout_add( HTTP_POOL_IDLE_TIMEOUT * 1000, http_pool_conn_expire, c );
+	
+	http_pool = g_slist_prepend( http_pool, c );
+	http_stats.idle ++;
+	
+	req->ssl = NULL;
+	req->fd = -1;
+}
+
+static gboolean http_pool_get( struct http_request *req )
+{
+	GSList *l;
+	
+	for( l = http_pool; l; l = l->next )
+	{
+		struct http_pool_conn *c = l->data;
+		
+		if( http_same_host( req, c->host, c->port, c->use_ssl ) )
+		{
+			req->ssl = c->ssl;
+			req->fd = c->fd;
+			req->reused = 1;
+			
+			http_pool_conn_free( c, FALSE );
+			http_stats.reuses ++;
+			
+			return TRUE;
+		}
+	}
+	
+	return FALSE;
+}
+
+static gboolean http_connect( struct http_request *req )
+{
+	req->reused = 0;
+	http_stats.connects ++;
+	
+	if( req->use_ssl )
+	{
+		req->ssl = ssl_connect( req->host, req->port, TRUE, http_ssl_connected, req );
+		return req->ssl != NULL;
+	}
+	else
+	{
+		req->fd = proxy_connect( req->host, req->port, http_connected, req );
+		return req->fd >= 0;
+	}
+}
+
+/* Get a connection for the request: a pooled one if possible, a new one
+   if there aren't too many to this host already, or wait in the queue
+   until one of the busy ones is released. */
+static gboolean http_start( struct http_request *req )
+{
+	if( req->keepalive )
+	{
+		if( http_pool_get( req ) )
+		{
+			http_busy = g_slist_prepend( http_busy, req );
+			req->inpa = b_input_add( req->fd, B_EV_IO_WRITE, http_connected, req );
+			return TRUE;
+		}
+		
+		if( http_host_conns( req ) >= HTTP_POOL_MAX_PER_HOST )
+		{
+			http_queue = g_slist_append( http_queue, req );
+			http_stats.queued ++;
+			return TRUE;
+		}
+	}
+	
+	if( !http_connect( req ) )
+		return FALSE;
+	
+	if( req->keepalive )
+		http_busy = g_slist_prepend( http_busy, req );
+	
+	return TRUE;
+}
+
+/* A queued request couldn't be started. Tell its owner from the main
+   loop, we may well be inside a callback for some other request now. */
+static gboolean http_start_failed( gpointer data, int source, b_input_condition cond )
+{
+	struct http_request *req = data;
+	
+	req->inpa = 0;
+	req->status_string = g_strdup( "Connection problem" );
+	http_finish( req );
+	return FALSE;
+}
+
+/* Start the first queued request for the host @done was talking to. */
+static void http_dequeue( struct http_request *done )
+{
+	GSList *l;
+	
+	for( l = http_queue; l; )
+	{
+		struct http_request *req = l->data;
+		
+		if( !http_same_host( req, done->host, done->port, done->use_ssl ) )
+		{
+			l = l->next;
+			continue;
+		}
+		
+		http_queue = g_slist_remove( http_queue, req );
+		
+		if( http_start( req ) )
+			return;
+		
+		/* Didn't take the connection slot, so try the next one. */
+		req->inpa = b_timeout_add( 0, http_start_failed, req );
+		l = http_queue;
+	}
+}
+
+/* Done with the connection: pool or close it, and let the next queued
+   request for the same host have a go. */
+static void http_release( struct http_request *req, gboolean reuse )
+{
+	gboolean was_busy = g_slist_find( http_busy, req ) != NULL;
+	
+	if( req->inpa > 0 )
+		b_event_remove( req->inpa );
+	req->inpa = 0;
+	
+	if( reuse && req->fd >= 0 )
+		http_pool_put( req );
+	else
+		http_conn_close( req );
+	
+	if( was_busy )
+	{
+		http_busy = g_slist_remove( http_busy, req );
+		http_dequeue( req );
+	}
+}
+
+/* A pooled connection turned out to be closed by the server before we got
+   any reply. Not the caller's problem, just try again on a new one. */
+static gboolean http_retry( struct http_request *req )
+{
+	if( req->inpa > 0 )
+		b_event_remove( req->inpa );
+	req->inpa = 0;
+	
+	http_conn_close( req );
+	http_stats.retries ++;
+	
+	g_free( req->reply_headers );
+	req->reply_headers = NULL;
+	req->bytes_read = req->bytes_written = 0;
+	req->body_start = req->chunked = req->chunk_pos = 0;
+	
+	return http_connect( req );
+}
+
 /* This one is actually pretty simple... Might get more calls if we can't write 
    the whole request at once. */
 static gboolean http_connected( gpointer data, int source, b_input_condition cond )
@@ -115,10 +451,16 @@ static gboolean http_connected( gpointer data, int source, b_input_condition con
 	int st;
 	
 	if( source < 0 )
+	{
+		/* The connection code already cleaned up after itself. */
+		req->ssl = NULL;
+		req->fd = -1;
 		goto error;
+	}
 	
 	if( req->inpa > 0 )
 		b_event_remove( req->inpa );
+	req->inpa = 0;
 	
 	sock_make_nonblocking( req->fd );
 	
@@ -130,7 +472,8 @@ static gboolean http_connected( gpointer data, int source, b_input_condition con
 		{
 			if( ssl_errno != SSL_AGAIN )
 			{
-				ssl_disconnect( req->ssl );
+				if( req->reused && http_retry( req ) )
+					return FALSE;
 				goto error;
 			}
 		}
@@ -143,7 +486,8 @@ static gboolean http_connected( gpointer data, int source, b_input_condition con
 		{
 			if( !sockerr_again() )
 			{
-				closesocket( req->fd );
+				if( req->reused && http_retry( req ) )
+					return FALSE;
 				goto error;
 			}
 		}
@@ -165,8 +509,8 @@ error:
 	if( req->status_string == NULL )
 		req->status_string = g_strdup( "Error while writing HTTP request" );
 	
-	req->func( req );
-	http_free( req );
+	http_release( req, FALSE );
+	http_finish( req );
 	return FALSE;
 }
 
@@ -192,16 +536,335 @@ static gboolean http_ssl_connected( gpointer data, int returncode, void *source,
 	return http_connected( data, req->fd, cond );
 }
 
+/* Walk the chunks received so far, returns TRUE once the last one (and
+   the trailer after it) is in. */
+static gboolean http_chunks_complete( struct http_request *req )
+{
+	char *end = req->reply_headers + req->bytes_read;
+	
+	while( TRUE )
+	{
+		char *line = req->reply_headers + req->chunk_pos, *eol;
+		long size;
+		
+		if( ( eol = memchr( line, '\n', end - line ) ) == NULL )
+			return FALSE;
+		
+		size = strtol( line, NULL, 16 );
+		if( size < 0 )
+		{
+			req->keepalive = 0;
+			return TRUE;
+		}
+		else if( size == 0 )
+		{
+			/* Trailer headers, if any, end with an empty line. */
+			while( ( line = eol + 1 ) < end )
+			{
+				if( *line == '\n' || ( *line == '\r' && line + 1 < end && line[1] == '\n' ) )
+					return TRUE;
+				if( ( eol = memchr( line, '\n', end - line ) ) == NULL )
+					return FALSE;
+			}
+			return FALSE;
+		}
+		
+		line = eol + 1 + size;
+		if( line < end && *line == '\r' )
+			line ++;
+		if( line >= end )
+			return FALSE;
+		if( *line == '\n' )
+			line ++;
+		
+		req->chunk_pos = line - req->reply_headers;
+	}
+}
+
+/* Look at the headers as soon as they're in to find out where the reply
+   ends, so we don't have to wait for the server to close the connection. */
+static gboolean http_reply_complete( struct http_request *req )
+{
+	if( req->body_start == 0 )
+	{
+		char *headers, *end1, *end2, *s;
+		int status = 0;
+		
+		end1 = strstr( req->reply_headers, "\r\n\r\n" );
+		end2 = strstr( req->reply_headers, "\n\n" );
+		
+		if( end2 && ( end1 == NULL || end2 < end1 ) )
+			req->body_start = end2 + 2 - req->reply_headers;
+		else if( end1 )
+			req->body_start = end1 + 4 - req->reply_headers;
+		else
+			return FALSE;
+		
+		headers = g_strndup( req->reply_headers, req->body_start );
+		
+		if( ( s = strchr( headers, ' ' ) ) )
+			sscanf( s + 1, "%d", &status );
+		if( g_strncasecmp( headers, "HTTP/1.1", 8 ) != 0 )
+			req->keepalive = 0;
+		
+		if( ( s = get_rfc822_header( headers, "Connection", 0 ) ) )
+		{
+			if( g_strcasecmp( s, "close" ) == 0 )
+				req->keepalive = 0;
+			g_free( s );
+		}
+		
+		req->content_length = -1;
+		if( ( s = get_rfc822_header( headers, "Transfer-Encoding", 0 ) ) )
+		{
+			req->chunked = g_strcasecmp( s, "identity" ) != 0;
+			g_free( s );
+		}
+		if( !req->chunked && ( s = get_rfc822_header( headers, "Content-Length", 0 ) ) )
+		{
+			req->content_length = atoi( s );
+			g_free( s );
+		}
+		
+		/* Some replies never have a body. */
+		if( status == 204 || status == 304 || ( status >= 100 && status < 200 ) ||
+		    g_strncasecmp( req->request, "HEAD ", 5 ) == 0 )
+		{
+			req->chunked = 0;
+			req->content_length = 0;
+		}
+		
+		/* Without any framing the reply ends when the connection does. */
+		if( !req->chunked && req->content_length < 0 )
+			req->keepalive = 0;
+		
+		req->chunk_pos = req->body_start;
+		g_free( headers );
+	}
+	
+	if( req->chunked )
+		return http_chunks_complete( req );
+	else if( req->content_length >= 0 )
+		return req->bytes_read - req->body_start >= req->content_length;
+	else
+		return FALSE;
+}
+
+/* Glue the chunks back together, in place. */
+static void http_dechunk( struct http_request *req )
+{
+	char *in = req->reply_body, *out = req->reply_body;
+	char *end = req->reply_body + req->body_size;
+	
+	while( in < end )
+	{
+		char *eol = memchr( in, '\n', end - in );
+		long size;
+		
+		if( eol == NULL )
+			break;
+		
+		size = strtol( in, NULL, 16 );
+		in = eol + 1;
+		if( size <= 0 )
+			break;
+		
+		/* Truncated reply, take what we have. */
+		if( size > end - in )
+			size = end - in;
+		
+		memmove( out, in, size );
+		out += size;
+		in += size;
+		
+		if( in < end && *in == '\r' )
+			in ++;
+		if( in < end && *in == '\n' )
+			in ++;
+	}
+	
+	*out = 0;
+	req->body_size = out - req->reply_body;
+}
+
+/* Parse the status line at the start of req->reply_headers. */
+static void http_parse_status( struct http_request *req )
+{
+	char *s, *eol;
+	
+	if( ( s = strchr( req->reply_headers, ' ' ) ) == NULL )
+	{
+		req->status_string = g_strdup( "Can't locate status code" );
+		req->status_code = -1;
+	}
+	else if( sscanf( s + 1, "%d", &req->status_code ) != 1 )
+	{
+		req->status_string = g_strdup( "Can't parse status code" );
+		req->status_code = -1;
+	}
+	else
+	{
+		eol = s + 1 + strcspn( s + 1, "\r\n" );
+		req->status_string = g_strndup( s + 1, eol - s - 1 );
+	}
+}
+
+static gboolean http_will_redirect( struct http_request *req )
+{
+	char *s = strchr( req->reply_headers, ' ' );
+	int status = 0;
+	
+	if( s )
+		sscanf( s + 1, "%d", &status );
+	
+	return ( ( status >= 301 && status <= 303 ) || status == 307 ) &&
+	       req->redir_ttl > 0;
+}
+
+/* Calls the callback for more streamed data. Returns FALSE if the caller
+   closed the request from there. */
+static gboolean http_stream_callback( struct http_request *req )
+{
+	req->flags |= HTTPC_IN_CALLBACK;
+	req->func( req );
+	req->flags &= ~HTTPC_IN_CALLBACK;
+	
+	if( req->flags & HTTPC_CLOSED )
+	{
+		http_release( req, FALSE );
+		http_free( req );
+		return FALSE;
+	}
+	
+	return TRUE;
+}
+
+/* Decode whatever's in the stream buffer into reply_body and pass it on.
+   Returns FALSE if the request is gone. */
+static gboolean http_stream_body( struct http_request *req )
+{
+	int pos = 0, done = 0, old_size = req->body_size;
+	
+	if( !req->chunked && req->content_length == 0 )
+		done = 1;
+	
+	while( pos < req->sblen && !done )
+	{
+		char *p = req->sbuf + pos, *eol;
+		int n = req->sblen - pos;
+		
+		if( !req->chunked || req->chunk_left > 0 )
+		{
+			if( req->chunked && n > req->chunk_left )
+				n = req->chunk_left;
+			else if( !req->chunked && req->content_length >= 0 && n > req->content_length )
+				n = req->content_length;
+			
+			req->reply_body = g_realloc( req->reply_body, req->body_size + n + 1 );
+			memcpy( req->reply_body + req->body_size, p, n );
+			req->body_size += n;
+			req->reply_body[req->body_size] = 0;
+			pos += n;
+			
+			if( req->chunked && ( req->chunk_left -= n ) == 0 )
+				req->chunk_left = -1;
+			else if( !req->chunked && req->content_length >= 0 &&
+			         ( req->content_length -= n ) == 0 )
+				done = 1;
+			
+			continue;
+		}
+		
+		/* Everything else is line-based. */
+		if( ( eol = memchr( p, '\n', n ) ) == NULL )
+			break;
+		pos = eol + 1 - req->sbuf;
+		
+		if( req->chunk_left == -1 )
+		{
+			/* End of the chunk data. */
+			req->chunk_left = 0;
+		}
+		else if( req->chunk_left == -2 )
+		{
+			/* Trailers, until an empty line. */
+			if( p == eol || ( *p == '\r' && p + 1 == eol ) )
+				done = 1;
+		}
+		else
+		{
+			long size = strtol( p, NULL, 16 );
+			
+			if( size < 0 )
+			{
+				req->keepalive = 0;
+				done = 1;
+			}
+			else if( size == 0 )
+				req->chunk_left = -2;
+			else
+				req->chunk_left = size;
+		}
+	}
+	
+	req->sblen -= pos;
+	memmove( req->sbuf, req->sbuf + pos, req->sblen );
+	
+	if( done )
+	{
+		if( req->sblen > 0 )
+			req->keepalive = 0;
+		
+		req->finished = 1;
+		http_release( req, req->keepalive );
+		http_finish( req );
+		return FALSE;
+	}
+	
+	if( req->body_size > old_size )
+		return http_stream_callback( req );
+	
+	return TRUE;
+}
+
+/* The headers are in, hand them to the caller and from now on pass on the
+   body bit by bit instead of collecting all of it. */
+static gboolean http_stream_start( struct http_request *req )
+{
+	int hlen = req->body_start;
+	
+	/* Cut off the empty line, like for non-streaming replies. */
+	hlen -= req->reply_headers[hlen - 2] == '\r' ? 2 : 1;
+	
+	req->sblen = req->bytes_read - req->body_start;
+	req->sbuf = g_memdup( req->reply_headers + req->body_start, req->sblen + 1 );
+	req->reply_headers[hlen] = 0;
+	req->reply_body = g_strdup( "" );
+	req->body_size = 0;
+	req->chunk_left = 0;
+	
+	if( getenv( "BITLBEE_DEBUG" ) )
+		printf( "HTTP response headers:\n%s\n", req->reply_headers );
+	
+	http_parse_status( req );
+	
+	if( !http_stream_callback( req ) )
+		return FALSE;
+	
+	return http_stream_body( req );
+}
+
 static gboolean http_incoming_data( gpointer data, int source, b_input_condition cond )
 {
 	struct http_request *req = data;
 	int evil_server = 0;
-	char buffer[2048];
+	char buffer[4096];
 	char *end1, *end2;
 	int st;
 	
 	if( req->inpa > 0 )
 		b_event_remove( req->inpa );
+	req->inpa = 0;
 	
 	if( req->ssl )
 	{
@@ -216,12 +879,12 @@ static gboolean http_incoming_data( gpointer data, int source, b_input_condition
 				   servers that LOVE to send invalid TLS
 				   packets that abort connections! \o/ */
 				
-				goto got_reply;
+				goto eof;
 			}
 		}
 		else if( st == 0 )
 		{
-			goto got_reply;
+			goto eof;
 		}
 	}
 	else
@@ -231,21 +894,49 @@ static gboolean http_incoming_data( gpointer data, int source, b_input_condition
 		{
 			if( !sockerr_again() )
 			{
+				if( req->reused && req->bytes_read == 0 && http_retry( req ) )
+					return FALSE;
+				
+				g_free( req->status_string );
 				req->status_string = g_strdup( strerror( errno ) );
 				goto cleanup;
 			}
 		}
 		else if( st == 0 )
 		{
-			goto got_reply;
+			goto eof;
 		}
 	}
 	
-	if( st > 0 )
+	if( st > 0 && req->sbuf )
+	{
+		req->sbuf = g_realloc( req->sbuf, req->sblen + st + 1 );
+		memcpy( req->sbuf + req->sblen, buffer, st );
+		req->sblen += st;
+		req->bytes_read += st;
+		
+		if( !http_stream_body( req ) )
+			return FALSE;
+	}
+	else if( st > 0 )
 	{
+		gboolean complete;
+		
 		req->reply_headers = g_realloc( req->reply_headers, req->bytes_read + st + 1 );
 		memcpy( req->reply_headers + req->bytes_read, buffer, st );
 		req->bytes_read += st;
+		req->reply_headers[req->bytes_read] = 0;
+		
+		complete = http_reply_complete( req );
+		
+		if( ( req->flags & HTTPC_STREAMING ) && req->body_start &&
+		    !http_will_redirect( req ) )
+		{
+			if( !http_stream_start( req ) )
+				return FALSE;
+		}
+		else if( complete )
+			goto got_reply;
 	}
 	
 	/* There will be more! */
@@ -258,6 +949,20 @@ static gboolean http_incoming_data( gpointer data, int source, b_input_condition
 	else
 		return FALSE;
 
+eof:
+	if( req->reused && req->bytes_read == 0 && http_retry( req ) )
+		return FALSE;
+	
+	/* Whatever we have now is all we'll get. */
+	req->keepalive = 0;
+	
+	if( req->sbuf )
+	{
+		/* Only replies without any framing end like this. */
+		req->finished = !req->chunked && req->content_length < 0;
+		goto cleanup;
+	}
+
 got_reply:
 	/* Maybe if the webserver is overloaded, or when there's bad SSL
 	   support... */
@@ -302,42 +1007,25 @@ got_reply:
 	
 	req->body_size = req->reply_headers + req->bytes_read - req->reply_body;
 	
-	if( ( end1 = strchr( req->reply_headers, ' ' ) ) != NULL )
+	if( req->chunked )
 	{
-		if( sscanf( end1 + 1, "%d", &req->status_code ) != 1 )
-		{
-			req->status_string = g_strdup( "Can't parse status code" );
-			req->status_code = -1;
-		}
-		else
-		{
-			char *eol;
-			
-			if( evil_server )
-				eol = strchr( end1, '\n' );
-			else
-				eol = strchr( end1, '\r' );
-			
-			req->status_string = g_strndup( end1 + 1, eol - end1 - 1 );
-			
-			/* Just to be sure... */
-			if( ( eol = strchr( req->status_string, '\r' ) ) )
-				*eol = 0;
-			if( ( eol = strchr( req->status_string, '\n' ) ) )
-				*eol = 0;
-		}
+		http_dechunk( req );
 	}
-	else
+	else if( req->content_length >= 0 && req->body_size > req->content_length )
 	{
-		req->status_string = g_strdup( "Can't locate status code" );
-		req->status_code = -1;
+		/* Junk after the reply, don't trust this connection anymore. */
+		req->body_size = req->content_length;
+		req->reply_body[req->body_size] = 0;
+		req->keepalive = 0;
 	}
 	
+	http_parse_status( req );
+	
 	if( ( ( req->status_code >= 301 && req->status_code <= 303 ) ||
 	      req->status_code == 307 ) && req->redir_ttl-- > 0 )
 	{
 		char *loc, *new_request, *new_host;
-		int error = 0, new_port, new_proto;
+		int new_port, new_proto;
 		
 		/* We might fill it again, so let's not leak any memory. */
 		g_free( req->status_string );
@@ -421,8 +1109,10 @@ got_reply:
 				new_method = "POST";
 			
 			/* Okay, this isn't fun! We have to rebuild the request... :-( */
-			new_request = g_strdup_printf( "%s %s HTTP/1.0\r\nHost: %s%s",
-			                               new_method, url->file, url->host, s );
+			new_request = g_strdup_printf( "%s %s HTTP/1.%c\r\nHost: %s%s",
+			                               new_method, url->file,
+			                               http_request_keepalive( req->request ) ? '1' : '0',
+			                               url->host, s );
 			
 			new_host = g_strdup( url->host );
 			new_port = url->port;
@@ -436,69 +1126,68 @@ got_reply:
 			g_free( url );
 		}
 		
-		if( req->ssl )
-			ssl_disconnect( req->ssl );
-		else
-			closesocket( req->fd );
-		
-		req->fd = -1;
-		req->ssl = NULL;
+		/* Done with this connection, the next one may well be to
+		   a different host. */
+		http_release( req, req->keepalive );
 		
 		if( getenv( "BITLBEE_DEBUG" ) )
 			printf( "New headers for redirected HTTP request:\n%s\n", new_request );
-	
-		if( new_proto == PROTO_HTTPS )
-		{
-			req->ssl = ssl_connect( new_host, new_port, TRUE, http_ssl_connected, req );
-			if( req->ssl == NULL )
-				error = 1;
-		}
-		else
-		{
-			req->fd = proxy_connect( new_host, new_port, http_connected, req );
-			if( req->fd < 0 )
-				error = 1;
-		}
-		g_free( new_host );
-		
-		if( error )
-		{
-			req->status_string = g_strdup( "Connection problem during redirect" );
-			g_free( new_request );
-			goto cleanup;
-		}
 		
+		g_free( req->host );
 		g_free( req->request );
 		g_free( req->reply_headers );
+		req->host = new_host;
+		req->port = new_port;
+		req->use_ssl = new_proto == PROTO_HTTPS;
 		req->request = new_request;
 		req->request_length = strlen( new_request );
-		req->bytes_read = req->bytes_written = req->inpa = 0;
+		req->keepalive = http_request_keepalive( new_request );
+		req->bytes_read = req->bytes_written = 0;
+		req->body_start = req->chunked = req->chunk_pos = 0;
 		req->reply_headers = req->reply_body = NULL;
 		
+		if( !http_start( req ) )
+		{
+			req->status_string = g_strdup( "Connection problem during redirect" );
+			goto cleanup;
+		}
+		
 		return FALSE;
 	}
 	
-	/* Assume that a closed connection means we're finished, this indeed
-	   breaks with keep-alive connections and faulty connections. */
+	/* Either the framing says we have it all, or the server closed the
+	   connection which is all we can go by for HTTP/1.0 replies. */
 	req->finished = 1;
 
 cleanup:
-	if( req->ssl )
-		ssl_disconnect( req->ssl );
-	else
-		closesocket( req->fd );
+	/* Release the connection before the callback, it may well want to
+	   send another request to the same server. */
+	http_release( req, req->finished && req->keepalive );
 	
 	if( getenv( "BITLBEE_DEBUG" ) && req )
 		printf( "Finishing HTTP request with status: %s\n",
 		        req->status_string ? req->status_string : "NULL" );
 	
+	http_finish( req );
+	return FALSE;
+}
+
+/* Last call to the callback, the request is gone after this. */
+static void http_finish( struct http_request *req )
+{
+	req->flags |= HTTPC_EOF | HTTPC_IN_CALLBACK;
 	req->func( req );
 	http_free( req );
-	return FALSE;
 }
 
 static void http_free( struct http_request *req )
 {
+	/* When streaming, the body has a buffer of its own. */
+	if( req->sbuf )
+		g_free( req->reply_body );
+	
+	g_free( req->sbuf );
+	g_free( req->host );
 	g_free( req->request );
 	g_free( req->reply_headers );
 	g_free( req->status_string );
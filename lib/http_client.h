@@ -25,17 +25,22 @@
 
 /* http_client allows you to talk (asynchronously, again) to HTTP servers.
    In the "background" it will send the whole query and wait for a complete
-   response to come back. Right now it's only used by the MSN Passport
-   authentication code, but it might be useful for other things too (for
-   example the AIM usericon patch uses this so icons can be stored on
-   webservers instead of the local filesystem).
+   response to come back. It's used by the MSN, Yahoo! and Twitter
+   modules, but it might be useful for other things too (for example the
+   AIM usericon patch uses this so icons can be stored on webservers
+   instead of the local filesystem).
    
    Didn't test this too much, but it seems to work well. Just don't look
-   at the code that handles HTTP 30x redirects. ;-) The function is
-   probably not very useful for downloading lots of data since it keeps 
-   everything in a memory buffer until the download is completed (and
-   can't pass any data or whatever before then). It's very useful for
-   doing quick requests without blocking the whole program, though. */
+   at the code that handles HTTP 30x redirects. ;-) By default the whole
+   reply is kept in a memory buffer and the callback is only called once
+   it's complete, which is what you want for quick requests. For long or
+   endless replies (like the Twitter stream) use streaming mode instead:
+   set HTTPC_STREAMING and the callback gets the body as it comes in, and
+   only what wasn't passed to http_flush_bytes() yet stays in memory.
+   
+   Replies are framed using Content-Length or chunked encoding where
+   available (chunked bodies are decoded before the callback sees them),
+   otherwise the reply ends when the server closes the connection. */
 
 #include <glib.h>
 #include "ssl_client.h"
@@ -45,6 +50,16 @@ struct http_request;
 /* Your callback function should look like this: */
 typedef void (*http_input_function)( struct http_request * );
 
+typedef enum http_client_flags
+{
+	HTTPC_STREAMING = 1,    /* Set by the caller, see http_flush_bytes(). */
+	HTTPC_EOF = 2,          /* This is the last callback for this request. */
+	
+	/* Internal. */
+	HTTPC_IN_CALLBACK = 0x100,
+	HTTPC_CLOSED = 0x200,
+} http_client_flags_t;
+
 /* This structure will be filled in by the http_dorequest* functions, and
    it will be passed to the callback function. Use the data field to add
    your own data. */
@@ -63,6 +78,8 @@ struct http_request
 	int redir_ttl;          /* You can set it to 0 if you don't want
 	                           http_client to follow them. */
 	
+	http_client_flags_t flags;
+	
 	http_input_function func;
 	gpointer data;
 	
@@ -74,6 +91,31 @@ struct http_request
 	int inpa;
 	int bytes_written;
 	int bytes_read;
+	
+	char *host;
+	int port;
+	int use_ssl;
+	int keepalive;          /* Connection can go back to the pool after. */
+	int reused;             /* Connection came from the pool. */
+	
+	int body_start;         /* Offset of the body, 0 until headers are in. */
+	int content_length;     /* -1 if not known. */
+	int chunked;
+	int chunk_pos;          /* Next chunk header in a chunked body. */
+	
+	char *sbuf;             /* Undecoded body data when streaming. */
+	int sblen;
+	int chunk_left;         /* Bytes left in the current chunk. */
+};
+
+/* Counters for the keep-alive connection pool. */
+struct http_pool_stats
+{
+	int connects;           /* New connections opened. */
+	int reuses;             /* Requests sent over a pooled connection. */
+	int retries;            /* Pooled connections found dead on reuse. */
+	int queued;             /* Requests that had to wait for a connection. */
+	int idle;               /* Connections in the pool right now. */
 };
 
 /* The _url variant is probably more useful than the raw version. The raw
@@ -82,3 +124,24 @@ struct http_request
    are also supported (using ssl_client). */
 struct http_request *http_dorequest( char *host, int port, int ssl, char *request, http_input_function func, gpointer data );
 struct http_request *http_dorequest_url( char *url_string, http_input_function func, gpointer data );
+
+/* HTTP/1.1 requests without a "Connection: close" header keep their
+   connection open afterwards and put it in a pool, so the next request to
+   the same host/port can skip the (TLS) handshake. At most a few
+   connections per host are opened, other requests wait for one to become
+   available. */
+int http_request_keepalive( const char *request );
+
+/* Streaming: set HTTPC_STREAMING in req->flags right after starting the
+   request and the callback gets called as soon as the headers are in
+   (body_size 0), then every time more of the body arrives. reply_body
+   holds whatever body data you didn't flush yet, so call this function
+   for everything you've processed. The last call has HTTPC_EOF set, with
+   finished set only if the whole reply came in. Redirects are followed
+   before streaming starts. */
+void http_flush_bytes( struct http_request *req, size_t len );
+
+/* Abort a request, the callback won't be called anymore. Also safe to
+   call from inside the callback. */
+void http_close( struct http_request *req );
+const struct http_pool_stats *http_pool_get_stats( void );
@@ -150,19 +150,27 @@ static const htmlentity_t ent[] =
 	{ "",        ""  }
 };
 
+/* Works in-place, the result is never longer than the input: tags and
+   entities are never replaced with anything longer than themselves. */
 void strip_html( char *in )
 {
-	char *start = in;
-	char out[strlen(in)+1];
-	char *s = out, *cs;
+	char *s = in, *cs;
 	int i, matched;
 	int taglen;
-	
-	memset( out, 0, sizeof( out ) );
+	size_t n;
 	
 	while( *in )
 	{
-		if( *in == '<' && ( isalpha( *(in+1) ) || *(in+1) == '/' ) )
+		/* Most of the text usually isn't markup, copy all of that in
+		   one go. */
+		if( ( n = strcspn( in, "<&" ) ) > 0 )
+		{
+			if( s != in )
+				memmove( s, in, n );
+			s += n;
+			in += n;
+		}
+		else if( *in == '<' && ( isalpha( *(in+1) ) || *(in+1) == '/' ) )
 		{
 			/* If in points at a < and in+1 points at a letter or a slash, this is probably
 			   a HTML-tag. Try to find a closing > and continue there. If the > can't be
@@ -204,7 +212,8 @@ void strip_html( char *in )
 			matched = 0;
 			
 			for( i = 0; *ent[i].code; i ++ )
-				if( g_strncasecmp( ent[i].code, cs, strlen( ent[i].code ) ) == 0 )
+				if( ent[i].code[0] == g_ascii_tolower( *cs ) &&
+				    g_strncasecmp( ent[i].code, cs, strlen( ent[i].code ) ) == 0 )
 				{
 					int j;
 					
@@ -228,7 +237,7 @@ void strip_html( char *in )
 		}
 	}
 	
-	strcpy( start, out );
+	*s = '\0';
 }
 
 char *escape_html( const char *html )
@@ -589,9 +598,10 @@ void srv_free( struct ns_srv_reply **srv )
 /* Word wrapping. Yes, I know this isn't UTF-8 clean. I'm willing to take the risk. */
 char *word_wrap( const char *msg, int line_len )
 {
-	GString *ret = g_string_sized_new( strlen( msg ) + 16 );
+	int len = strlen( msg );
+	GString *ret = g_string_sized_new( len + 16 );
 	
-	while( strlen( msg ) > line_len )
+	while( len > line_len )
 	{
 		int i;
 		
@@ -602,6 +612,7 @@ char *word_wrap( const char *msg, int line_len )
 		{
 			g_string_append_len( ret, msg, i + 1 );
 			msg += i + 1;
+			len -= i + 1;
 			continue;
 		}
 		
@@ -612,6 +623,7 @@ char *word_wrap( const char *msg, int line_len )
 				g_string_append_len( ret, msg, i + 1 );
 				g_string_append_c( ret, '\n' );
 				msg += i + 1;
+				len -= i + 1;
 				break;
 			}
 			else if( msg[i] == ' ' )
@@ -619,6 +631,7 @@ char *word_wrap( const char *msg, int line_len )
 				g_string_append_len( ret, msg, i );
 				g_string_append_c( ret, '\n' );
 				msg += i + 1;
+				len -= i + 1;
 				break;
 			}
 		}
@@ -627,9 +640,10 @@ char *word_wrap( const char *msg, int line_len )
 			g_string_append_len( ret, msg, line_len );
 			g_string_append_c( ret, '\n' );
 			msg += line_len;
+			len -= line_len;
 		}
 	}
-	g_string_append( ret, msg );
+	g_string_append_len( ret, msg, len );
 	
 	return g_string_free( ret, FALSE );
 }
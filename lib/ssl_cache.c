@@ -0,0 +1,123 @@
+  /********************************************************************\
+  * BitlBee -- An IRC to other IM-networks gateway                     *
+  *                                                                    *
+  * Copyright 2002-2012 Wilmer van der Gaast and others                *
+  \********************************************************************/
+
+/* SSL module - session cache shared by the SSL libraries              */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License with
+  the Debian GNU/Linux distribution in /usr/share/common-licenses/GPL;
+  if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+  Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <string.h>
+#include "ssl_client.h"
+
+/* Sessions are small (a few hundred bytes) and we rarely talk to more
+   than a handful of servers, so a short list in most-recently-used order
+   will do. */
+struct ssl_cache_entry
+{
+	char *host;
+	int port;
+	void *data;
+	size_t len;
+};
+
+static GSList *ssl_cache;
+static struct ssl_stats ssl_stats;
+
+static GSList *ssl_cache_find( const char *host, int port )
+{
+	GSList *l;
+	
+	for( l = ssl_cache; l; l = l->next )
+	{
+		struct ssl_cache_entry *e = l->data;
+		
+		if( e->port == port && g_strcasecmp( e->host, host ) == 0 )
+			return l;
+	}
+	
+	return NULL;
+}
+
+static void ssl_cache_free( struct ssl_cache_entry *e )
+{
+	ssl_cache = g_slist_remove( ssl_cache, e );
+	g_free( e->host );
+	g_free( e->data );
+	g_free( e );
+}
+
+void ssl_cache_store( const char *host, int port, const void *data, size_t len )
+{
+	struct ssl_cache_entry *e;
+	
+	if( host == NULL || data == NULL || len == 0 )
+		return;
+	
+	ssl_cache_remove( host, port );
+	
+	if( g_slist_length( ssl_cache ) >= SSL_CACHE_SIZE )
+		ssl_cache_free( g_slist_last( ssl_cache )->data );
+	
+	e = g_new0( struct ssl_cache_entry, 1 );
+	e->host = g_strdup( host );
+	e->port = port;
+	e->data = g_memdup( data, len );
+	e->len = len;
+	
+	ssl_cache = g_slist_prepend( ssl_cache, e );
+}
+
+void *ssl_cache_lookup( const char *host, int port, size_t *len )
+{
+	struct ssl_cache_entry *e;
+	GSList *l;
+	
+	if( host == NULL || ( l = ssl_cache_find( host, port ) ) == NULL )
+		return NULL;
+	
+	/* Move it to the front. */
+	e = l->data;
+	ssl_cache = g_slist_delete_link( ssl_cache, l );
+	ssl_cache = g_slist_prepend( ssl_cache, e );
+	
+	*len = e->len;
+	return e->data;
+}
+
+void ssl_cache_remove( const char *host, int port )
+{
+	GSList *l;
+	
+	if( host && ( l = ssl_cache_find( host, port ) ) )
+		ssl_cache_free( l->data );
+}
+
+void ssl_count_handshake( gboolean resumed )
+{
+	if( resumed )
+		ssl_stats.resumed ++;
+	else
+		ssl_stats.full ++;
+}
+
+const struct ssl_stats *ssl_get_stats( void )
+{
+	return &ssl_stats;
+}
@@ -102,4 +102,25 @@ G_MODULE_EXPORT b_input_condition ssl_getdirection( void *conn );
    a more useful string. Or NULL if it had no useful bits set. */
 G_MODULE_EXPORT char *ssl_verify_strerror( int code );
 
+/* Handshake counters, see ssl_get_stats(). */
+struct ssl_stats
+{
+	int full;               /* Handshakes done from scratch. */
+	int resumed;            /* Handshakes that resumed a cached session. */
+};
+
+G_MODULE_EXPORT const struct ssl_stats *ssl_get_stats( void );
+
+/* Session cache (ssl_cache.c) used by the SSL modules to resume sessions
+   instead of doing a full handshake every time we reconnect to the same
+   server. Keyed by (host, port), port is 0 for ssl_starttls(). The data
+   is whatever the SSL library needs to resume; lookup returns a pointer
+   owned by the cache, only valid until the next store/remove. */
+#define SSL_CACHE_SIZE 32
+
+void ssl_cache_store( const char *host, int port, const void *data, size_t len );
+void *ssl_cache_lookup( const char *host, int port, size_t *len );
+void ssl_cache_remove( const char *host, int port );
+void ssl_count_handshake( gboolean resumed );
+
 G_MODULE_EXPORT size_t ssl_des3_encrypt(const unsigned char *key, size_t key_len, const unsigned char *input, size_t input_len, const unsigned char *iv, unsigned char **res);
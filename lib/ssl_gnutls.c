@@ -57,6 +57,7 @@ struct scd
 	gboolean established;
 	int inpa;
 	char *hostname;
+	int port;               /* 0 for STARTTLS */
 	gboolean verify;
 	
 	gnutls_session session;
@@ -101,6 +102,7 @@ void *ssl_connect( char *host, int port, gboolean verify, ssl_input_function fun
 	conn->data = data;
 	conn->inpa = -1;
 	conn->hostname = g_strdup( host );
+	conn->port = port;
 	conn->verify = verify && global.conf->cafile;
 	
 	if( conn->fd < 0 )
@@ -249,6 +251,8 @@ char *ssl_verify_strerror( int code )
 static gboolean ssl_connected( gpointer data, gint source, b_input_condition cond )
 {
 	struct scd *conn = data;
+	void *sess_data;
+	size_t sess_len;
 	
 	if( source == -1 )
 	{
@@ -268,6 +272,9 @@ static gboolean ssl_connected( gpointer data, gint source, b_input_condition con
 	gnutls_set_default_priority( conn->session );
 	gnutls_credentials_set( conn->session, GNUTLS_CRD_CERTIFICATE, xcred );
 	
+	if( ( sess_data = ssl_cache_lookup( conn->hostname, conn->port, &sess_len ) ) )
+		gnutls_session_set_data( conn->session, sess_data, sess_len );
+	
 	sock_make_nonblocking( conn->fd );
 	gnutls_transport_set_ptr( conn->session, (gnutls_transport_ptr) GNUTLS_STUPID_CAST conn->fd );
 	
@@ -290,6 +297,9 @@ static gboolean ssl_handshake( gpointer data, gint source, b_input_condition con
 		{
 			conn->func( conn->data, 0, NULL, cond );
 			
+			/* Don't try that session again if it's what broke. */
+			ssl_cache_remove( conn->hostname, conn->port );
+			
 			gnutls_deinit( conn->session );
 			closesocket( conn->fd );
 			
@@ -309,6 +319,15 @@ static gboolean ssl_handshake( gpointer data, gint source, b_input_condition con
 		}
 		else
 		{
+			gnutls_datum_t sess;
+			
+			ssl_count_handshake( gnutls_session_is_resumed( conn->session ) );
+			if( gnutls_session_get_data2( conn->session, &sess ) == 0 )
+			{
+				ssl_cache_store( conn->hostname, conn->port, sess.data, sess.size );
+				gnutls_free( sess.data );
+			}
+			
 			/* For now we can't handle non-blocking perfectly everywhere... */
 			sock_make_blocking( conn->fd );
 		
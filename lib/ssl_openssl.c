@@ -38,6 +38,9 @@ int ssl_errno = 0;
 
 static gboolean initialized = FALSE;
 
+/* One context for all connections, setting one up isn't cheap. */
+static SSL_CTX *ssl_ctx;
+
 struct scd
 {
 	ssl_input_function func;
@@ -45,11 +48,12 @@ struct scd
 	int fd;
 	gboolean established;
 	gboolean verify;
+	char *hostname;
+	int port;		/* 0 for STARTTLS */
 	
 	int inpa;
 	int lasterr;		/* Necessary for SSL_get_error */
 	SSL *ssl;
-	SSL_CTX *ssl_ctx;
 };
 
 static gboolean ssl_connected( gpointer data, gint source, b_input_condition cond );
@@ -59,9 +63,29 @@ static gboolean ssl_handshake( gpointer data, gint source, b_input_condition con
 
 void ssl_init( void )
 {
+	if( initialized )
+		return;
+	
 	initialized = TRUE;
 	SSL_library_init();
 	// SSLeay_add_ssl_algorithms();
+	
+	ssl_ctx = SSL_CTX_new( TLSv1_client_method() );
+	
+	/* We do resumption ourselves (ssl_cache.c), keyed by host. */
+	if( ssl_ctx )
+		SSL_CTX_set_session_cache_mode( ssl_ctx, SSL_SESS_CACHE_OFF );
+}
+
+static void ssl_conn_free( struct scd *conn )
+{
+	if( conn->ssl )
+	{
+		SSL_shutdown( conn->ssl );
+		SSL_free( conn->ssl );
+	}
+	g_free( conn->hostname );
+	g_free( conn );
 }
 
 void *ssl_connect( char *host, int port, gboolean verify, ssl_input_function func, gpointer data )
@@ -78,6 +102,8 @@ void *ssl_connect( char *host, int port, gboolean verify, ssl_input_function fun
 	conn->func = func;
 	conn->data = data;
 	conn->inpa = -1;
+	conn->hostname = g_strdup( host );
+	conn->port = port;
 	
 	return conn;
 }
@@ -91,6 +117,7 @@ void *ssl_starttls( int fd, char *hostname, gboolean verify, ssl_input_function
 	conn->data = data;
 	conn->inpa = -1;
 	conn->verify = verify && global.conf->cafile;
+	conn->hostname = g_strdup( hostname );
 	
 	/* This function should be called via a (short) timeout instead of
 	   directly from here, because these SSL calls are *supposed* to be
@@ -116,7 +143,8 @@ static gboolean ssl_starttls_real( gpointer data, gint source, b_input_condition
 static gboolean ssl_connected( gpointer data, gint source, b_input_condition cond )
 {
 	struct scd *conn = data;
-	SSL_METHOD *meth;
+	const unsigned char *sess_data;
+	size_t sess_len;
 	
 	/* Right now we don't have any verification functionality for OpenSSL. */
 
@@ -124,7 +152,7 @@ static gboolean ssl_connected( gpointer data, gint source, b_input_condition con
 	{
 		conn->func( conn->data, 1, NULL, cond );
 		if( source >= 0 ) closesocket( source );
-		g_free( conn );
+		ssl_conn_free( conn );
 
 		return FALSE;
 	}
@@ -137,15 +165,24 @@ static gboolean ssl_connected( gpointer data, gint source, b_input_condition con
 		ssl_init();
 	}
 	
-	meth = TLSv1_client_method();
-	conn->ssl_ctx = SSL_CTX_new( meth );
-	if( conn->ssl_ctx == NULL )
+	if( ssl_ctx == NULL )
 		goto ssl_connected_failure;
 	
-	conn->ssl = SSL_new( conn->ssl_ctx );
+	conn->ssl = SSL_new( ssl_ctx );
 	if( conn->ssl == NULL )
 		goto ssl_connected_failure;
 	
+	if( ( sess_data = ssl_cache_lookup( conn->hostname, conn->port, &sess_len ) ) )
+	{
+		SSL_SESSION *sess = d2i_SSL_SESSION( NULL, &sess_data, sess_len );
+		
+		if( sess )
+		{
+			SSL_set_session( conn->ssl, sess );
+			SSL_SESSION_free( sess );
+		}
+	}
+	
 	/* We can do at least the handshake with non-blocking I/O */
 	sock_make_nonblocking( conn->fd );
 	SSL_set_fd( conn->ssl, conn->fd );
@@ -155,22 +192,33 @@ static gboolean ssl_connected( gpointer data, gint source, b_input_condition con
 ssl_connected_failure:
 	conn->func( conn->data, 0, NULL, cond );
 	
-	if( conn->ssl )
-	{
-		SSL_shutdown( conn->ssl );
-		SSL_free( conn->ssl );
-	}
-	if( conn->ssl_ctx )
-	{
-		SSL_CTX_free( conn->ssl_ctx );
-	}
 	if( source >= 0 ) closesocket( source );
-	g_free( conn );
+	ssl_conn_free( conn );
 	
 	return FALSE;
 
 }	
 
+static void ssl_save_session( struct scd *conn )
+{
+	SSL_SESSION *sess = SSL_get1_session( conn->ssl );
+	unsigned char *buf, *p;
+	int len;
+	
+	if( sess == NULL )
+		return;
+	
+	if( ( len = i2d_SSL_SESSION( sess, NULL ) ) > 0 )
+	{
+		p = buf = g_malloc( len );
+		i2d_SSL_SESSION( sess, &p );
+		ssl_cache_store( conn->hostname, conn->port, buf, len );
+		g_free( buf );
+	}
+	
+	SSL_SESSION_free( sess );
+}
+
 static gboolean ssl_handshake( gpointer data, gint source, b_input_condition cond )
 {
 	struct scd *conn = data;
@@ -183,12 +231,11 @@ static gboolean ssl_handshake( gpointer data, gint source, b_input_condition con
 		{
 			conn->func( conn->data, 0, NULL, cond );
 			
-			SSL_shutdown( conn->ssl );
-			SSL_free( conn->ssl );
-			SSL_CTX_free( conn->ssl_ctx );
+			/* Don't try that session again if it's what broke. */
+			ssl_cache_remove( conn->hostname, conn->port );
 			
 			if( source >= 0 ) closesocket( source );
-			g_free( conn );
+			ssl_conn_free( conn );
 			
 			return FALSE;
 		}
@@ -197,6 +244,9 @@ static gboolean ssl_handshake( gpointer data, gint source, b_input_condition con
 		return FALSE;
 	}
 	
+	ssl_count_handshake( SSL_session_reused( conn->ssl ) );
+	ssl_save_session( conn );
+	
 	conn->established = TRUE;
 	sock_make_blocking( conn->fd );		/* For now... */
 	conn->func( conn->data, 0, conn, cond );
@@ -272,7 +322,7 @@ void ssl_disconnect( void *conn_ )
 	closesocket( conn->fd );
 	
 	SSL_free( conn->ssl );
-	SSL_CTX_free( conn->ssl_ctx );
+	g_free( conn->hostname );
 	g_free( conn );
 }
 
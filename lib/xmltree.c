@@ -110,12 +110,91 @@ GMarkupParser xt_parser_funcs =
 	NULL
 };
 
+/* Handler lookups are done on (parent, name) pairs. Either field can be
+   NULL, which is how wildcard entries from the handler table are stored. */
+struct xt_handler_key
+{
+	const char *parent, *name;
+};
+
+static guint xt_handler_key_hash( gconstpointer key )
+{
+	const struct xt_handler_key *k = key;
+	const char *s;
+	guint h = 5381;
+	
+	/* Case-insensitive since tag names are compared that way. The '/'
+	   keeps "a" + "bc" and "ab" + "c" apart. */
+	for( s = k->parent; s && *s; s ++ )
+		h = h * 33 + g_ascii_tolower( *s );
+	h = h * 33 + '/';
+	for( s = k->name; s && *s; s ++ )
+		h = h * 33 + g_ascii_tolower( *s );
+	
+	return h;
+}
+
+static gboolean xt_handler_str_equal( const char *a, const char *b )
+{
+	if( a == NULL || b == NULL )
+		return a == b;
+	
+	return g_strcasecmp( a, b ) == 0;
+}
+
+static gboolean xt_handler_key_equal( gconstpointer a_, gconstpointer b_ )
+{
+	const struct xt_handler_key *a = a_, *b = b_;
+	
+	return xt_handler_str_equal( a->parent, b->parent ) &&
+	       xt_handler_str_equal( a->name, b->name );
+}
+
+static void xt_handler_list_free( gpointer list )
+{
+	g_array_free( list, TRUE );
+}
+
+/* Compile the handler table into a hash of (parent, name) -> list of table
+   offsets. Offsets are appended in table order so each list stays sorted,
+   xt_handle() relies on that to preserve handler priorities. */
+static GHashTable *xt_index_handlers( const struct xt_handler_entry *handlers )
+{
+	GHashTable *index;
+	int i;
+	
+	index = g_hash_table_new_full( xt_handler_key_hash, xt_handler_key_equal,
+	                               g_free, xt_handler_list_free );
+	
+	for( i = 0; handlers[i].func; i ++ )
+	{
+		struct xt_handler_key k, *key;
+		GArray *list;
+		
+		k.parent = handlers[i].parent;
+		k.name = handlers[i].name;
+		
+		if( !( list = g_hash_table_lookup( index, &k ) ) )
+		{
+			key = g_memdup( &k, sizeof( k ) );
+			list = g_array_new( FALSE, FALSE, sizeof( int ) );
+			g_hash_table_insert( index, key, list );
+		}
+		
+		g_array_append_val( list, i );
+	}
+	
+	return index;
+}
+
 struct xt_parser *xt_new( const struct xt_handler_entry *handlers, gpointer data )
 {
 	struct xt_parser *xt = g_new0( struct xt_parser, 1 );
 	
 	xt->data = data;
 	xt->handlers = handlers;
+	if( handlers )
+		xt->handler_index = xt_index_handlers( handlers );
 	xt_reset( xt );
 	
 	return xt;
@@ -157,7 +236,7 @@ int xt_handle( struct xt_parser *xt, struct xt_node *node, int depth )
 {
 	struct xt_node *c;
 	xt_status st;
-	int i;
+	int i, j, n;
 	
 	/* Just in case someone likes infinite loops... */
 	if( xt->root == NULL )
@@ -173,21 +252,41 @@ int xt_handle( struct xt_parser *xt, struct xt_node *node, int depth )
 	
 	if( node->flags & XT_COMPLETE && !( node->flags & XT_SEEN ) )
 	{
-		if( xt->handlers ) for( i = 0; xt->handlers[i].func; i ++ )
+		if( xt->handler_index )
 		{
-			/* This one is fun! \o/ */
+			struct xt_handler_key k;
+			GArray *cand[4];
+			guint pos[4] = { 0, 0, 0, 0 };
 			
-			    /* If handler.name == NULL it means it should always match. */
-			if( ( xt->handlers[i].name == NULL || 
-			      /* If it's not, compare. There should always be a name. */
-			      g_strcasecmp( xt->handlers[i].name, node->name ) == 0 ) &&
-			    /* If handler.parent == NULL, it's a match. */
-			    ( xt->handlers[i].parent == NULL ||
-			      /* If there's a parent node, see if the name matches. */
-			      ( node->parent ? g_strcasecmp( xt->handlers[i].parent, node->parent->name ) == 0 : 
-			      /* If there's no parent, the handler should mention <root> as a parent. */
-			                       strcmp( xt->handlers[i].parent, "<root>" ) == 0 ) ) )
+			/* Collect the exact match and the three wildcard variants.
+			   If there's no parent, the handler should mention <root>
+			   as a parent. */
+			k.parent = node->parent ? node->parent->name : "<root>";
+			k.name = node->name;
+			cand[0] = g_hash_table_lookup( xt->handler_index, &k );
+			k.name = NULL;
+			cand[1] = g_hash_table_lookup( xt->handler_index, &k );
+			k.parent = NULL;
+			cand[2] = g_hash_table_lookup( xt->handler_index, &k );
+			k.name = node->name;
+			cand[3] = g_hash_table_lookup( xt->handler_index, &k );
+			
+			/* Merge the lists, always taking the lowest table offset
+			   so handlers are tried in the order they were defined. */
+			while( 1 )
 			{
+				for( n = -1, j = 0; j < 4; j ++ )
+					if( cand[j] && pos[j] < cand[j]->len &&
+					    ( n == -1 || g_array_index( cand[j], int, pos[j] ) <
+					                 g_array_index( cand[n], int, pos[n] ) ) )
+						n = j;
+				
+				if( n == -1 )
+					break;
+				
+				i = g_array_index( cand[n], int, pos[n] );
+				pos[n] ++;
+				
 				st = xt->handlers[i].func( node, xt->data );
 				
 				if( st == XT_ABORT )
@@ -273,19 +372,58 @@ struct xt_node *xt_from_string( const char *in )
 	return ret;
 }
 
-static void xt_to_string_real( struct xt_node *node, GString *str )
+/* Append text to str with the XML special characters escaped. Done in a
+   single pass over the input, copying unescaped runs as a whole, instead
+   of building a temporary escaped copy first. */
+static void xt_append_escaped( GString *str, const char *text, int len )
+{
+	const char *run, *s, *end = text + len;
+	char esc[8];
+	
+	for( run = s = text; s < end; s ++ )
+	{
+		unsigned char c = *s;
+		
+		if( c == '&' )
+			strcpy( esc, "&amp;" );
+		else if( c == '<' )
+			strcpy( esc, "&lt;" );
+		else if( c == '>' )
+			strcpy( esc, "&gt;" );
+		else if( c == '\'' )
+			strcpy( esc, "&apos;" );
+		else if( c == '"' )
+			strcpy( esc, "&quot;" );
+		else if( ( c < ' ' && c != '\t' && c != '\n' && c != '\r' ) || c == 0x7f )
+			g_snprintf( esc, sizeof( esc ), "&#x%x;", c );
+		else
+			continue;
+		
+		g_string_append_len( str, run, s - run );
+		g_string_append( str, esc );
+		run = s + 1;
+	}
+	
+	g_string_append_len( str, run, end - run );
+}
+
+/* Serialize node and append it to str. Useful to write into an existing
+   buffer (like a connection's output queue) without an extra copy. */
+void xt_to_gstring( struct xt_node *node, GString *str )
 {
-	char *buf;
 	struct xt_node *c;
 	int i;
 	
-	g_string_append_printf( str, "<%s", node->name );
+	g_string_append_c( str, '<' );
+	g_string_append( str, node->name );
 	
 	for( i = 0; node->attr[i].key; i ++ )
 	{
-		buf = g_markup_printf_escaped( " %s=\"%s\"", node->attr[i].key, node->attr[i].value );
-		g_string_append( str, buf );
-		g_free( buf );
+		g_string_append_c( str, ' ' );
+		g_string_append( str, node->attr[i].key );
+		g_string_append( str, "=\"" );
+		xt_append_escaped( str, node->attr[i].value, strlen( node->attr[i].value ) );
+		g_string_append_c( str, '"' );
 	}
 	
 	if( node->text == NULL && node->children == NULL )
@@ -294,18 +432,16 @@ static void xt_to_string_real( struct xt_node *node, GString *str )
 		return;
 	}
 	
-	g_string_append( str, ">" );
+	g_string_append_c( str, '>' );
 	if( node->text_len > 0 )
-	{
-		buf = g_markup_escape_text( node->text, node->text_len );
-		g_string_append( str, buf );
-		g_free( buf );
-	}
+		xt_append_escaped( str, node->text, node->text_len );
 	
 	for( c = node->children; c; c = c->next )
-		xt_to_string_real( c, str );
+		xt_to_gstring( c, str );
 	
-	g_string_append_printf( str, "</%s>", node->name );
+	g_string_append( str, "</" );
+	g_string_append( str, node->name );
+	g_string_append_c( str, '>' );
 }
 
 char *xt_to_string( struct xt_node *node )
@@ -314,7 +450,7 @@ char *xt_to_string( struct xt_node *node )
 	char *real;
 	
 	ret = g_string_new( "" );
-	xt_to_string_real( node, ret );
+	xt_to_gstring( node, ret );
 	
 	real = ret->str;
 	g_string_free( ret, FALSE );
@@ -459,6 +595,9 @@ void xt_free( struct xt_parser *xt )
 	if( xt->root )
 		xt_free_node( xt->root );
 	
+	if( xt->handler_index )
+		g_hash_table_destroy( xt->handler_index );
+	
 	g_markup_parse_context_free( xt->parser );
 	
 	g_free( xt );
@@ -71,6 +71,7 @@ struct xt_parser
 	struct xt_node *cur;
 	
 	const struct xt_handler_entry *handlers;
+	GHashTable *handler_index;
 	gpointer data;
 	
 	GError *gerr;
@@ -83,6 +84,7 @@ int xt_handle( struct xt_parser *xt, struct xt_node *node, int depth );
 void xt_cleanup( struct xt_parser *xt, struct xt_node *node, int depth );
 struct xt_node *xt_from_string( const char *in );
 char *xt_to_string( struct xt_node *node );
+void xt_to_gstring( struct xt_node *node, GString *str );
 void xt_print( struct xt_node *node );
 struct xt_node *xt_dup( struct xt_node *node );
 void xt_free_node( struct xt_node *node );
@@ -122,17 +122,19 @@ int keygen_in_progress(irc_t *irc, const char *handle, const char *protocol);
 /* start background process to generate a (new) key for a given account */
 void otr_keygen(irc_t *irc, const char *handle, const char *protocol);
 
-/* main function for the forked keygen slave */
-void keygen_child_main(OtrlUserState us, int infd, int outfd);
+/* main function for the forked keygen worker, returns its exit status */
+int keygen_child_main(const char *accountname, const char *protocol,
+                      const char *filename, int outfd);
+
+/* start as many queued keygen jobs as there are free workers */
+void keygen_dispatch(void);
 
 /* mainloop handler for when a keygen finishes */
 gboolean keygen_finish_handler(gpointer data, gint fd, b_input_condition cond);
 
-/* copy the contents of file a to file b, overwriting it if it exists */
-void copyfile(const char *a, const char *b);
-
-/* read one line of input from a stream, excluding trailing newline */
-void myfgets(char *s, int size, FILE *stream);
+/* add the key in file newkeys to the user's keys (replacing any old key for
+   the same account), returns 0 (and tells the user) on failure */
+int keygen_merge(irc_t *irc, const char *newkeys);
 
 /* some yes/no handlers */
 void yes_keygen(void *data);
@@ -248,24 +250,49 @@ gboolean otr_irc_new(irc_t *irc)
 	return TRUE;
 }
 
+/* all keygen jobs in this process, in the order they were requested */
+static kg_t *keygen_jobs;
+
+static void keygen_free(kg_t *kg)
+{
+	kg_t **p;
+	
+	for(p=&keygen_jobs; *p; p=&(*p)->next) {
+		if(*p == kg) {
+			*p = kg->next;
+			break;
+		}
+	}
+	
+	if(kg->pid) {
+		b_event_remove(kg->inpa);
+		close(kg->fd);
+		kill(kg->pid, SIGTERM);
+		waitpid(kg->pid, NULL, 0);
+	}
+	if(kg->filename) {
+		unlink(kg->filename);
+		g_free(kg->filename);
+	}
+	g_free(kg->accountname);
+	g_free(kg->protocol);
+	g_free(kg);
+}
+
 void otr_irc_free(irc_t *irc)
 {
 	otr_t *otr = irc->otr;
-	otrl_userstate_free(otr->us);
-	if(otr->keygen) {
-		kill(otr->keygen, SIGTERM);
-		waitpid(otr->keygen, NULL, 0);
-		/* TODO: remove stale keygen tempfiles */
-	}
-	if(otr->to)
-		fclose(otr->to);
-	if(otr->from)
-		fclose(otr->from);
-	while(otr->todo) {
-		kg_t *p = otr->todo;
-		otr->todo = p->next;
-		g_free(p);
+	kg_t *kg, *next;
+	
+	for(kg=keygen_jobs; kg; kg=next) {
+		next = kg->next;
+		if(kg->irc == irc)
+			keygen_free(kg);
 	}
+	/* other users' jobs can use the freed workers now */
+	keygen_dispatch();
+	
+	otrl_userstate_free(otr->us);
 	g_free(otr);
 }
 
@@ -1556,6 +1583,7 @@ void show_general_otr_info(irc_t *irc)
 	OtrlPrivKey *key;
 	char human[45];
 	kg_t *kg;
+	int njobs = 0;
 
 	/* list all privkeys (including ones being generated) */
 	irc_rootmsg(irc, "\x1fprivate keys:\x1f");
@@ -1578,18 +1606,14 @@ void show_general_otr_info(irc_t *irc)
 		if(hash) /* should always succeed */
 			irc_rootmsg(irc, "    %s", human);
 	}
-	if(irc->otr->sent_accountname) {
-		irc_rootmsg(irc, "  %s/%s - DSA", irc->otr->sent_accountname,
-			irc->otr->sent_protocol);
-		irc_rootmsg(irc, "    (being generated)");
-	}
-	for(kg=irc->otr->todo; kg; kg=kg->next) {
+	for(kg=keygen_jobs; kg; kg=kg->next) {
+		if(kg->irc != irc)
+			continue;
 		irc_rootmsg(irc, "  %s/%s - DSA", kg->accountname, kg->protocol);
-		irc_rootmsg(irc, "    (queued)");
+		irc_rootmsg(irc, kg->pid ? "    (being generated)" : "    (queued)");
+		njobs++;
 	}
-	if(key == irc->otr->us->privkey_root &&
-	   !irc->otr->sent_accountname &&
-	   kg == irc->otr->todo)
+	if(key == irc->otr->us->privkey_root && njobs == 0)
 		irc_rootmsg(irc, "  (none)");
 
 	/* list all contexts */
@@ -1660,17 +1684,10 @@ int keygen_in_progress(irc_t *irc, const char *handle, const char *protocol)
 {
 	kg_t *kg;
 	
-	if(!irc->otr->sent_accountname || !irc->otr->sent_protocol)
-		return 0;
-
-	/* are we currently working on this key? */
-	if(!strcmp(handle, irc->otr->sent_accountname) &&
-	   !strcmp(protocol, irc->otr->sent_protocol))
-		return 1;
-	
-	/* do we have it queued for later? */
-	for(kg=irc->otr->todo; kg; kg=kg->next) {
-		if(!strcmp(handle, kg->accountname) &&
+	/* are we working on this key, or do we have it queued for later? */
+	for(kg=keygen_jobs; kg; kg=kg->next) {
+		if(kg->irc == irc &&
+		   !strcmp(handle, kg->accountname) &&
 		   !strcmp(protocol, kg->protocol))
 			return 1;
 	}
@@ -1678,184 +1695,330 @@ int keygen_in_progress(irc_t *irc, const char *handle, const char *protocol)
 	return 0;
 }
 
+/* number of keys we generate at the same time, for all users together */
+static int keygen_max_workers(void)
+{
+	long n = global.conf->otr_keygen_workers;
+	
+	if(n <= 0)
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	
+	return n > 0 ? n : 1;
+}
+
 void otr_keygen(irc_t *irc, const char *handle, const char *protocol)
 {
+	kg_t *kg, **p;
+	int waiting = 0;
+	
 	/* do nothing if a key for the requested account is already being generated */
 	if(keygen_in_progress(irc, handle, protocol))
 		return;
+	
+	kg = g_new0(kg_t, 1);
+	kg->accountname = g_strdup(handle);
+	kg->protocol = g_strdup(protocol);
+	kg->irc = irc;
+	kg->queued = time(NULL);
+	
+	for(p=&keygen_jobs; *p; p=&(*p)->next)
+		waiting += (*p)->pid == 0;
+	*p = kg;
+	
+	keygen_dispatch();
+	
+	/* if it couldn't be started right away, it's still in the list. the
+	   jobs waiting already don't necessarily go first (see
+	   keygen_dispatch()), so just say how many there are */
+	for(p=&keygen_jobs; *p && *p != kg; p=&(*p)->next);
+	if(*p && !kg->pid)
+		irc_rootmsg(irc, "otr keygen for %s/%s queued, %d other key%s waiting",
+			handle, protocol, waiting, waiting == 1 ? "" : "s");
+}
 
-	/* see if we already have a keygen child running. if not, start one and put a
-	   handler on its output. */
-	if(!irc->otr->keygen || waitpid(irc->otr->keygen, NULL, WNOHANG)) {
-		pid_t p;
-		int to[2], from[2];
-		FILE *tof, *fromf;
-		
-		if(pipe(to) < 0 || pipe(from) < 0) {
-			irc_rootmsg(irc, "otr keygen: couldn't create pipe: %s", strerror(errno));
-			return;
-		}
+/* start a worker for a job, returns 0 (and tells the user) on failure */
+static int keygen_start(kg_t *kg)
+{
+	irc_t *irc = kg->irc;
+	char filename[128];
+	int from[2], tempfd;
+	pid_t p;
+	
+	strncpy(filename, "/tmp/bitlbee-XXXXXX", 128);
+	if((tempfd = mkstemp(filename)) < 0) {
+		irc_rootmsg(irc, "otr keygen: couldn't create temporary file: %s", strerror(errno));
+		return 0;
+	}
+	close(tempfd);
+	
+	if(pipe(from) < 0) {
+		irc_rootmsg(irc, "otr keygen: couldn't create pipe: %s", strerror(errno));
+		unlink(filename);
+		return 0;
+	}
+	
+	p = fork();
+	if(p<0) {
+		irc_rootmsg(irc, "otr keygen: couldn't fork: %s", strerror(errno));
+		close(from[0]);
+		close(from[1]);
+		unlink(filename);
+		return 0;
+	}
+	
+	if(!p) {
+		/* child process */
+		signal(SIGTERM, exit);
+		close(from[0]);
+		exit(keygen_child_main(kg->accountname, kg->protocol, filename, from[1]));
+	}
+	
+	close(from[1]);
+	kg->pid = p;
+	kg->fd = from[0];
+	kg->filename = g_strdup(filename);
+	kg->inpa = b_input_add(kg->fd, B_EV_IO_READ, keygen_finish_handler, kg);
+	
+	return 1;
+}
+
+void keygen_dispatch(void)
+{
+	int running = 0, max = keygen_max_workers();
+	kg_t *kg;
+	
+	for(kg=keygen_jobs; kg; kg=kg->next)
+		running += kg->pid != 0;
+	
+	while(running < max) {
+		kg_t *next = NULL;
+		int next_busy = 0;
 		
-		tof = fdopen(to[1], "w");
-		fromf = fdopen(from[0], "r");
-		if(!tof || !fromf) {
-			irc_rootmsg(irc, "otr keygen: couldn't streamify pipe: %s", strerror(errno));
-			return;
+		/* be fair: take the oldest job of the user with the fewest keys
+		   being generated right now, so one user with many accounts can't
+		   hold up everybody else */
+		for(kg=keygen_jobs; kg; kg=kg->next) {
+			kg_t *o;
+			int busy = 0;
+			
+			if(kg->pid)
+				continue;
+			
+			for(o=keygen_jobs; o; o=o->next)
+				busy += o->pid && o->irc == kg->irc;
+			
+			if(!next || busy < next_busy) {
+				next = kg;
+				next_busy = busy;
+			}
 		}
 		
-		p = fork();
-		if(p<0) {
-			irc_rootmsg(irc, "otr keygen: couldn't fork: %s", strerror(errno));
-			return;
-		}
+		if(!next)
+			break;
 		
-		if(!p) {
-			/* child process */
-			signal(SIGTERM, exit);
-			keygen_child_main(irc->otr->us, to[0], from[1]);
-			exit(0);
+		if(!keygen_start(next)) {
+			keygen_free(next);
+			continue;
 		}
+		running++;
 		
-		irc->otr->keygen = p;
-		irc->otr->to = tof;
-		irc->otr->from = fromf;
-		irc->otr->sent_accountname = NULL;
-		irc->otr->sent_protocol = NULL;
-		irc->otr->todo = NULL;
-		b_input_add(from[0], B_EV_IO_READ, keygen_finish_handler, irc);
-	}
-	
-	/* is the keygen slave currently working? */
-	if(irc->otr->sent_accountname) {
-		/* enqueue our job for later transmission */
-		kg_t **kg = &irc->otr->todo;
-		while(*kg)
-			kg=&((*kg)->next);
-		*kg = g_new0(kg_t, 1);
-		(*kg)->accountname = g_strdup(handle);
-		(*kg)->protocol = g_strdup(protocol);
-	} else {
-		/* send our job over and remember it */
-		fprintf(irc->otr->to, "%s\n%s\n", handle, protocol);
-		fflush(irc->otr->to);
-		irc->otr->sent_accountname = g_strdup(handle);
-		irc->otr->sent_protocol = g_strdup(protocol);
+		/* only worth mentioning if it had to wait */
+		if(time(NULL) > next->queued)
+			irc_rootmsg(next->irc, "otr keygen for %s/%s started",
+				next->accountname, next->protocol);
 	}
 }
 
-void keygen_child_main(OtrlUserState us, int infd, int outfd)
+int keygen_child_main(const char *accountname, const char *protocol,
+                      const char *filename, int outfd)
 {
-	FILE *input, *output;
-	char filename[128], accountname[512], protocol[512];
+	/* start from an empty userstate so the file only gets the new key (the
+	   process we're forked from may be serving other users, too) */
+	OtrlUserState us = otrl_userstate_create();
 	gcry_error_t e;
-	int tempfd;
+	char *msg;
+	int st;
 	
-	input = fdopen(infd, "r");
-	output = fdopen(outfd, "w");
+	e = otrl_privkey_generate(us, filename, accountname, protocol);
 	
-	while(!feof(input) && !ferror(input) && !feof(output) && !ferror(output)) {
-		myfgets(accountname, 512, input);
-		myfgets(protocol, 512, input);
-		
-		strncpy(filename, "/tmp/bitlbee-XXXXXX", 128);
-		tempfd = mkstemp(filename);
-		close(tempfd);
-
-		e = otrl_privkey_generate(us, filename, accountname, protocol);
-		if(e) {
-			fprintf(output, "\n");  /* this means failure */
-			fprintf(output, "otr keygen: %s\n", gcry_strerror(e));
-			unlink(filename);
-		} else {
-			fprintf(output, "%s\n", filename);
-			fprintf(output, "otr keygen for %s/%s complete\n", accountname, protocol);
-		}
-		fflush(output);
-	}
+	/* an empty line means success, otherwise it's an error message. if the
+	   parent doesn't get all of it, it sees a failure */
+	msg = g_strdup_printf("%s\n", e ? gcry_strerror(e) : "");
+	st = write(outfd, msg, strlen(msg)) == strlen(msg) && !e ? 0 : 1;
+	g_free(msg);
+	close(outfd);
 	
-	fclose(input);
-	fclose(output);
+	return st;
 }
 
 gboolean keygen_finish_handler(gpointer data, gint fd, b_input_condition cond)
 {
-	irc_t *irc = (irc_t *)data;
-	char filename[512], msg[512];
-
-	myfgets(filename, 512, irc->otr->from);
-	myfgets(msg, 512, irc->otr->from);
-	
-	irc_rootmsg(irc, "%s", msg);
-	if(filename[0]) {
-		if(strsane(irc->user->nick)) {
-			char *kf = g_strdup_printf("%s%s.otr_keys", global.conf->configdir, irc->user->nick);
-			char *tmp = g_strdup_printf("%s.new", kf);
-			copyfile(filename, tmp);
-			unlink(filename);
-			rename(tmp,kf);
-			otrl_privkey_read(irc->otr->us, kf);
-			g_free(kf);
-			g_free(tmp);
-		} else {
-			otrl_privkey_read(irc->otr->us, filename);
-			unlink(filename);
-		}
-	}
-	
-	/* forget this job */
-	g_free(irc->otr->sent_accountname);
-	g_free(irc->otr->sent_protocol);
-	irc->otr->sent_accountname = NULL;
-	irc->otr->sent_protocol = NULL;
-	
-	/* see if there are any more in the queue */
-	if(irc->otr->todo) {
-		kg_t *p = irc->otr->todo;
-		/* send the next one over */
-		fprintf(irc->otr->to, "%s\n%s\n", p->accountname, p->protocol);
-		fflush(irc->otr->to);
-		irc->otr->sent_accountname = p->accountname;
-		irc->otr->sent_protocol = p->protocol;
-		irc->otr->todo = p->next;
-		g_free(p);
-		return TRUE;   /* keep watching */
-	} else {
-		/* okay, the slave is idle now, so kill him */
-		fclose(irc->otr->from);
-		fclose(irc->otr->to);
-		irc->otr->from = irc->otr->to = NULL;
-		kill(irc->otr->keygen, SIGTERM);
-		waitpid(irc->otr->keygen, NULL, 0);
-		irc->otr->keygen = 0;
-		return FALSE;  /* unregister ourselves */
-	}
+	kg_t *kg = data;
+	irc_t *irc = kg->irc;
+	char msg[512];
+	int n, status = -1;
+	
+	n = read(kg->fd, msg, sizeof(msg) - 1);
+	msg[n > 0 ? n : 0] = '\0';
+	
+	/* the worker is done either way */
+	close(kg->fd);
+	waitpid(kg->pid, &status, 0);
+	kg->pid = 0;
+	
+	if(n <= 0 || msg[n-1] != '\n' || !WIFEXITED(status)) {
+		irc_rootmsg(irc, "otr keygen for %s/%s failed: worker died",
+			kg->accountname, kg->protocol);
+	} else if(g_strchomp(msg)[0] || WEXITSTATUS(status) != 0) {
+		irc_rootmsg(irc, "otr keygen for %s/%s failed: %s",
+			kg->accountname, kg->protocol, msg[0] ? msg : "unknown error");
+	} else if(keygen_merge(irc, kg->filename)) {
+		irc_rootmsg(irc, "otr keygen for %s/%s complete (%d seconds)",
+			kg->accountname, kg->protocol, (int) (time(NULL) - kg->queued));
+	}
+	
+	keygen_free(kg);
+	keygen_dispatch();
+	
+	return FALSE;
 }
 
-void copyfile(const char *a, const char *b)
+/* libotr has no public function to write a set of keys, so this does the
+   same as account_write() and sexp_write() in libotr's privkey.c. What we
+   wrote is read back with otrl_privkey_read() before it replaces the old
+   key file. */
+static void keygen_write_sexp(FILE *f, gcry_sexp_t sexp)
 {
-	int fda, fdb;
-	int n;
-	char buf[1024];
+	size_t len = gcry_sexp_sprint(sexp, GCRYSEXP_FMT_ADVANCED, NULL, 0);
+	char *buf = g_malloc(len);
 	
-	fda = open(a, O_RDONLY);
-	fdb = open(b, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	gcry_sexp_sprint(sexp, GCRYSEXP_FMT_ADVANCED, buf, len);
+	fprintf(f, "%s", buf);
+	g_free(buf);
+}
+
+static gcry_error_t keygen_write_key(FILE *f, OtrlPrivKey *key)
+{
+	gcry_sexp_t sexp;
+	gcry_error_t e;
 	
-	while((n=read(fda, buf, 1024)) > 0)
-		write(fdb, buf, n);
+	fprintf(f, " (account\n");
+	if((e = gcry_sexp_build(&sexp, NULL, "(name %s)", key->accountname)))
+		return e;
+	keygen_write_sexp(f, sexp);
+	gcry_sexp_release(sexp);
+	if((e = gcry_sexp_build(&sexp, NULL, "(protocol %s)", key->protocol)))
+		return e;
+	keygen_write_sexp(f, sexp);
+	gcry_sexp_release(sexp);
+	keygen_write_sexp(f, key->privkey);
+	fprintf(f, " )\n");
 	
-	close(fda);
-	close(fdb);	
+	return 0;
 }
 
-void myfgets(char *s, int size, FILE *stream)
+/* check that file has the keys from new, and those from us for all the
+   other accounts, and nothing else */
+static int keygen_check_keys(const char *file, OtrlUserState us, OtrlUserState new)
 {
-	if(!fgets(s, size, stream)) {
-		s[0] = '\0';
-	} else {
-		int n = strlen(s);
-		if(n>0 && s[n-1] == '\n')
-			s[n-1] = '\0';
+	OtrlUserState check = otrl_userstate_create();
+	OtrlPrivKey *key, *ckey;
+	int n = 0, ok = !otrl_privkey_read(check, file);
+	
+	for(ckey=check->privkey_root; ok && ckey; ckey=ckey->next) {
+		n++;
+		if(!(key = otrl_privkey_find(new, ckey->accountname, ckey->protocol)) &&
+		   !(key = otrl_privkey_find(us, ckey->accountname, ckey->protocol)))
+			ok = 0;
+		else if(key->pubkey_datalen != ckey->pubkey_datalen ||
+		        memcmp(key->pubkey_data, ckey->pubkey_data, key->pubkey_datalen) != 0)
+			ok = 0;
+	}
+	
+	/* every account in us or new has to be in there */
+	for(key=us->privkey_root; ok && key; key=key->next)
+		ok = otrl_privkey_find(check, key->accountname, key->protocol) != NULL;
+	for(key=new->privkey_root; ok && key; key=key->next)
+		ok = otrl_privkey_find(check, key->accountname, key->protocol) != NULL;
+	
+	otrl_userstate_free(check);
+	return ok && n > 0;
+}
+
+int keygen_merge(irc_t *irc, const char *newkeys)
+{
+	OtrlUserState new = otrl_userstate_create();
+	OtrlPrivKey *key, *nkey;
+	char *kf, *tmp;
+	FILE *f;
+	int fd, ok = 0;
+	gcry_error_t e = 0;
+	
+	if(otrl_privkey_read(new, newkeys) || !new->privkey_root) {
+		irc_rootmsg(irc, "otr keygen: couldn't read the new key");
+		otrl_userstate_free(new);
+		return 0;
 	}
+	
+	if(strsane(irc->user->nick)) {
+		kf = g_strdup_printf("%s%s.otr_keys", global.conf->configdir, irc->user->nick);
+		tmp = g_strdup_printf("%s.new", kf);
+		fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	} else {
+		kf = NULL;
+		tmp = g_strdup("/tmp/bitlbee-XXXXXX");
+		fd = mkstemp(tmp);
+	}
+	
+	if(fd < 0 || !(f = fdopen(fd, "w"))) {
+		irc_rootmsg(irc, "otr keygen: couldn't write %s: %s", tmp, strerror(errno));
+		if(fd >= 0)
+			close(fd);
+		goto out;
+	}
+	
+	/* all the old keys, except the ones we have a new key for */
+	fprintf(f, "(privkeys\n");
+	for(key=irc->otr->us->privkey_root; key && !e; key=key->next) {
+		for(nkey=new->privkey_root; nkey; nkey=nkey->next)
+			if(!strcmp(key->accountname, nkey->accountname) &&
+			   !strcmp(key->protocol, nkey->protocol))
+				break;
+		if(!nkey)
+			e = keygen_write_key(f, key);
+	}
+	for(key=new->privkey_root; key && !e; key=key->next)
+		e = keygen_write_key(f, key);
+	fprintf(f, ")\n");
+	
+	/* don't replace a good key file with a broken one (disk full, ...) */
+	if(ferror(f) | fclose(f) || e) {
+		irc_rootmsg(irc, "otr keygen: couldn't write %s: %s", tmp,
+			e ? gcry_strerror(e) : strerror(errno));
+		unlink(tmp);
+		goto out;
+	}
+	if(!keygen_check_keys(tmp, irc->otr->us, new)) {
+		irc_rootmsg(irc, "otr keygen: %s doesn't read back properly, keeping the old keys", tmp);
+		unlink(tmp);
+		goto out;
+	}
+	
+	if(kf && rename(tmp, kf) < 0) {
+		irc_rootmsg(irc, "otr keygen: couldn't rename %s: %s", tmp, strerror(errno));
+		unlink(tmp);
+		goto out;
+	}
+	otrl_privkey_read(irc->otr->us, kf ? kf : tmp);
+	if(!kf)
+		unlink(tmp);
+	ok = 1;
+	
+out:
+	otrl_userstate_free(new);
+	g_free(kf);
+	g_free(tmp);
+	return ok;
 }
 
 void yes_keygen(void *data)
@@ -44,10 +44,18 @@ struct account;
 #include <libotr/message.h>
 #include <libotr/privkey.h>
 
-/* representing a keygen job */
+/* representing a keygen job. Jobs of all users in this process share a
+   limited number of worker processes, see otr_keygen(). */
 typedef struct kg {
 	char *accountname;
 	char *protocol;
+	struct irc *irc;
+	
+	pid_t pid;       /* pid of the worker (0 while queued) */
+	int fd;          /* pipe from the worker */
+	gint inpa;
+	char *filename;  /* temporary file the worker writes the key to */
+	time_t queued;
 	
 	struct kg *next;
 } kg_t;
@@ -55,16 +63,6 @@ typedef struct kg {
 /* struct to encapsulate our book keeping stuff */
 typedef struct otr {
 	OtrlUserState us;
-	pid_t keygen;    /* pid of keygen slave (0 if none) */
-	FILE *to;        /* pipe to keygen slave */
-	FILE *from;      /* pipe from keygen slave */
-	
-	/* active keygen job (NULL if none) */
-	char *sent_accountname;
-	char *sent_protocol;
-	
-	/* keygen jobs waiting to be sent to slave */
-	kg_t *todo;
 } otr_t;
 
 /* called from main() */
@@ -79,4 +77,8 @@ void otr_rename(const char *onick, const char *nnick);
 /* called from account_add() */
 int otr_check_for_key(struct account *a);
 
+/* queue a key generation for an account, and see if it's still pending */
+void otr_keygen(struct irc *irc, const char *handle, const char *protocol);
+int keygen_in_progress(struct irc *irc, const char *handle, const char *protocol);
+
 #endif
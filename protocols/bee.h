@@ -106,6 +106,9 @@ typedef struct bee_ui_funcs
 	gboolean (*user_group)( bee_t *bee, bee_user_t *bu );
 	/* State info is already updated, old is provided in case the UI needs a diff. */
 	gboolean (*user_status)( bee_t *bee, struct bee_user *bu, struct bee_user *old );
+	/* Called with start=TRUE/FALSE around a burst of user_status() calls
+	   so the UI can send its updates in fewer, bigger chunks. */
+	void (*user_status_batch)( bee_t *bee, gboolean start );
 	/* On every incoming message. sent_at = 0 means unknown. */
 	gboolean (*user_msg)( bee_t *bee, bee_user_t *bu, const char *msg, time_t sent_at );
 	/* Flags currently defined (OPT_TYPING/THINKING) in nogaim.h. */
@@ -153,6 +156,9 @@ void bee_group_free( bee_t *bee );
  * - 'state' and 'message' can be NULL */
 G_MODULE_EXPORT void imcb_buddy_status( struct im_connection *ic, const char *handle, int flags, const char *state, const char *message );
 G_MODULE_EXPORT void imcb_buddy_status_msg( struct im_connection *ic, const char *handle, const char *message );
+/* Wrap a series of imcb_buddy_status() calls in these if you have many of
+   them at once (like at login time). */
+G_MODULE_EXPORT void imcb_buddy_status_batch( struct im_connection *ic, gboolean start );
 G_MODULE_EXPORT void imcb_buddy_times( struct im_connection *ic, const char *handle, time_t login, time_t idle );
 /* Call when a handle says something. 'flags' and 'sent_at may be just 0. */
 G_MODULE_EXPORT void imcb_buddy_msg( struct im_connection *ic, const char *handle, char *msg, guint32 flags, time_t sent_at );
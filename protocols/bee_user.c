@@ -209,6 +209,14 @@ void imcb_buddy_status( struct im_connection *ic, const char *handle, int flags,
 	g_free( old );
 }
 
+void imcb_buddy_status_batch( struct im_connection *ic, gboolean start )
+{
+	bee_t *bee = ic->bee;
+	
+	if( bee->ui->user_status_batch )
+		bee->ui->user_status_batch( bee, start );
+}
+
 /* Same, but only change the away/status message, not any away/online state info. */
 void imcb_buddy_status_msg( struct im_connection *ic, const char *handle, const char *message )
 {
@@ -23,7 +23,7 @@
 
 #include "jabber.h"
 
-static xt_status jabber_chat_join_failed( struct im_connection *ic, struct xt_node *node, struct xt_node *orig );
+static xt_status jabber_chat_join_failed( struct im_connection *ic, struct xt_node *node, char *ctx );
 
 struct groupchat *jabber_chat_join( struct im_connection *ic, const char *room, const char *nick, const char *password )
 {
@@ -31,6 +31,7 @@ struct groupchat *jabber_chat_join( struct im_connection *ic, const char *room,
 	struct xt_node *node;
 	struct groupchat *c;
 	char *roomjid;
+	int st;
 	
 	roomjid = g_strdup_printf( "%s/%s", room, nick );
 	node = xt_new_node( "x", NULL, NULL );
@@ -38,9 +39,11 @@ struct groupchat *jabber_chat_join( struct im_connection *ic, const char *room,
 	if( password )
 		xt_add_child( node, xt_new_node( "password", password, NULL ) );
 	node = jabber_make_packet( "presence", NULL, roomjid, node );
-	jabber_cache_add( ic, node, jabber_chat_join_failed );
+	jabber_cache_add( ic, node, jabber_chat_join_failed, roomjid );
 	
-	if( !jabber_write_packet( ic, node ) )
+	st = jabber_write_packet( ic, node );
+	xt_free_node( node );
+	if( !st )
 	{
 		g_free( roomjid );
 		return NULL;
@@ -67,13 +70,12 @@ struct groupchat *jabber_chat_join( struct im_connection *ic, const char *room,
 	return c;
 }
 
-static xt_status jabber_chat_join_failed( struct im_connection *ic, struct xt_node *node, struct xt_node *orig )
+static xt_status jabber_chat_join_failed( struct im_connection *ic, struct xt_node *node, char *ctx )
 {
 	struct jabber_error *err;
 	struct jabber_buddy *bud;
-	char *room;
+	char *room = ctx;
 	
-	room = xt_find_attr( orig, "to" );
 	bud = jabber_buddy_by_jid( ic, room, 0 );
 	err = jabber_error_parse( xt_find_node( node->children, "error" ), XMLNS_STANZA_ERROR );
 	if( err )
@@ -27,28 +27,51 @@
 static gboolean jabber_write_callback( gpointer data, gint fd, b_input_condition cond );
 static gboolean jabber_write_queue( struct im_connection *ic );
 
+static gboolean jabber_write_queued( struct im_connection *ic, int start );
+
 int jabber_write_packet( struct im_connection *ic, struct xt_node *node )
 {
-	char *buf;
-	int st;
+	struct jabber_data *jd = ic->proto_data;
+	int start;
 	
-	buf = xt_to_string( node );
-	st = jabber_write( ic, buf, strlen( buf ) );
-	g_free( buf );
+	/* Serialize straight into the output queue, no need to build a
+	   separate string first just to copy it in there. */
+	if( jd->txq == NULL )
+		jd->txq = g_string_sized_new( 1024 );
 	
-	return st;
+	start = jd->txq->len;
+	xt_to_gstring( node, jd->txq );
+	
+	return jabber_write_queued( ic, start );
 }
 
 int jabber_write( struct im_connection *ic, char *buf, int len )
 {
 	struct jabber_data *jd = ic->proto_data;
+	int start;
+	
+	if( jd->txq == NULL )
+		jd->txq = g_string_sized_new( 1024 );
+	
+	start = jd->txq->len;
+	g_string_append_len( jd->txq, buf, len );
+	
+	return jabber_write_queued( ic, start );
+}
+
+/* Everything from start until the end of jd->txq was just appended, log
+   it if necessary and get it sent. */
+static gboolean jabber_write_queued( struct im_connection *ic, int start )
+{
+	struct jabber_data *jd = ic->proto_data;
+	int len = jd->txq->len - start;
 	gboolean ret;
 	
 	if( jd->flags & JFLAG_XMLCONSOLE && !( ic->flags & OPT_LOGGING_OUT ) )
 	{
 		char *msg, *s;
 		
-		msg = g_strdup_printf( "TX: %s", buf );
+		msg = g_strdup_printf( "TX: %s", jd->txq->str + start );
 		/* Don't include auth info in XML logs. */
 		if( strncmp( msg, "TX: <auth ", 10 ) == 0 && ( s = strchr( msg, '>' ) ) )
 		{
@@ -62,9 +85,8 @@ int jabber_write( struct im_connection *ic, char *buf, int len )
 	
 	if( jd->tx_len == 0 )
 	{
-		/* If the queue is empty, allocate a new buffer. */
+		/* The queue was empty. */
 		jd->tx_len = len;
-		jd->txq = g_memdup( buf, len );
 		
 		/* Try if we can write it immediately so we don't have to do
 		   it via the event handler. If not, add the handler. (In
@@ -74,10 +96,8 @@ int jabber_write( struct im_connection *ic, char *buf, int len )
 	}
 	else
 	{
-		/* Just add it to the buffer if it's already filled. The
-		   event handler is already set. */
-		jd->txq = g_renew( char, jd->txq, jd->tx_len + len );
-		memcpy( jd->txq + jd->tx_len, buf, len );
+		/* The data is already appended to the queue and the event
+		   handler is already set. */
 		jd->tx_len += len;
 		
 		/* The return value for write() doesn't necessarily mean
@@ -113,16 +133,24 @@ static gboolean jabber_write_queue( struct im_connection *ic )
 	int st;
 	
 	if( jd->ssl )
-		st = ssl_write( jd->ssl, jd->txq, jd->tx_len );
+		st = ssl_write( jd->ssl, jd->txq->str + jd->tx_off, jd->tx_len );
 	else
-		st = write( jd->fd, jd->txq, jd->tx_len );
+		st = write( jd->fd, jd->txq->str + jd->tx_off, jd->tx_len );
 	
 	if( st == jd->tx_len )
 	{
-		/* We wrote everything, clear the buffer. */
-		g_free( jd->txq );
-		jd->txq = NULL;
-		jd->tx_len = 0;
+		/* We wrote everything, clear the buffer. Keep it around
+		   for the next packet unless some burst made it huge. */
+		if( jd->txq->allocated_len > JABBER_TXQ_KEEP )
+		{
+			g_string_free( jd->txq, TRUE );
+			jd->txq = NULL;
+		}
+		else
+		{
+			g_string_truncate( jd->txq, 0 );
+		}
+		jd->tx_off = jd->tx_len = 0;
 		
 		return TRUE;
 	}
@@ -138,12 +166,17 @@ static gboolean jabber_write_queue( struct im_connection *ic )
 	}
 	else if( st > 0 )
 	{
-		char *s;
-		
-		s = g_memdup( jd->txq + st, jd->tx_len - st );
+		/* Just skip what got sent. Only move the rest to the front
+		   once the sent part is bigger than what's left, which keeps
+		   the copying linear in the amount of data. */
+		jd->tx_off += st;
 		jd->tx_len -= st;
-		g_free( jd->txq );
-		jd->txq = s;
+		
+		if( jd->tx_off > jd->tx_len )
+		{
+			g_string_erase( jd->txq, 0, jd->tx_off );
+			jd->tx_off = 0;
+		}
 		
 		return TRUE;
 	}
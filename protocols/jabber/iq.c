@@ -24,8 +24,8 @@
 #include "jabber.h"
 #include "sha1.h"
 
-static xt_status jabber_parse_roster( struct im_connection *ic, struct xt_node *node, struct xt_node *orig );
-static xt_status jabber_iq_display_vcard( struct im_connection *ic, struct xt_node *node, struct xt_node *orig );
+static xt_status jabber_parse_roster( struct im_connection *ic, struct xt_node *node, char *ctx );
+static xt_status jabber_iq_display_vcard( struct im_connection *ic, struct xt_node *node, char *ctx );
 
 xt_status jabber_pkt_iq( struct xt_node *node, gpointer data )
 {
@@ -225,8 +225,8 @@ xt_status jabber_pkt_iq( struct xt_node *node, gpointer data )
 	return XT_HANDLED;
 }
 
-static xt_status jabber_do_iq_auth( struct im_connection *ic, struct xt_node *node, struct xt_node *orig );
-static xt_status jabber_finish_iq_auth( struct im_connection *ic, struct xt_node *node, struct xt_node *orig );
+static xt_status jabber_do_iq_auth( struct im_connection *ic, struct xt_node *node, char *ctx );
+static xt_status jabber_finish_iq_auth( struct im_connection *ic, struct xt_node *node, char *ctx );
 
 int jabber_init_iq_auth( struct im_connection *ic )
 {
@@ -238,13 +238,15 @@ int jabber_init_iq_auth( struct im_connection *ic )
 	xt_add_attr( node, "xmlns", XMLNS_AUTH );
 	node = jabber_make_packet( "iq", "get", NULL, node );
 	
-	jabber_cache_add( ic, node, jabber_do_iq_auth );
+	jabber_cache_add( ic, node, jabber_do_iq_auth, NULL );
 	st = jabber_write_packet( ic, node );
 	
+	xt_free_node( node );
+	
 	return st;
 }
 
-static xt_status jabber_do_iq_auth( struct im_connection *ic, struct xt_node *node, struct xt_node *orig )
+static xt_status jabber_do_iq_auth( struct im_connection *ic, struct xt_node *node, char *ctx )
 {
 	struct jabber_data *jd = ic->proto_data;
 	struct xt_node *reply, *query;
@@ -298,13 +300,14 @@ static xt_status jabber_do_iq_auth( struct im_connection *ic, struct xt_node *no
 	}
 	
 	reply = jabber_make_packet( "iq", "set", NULL, reply );
-	jabber_cache_add( ic, reply, jabber_finish_iq_auth );
+	jabber_cache_add( ic, reply, jabber_finish_iq_auth, NULL );
 	st = jabber_write_packet( ic, reply );
+	xt_free_node( reply );
 	
 	return st ? XT_HANDLED : XT_ABORT;
 }
 
-static xt_status jabber_finish_iq_auth( struct im_connection *ic, struct xt_node *node, struct xt_node *orig )
+static xt_status jabber_finish_iq_auth( struct im_connection *ic, struct xt_node *node, char *ctx )
 {
 	struct jabber_data *jd = ic->proto_data;
 	char *type;
@@ -334,11 +337,12 @@ static xt_status jabber_finish_iq_auth( struct im_connection *ic, struct xt_node
 	return XT_HANDLED;
 }
 
-xt_status jabber_pkt_bind_sess( struct im_connection *ic, struct xt_node *node, struct xt_node *orig )
+xt_status jabber_pkt_bind_sess( struct im_connection *ic, struct xt_node *node, char *ctx )
 {
 	struct jabber_data *jd = ic->proto_data;
 	struct xt_node *c, *reply = NULL;
 	char *s;
+	int st;
 	
 	if( node && ( c = xt_find_node( node->children, "bind" ) ) )
 	{
@@ -381,9 +385,11 @@ xt_status jabber_pkt_bind_sess( struct im_connection *ic, struct xt_node *node,
 	if( reply != NULL )
 	{
 		reply = jabber_make_packet( "iq", "set", NULL, reply );
-		jabber_cache_add( ic, reply, jabber_pkt_bind_sess );
+		jabber_cache_add( ic, reply, jabber_pkt_bind_sess, NULL );
 		
-		if( !jabber_write_packet( ic, reply ) )
+		st = jabber_write_packet( ic, reply );
+		xt_free_node( reply );
+		if( !st )
 			return XT_ABORT;
 	}
 	else if( ( jd->flags & ( JFLAG_WANT_BIND | JFLAG_WANT_SESSION ) ) == 0 )
@@ -406,16 +412,20 @@ int jabber_get_roster( struct im_connection *ic )
 	xt_add_attr( node, "xmlns", XMLNS_ROSTER );
 	node = jabber_make_packet( "iq", "get", NULL, node );
 	
-	jabber_cache_add( ic, node, jabber_parse_roster );
+	/* Any non-NULL ctx will do, it tells jabber_parse_roster() this is
+	   the initial roster instead of a roster push. */
+	jabber_cache_add( ic, node, jabber_parse_roster, XMLNS_ROSTER );
 	st = jabber_write_packet( ic, node );
 	
+	xt_free_node( node );
+	
 	return st;
 }
 
-static xt_status jabber_parse_roster( struct im_connection *ic, struct xt_node *node, struct xt_node *orig )
+static xt_status jabber_parse_roster( struct im_connection *ic, struct xt_node *node, char *ctx )
 {
 	struct xt_node *query, *c;
-	int initial = ( orig != NULL );
+	int initial = ( ctx != NULL );
 	
 	if( !( query = xt_find_node( node->children, "query" ) ) )
 	{
@@ -452,7 +462,10 @@ static xt_status jabber_parse_roster( struct im_connection *ic, struct xt_node *
 	}
 	
 	if( initial )
+	{
+		jabber_presence_settle( ic );
 		imcb_connected( ic );
+	}
 	
 	return XT_HANDLED;
 }
@@ -460,6 +473,7 @@ static xt_status jabber_parse_roster( struct im_connection *ic, struct xt_node *
 int jabber_get_vcard( struct im_connection *ic, char *bare_jid )
 {
 	struct xt_node *node;
+	int st;
 	
 	if( strchr( bare_jid, '/' ) )
 		return 1;	/* This was an error, but return 0 should only be done if the connection died... */
@@ -468,11 +482,14 @@ int jabber_get_vcard( struct im_connection *ic, char *bare_jid )
 	xt_add_attr( node, "xmlns", XMLNS_VCARD );
 	node = jabber_make_packet( "iq", "get", bare_jid, node );
 	
-	jabber_cache_add( ic, node, jabber_iq_display_vcard );
-	return jabber_write_packet( ic, node );
+	jabber_cache_add( ic, node, jabber_iq_display_vcard, bare_jid );
+	st = jabber_write_packet( ic, node );
+	
+	xt_free_node( node );
+	return st;
 }
 
-static xt_status jabber_iq_display_vcard( struct im_connection *ic, struct xt_node *node, struct xt_node *orig )
+static xt_status jabber_iq_display_vcard( struct im_connection *ic, struct xt_node *node, char *ctx )
 {
 	struct xt_node *vc, *c, *sc; /* subchild, ic is already in use ;-) */
 	GString *reply;
@@ -482,14 +499,12 @@ static xt_status jabber_iq_display_vcard( struct im_connection *ic, struct xt_no
 	    strcmp( s, "result" ) != 0 ||
 	    ( vc = xt_find_node( node->children, "vCard" ) ) == NULL )
 	{
-		s = xt_find_attr( orig, "to" ); /* If this returns NULL something's wrong.. */
-		imcb_log( ic, "Could not retrieve vCard of %s", s ? s : "(NULL)" );
+		imcb_log( ic, "Could not retrieve vCard of %s", ctx ? ctx : "(NULL)" );
 		return XT_HANDLED;
 	}
 	
-	s = xt_find_attr( orig, "to" );
 	reply = g_string_new( "vCard information for " );
-	reply = g_string_append( reply, s ? s : "(NULL)" );
+	reply = g_string_append( reply, ctx ? ctx : "(NULL)" );
 	reply = g_string_append( reply, ":\n" );
 	
 	/* I hate this format, I really do... */
@@ -597,7 +612,7 @@ static xt_status jabber_iq_display_vcard( struct im_connection *ic, struct xt_no
 	return XT_HANDLED;
 }
 
-static xt_status jabber_add_to_roster_callback( struct im_connection *ic, struct xt_node *node, struct xt_node *orig );
+static xt_status jabber_add_to_roster_callback( struct im_connection *ic, struct xt_node *node, char *ctx );
 
 int jabber_add_to_roster( struct im_connection *ic, const char *handle, const char *name, const char *group )
 {
@@ -616,21 +631,20 @@ int jabber_add_to_roster( struct im_connection *ic, const char *handle, const ch
 	node = xt_new_node( "query", NULL, node );
 	xt_add_attr( node, "xmlns", XMLNS_ROSTER );
 	node = jabber_make_packet( "iq", "set", NULL, node );
-	jabber_cache_add( ic, node, jabber_add_to_roster_callback );
+	jabber_cache_add( ic, node, jabber_add_to_roster_callback, handle );
 	
 	st = jabber_write_packet( ic, node );
 	
+	xt_free_node( node );
+	
 	return st;
 }
 
-static xt_status jabber_add_to_roster_callback( struct im_connection *ic, struct xt_node *node, struct xt_node *orig )
+static xt_status jabber_add_to_roster_callback( struct im_connection *ic, struct xt_node *node, char *ctx )
 {
-	char *s, *jid = NULL;
-	struct xt_node *c;
+	char *s, *jid = ctx;
 	
-	if( ( c = xt_find_node( orig->children, "query" ) ) &&
-	    ( c = xt_find_node( c->children, "item" ) ) &&
-	    ( jid = xt_find_attr( c, "jid" ) ) &&
+	if( jid &&
 	    ( s = xt_find_attr( node, "type" ) ) &&
 	    strcmp( s, "result" ) == 0 )
 	{
@@ -667,12 +681,13 @@ int jabber_remove_from_roster( struct im_connection *ic, char *handle )
 	return st;
 }
 
-xt_status jabber_iq_parse_features( struct im_connection *ic, struct xt_node *node, struct xt_node *orig );
+xt_status jabber_iq_parse_features( struct im_connection *ic, struct xt_node *node, char *ctx );
 
 xt_status jabber_iq_query_features( struct im_connection *ic, char *bare_jid )
 {
 	struct xt_node *node, *query;
 	struct jabber_buddy *bud;
+	int st;
 	
 	if( ( bud = jabber_buddy_by_jid( ic, bare_jid , 0 ) ) == NULL )
 	{
@@ -694,12 +709,14 @@ xt_status jabber_iq_query_features( struct im_connection *ic, char *bare_jid )
 		return XT_HANDLED;
 	}
 
-	jabber_cache_add( ic, query, jabber_iq_parse_features );
+	jabber_cache_add( ic, query, jabber_iq_parse_features, NULL );
+	st = jabber_write_packet( ic, query );
+	xt_free_node( query );
 
-	return jabber_write_packet( ic, query ) ? XT_HANDLED : XT_ABORT;
+	return st ? XT_HANDLED : XT_ABORT;
 }
 
-xt_status jabber_iq_parse_features( struct im_connection *ic, struct xt_node *node, struct xt_node *orig )
+xt_status jabber_iq_parse_features( struct im_connection *ic, struct xt_node *node, char *ctx )
 {
 	struct xt_node *c;
 	struct jabber_buddy *bud;
@@ -732,12 +749,13 @@ xt_status jabber_iq_parse_features( struct im_connection *ic, struct xt_node *no
 	return XT_HANDLED;
 }
 
-xt_status jabber_iq_parse_server_features( struct im_connection *ic, struct xt_node *node, struct xt_node *orig );
+xt_status jabber_iq_parse_server_features( struct im_connection *ic, struct xt_node *node, char *ctx );
 
 xt_status jabber_iq_query_server( struct im_connection *ic, char *jid, char *xmlns )
 {
 	struct xt_node *node, *query;
 	struct jabber_data *jd = ic->proto_data;
+	int st;
 	
 	node = xt_new_node( "query", NULL, NULL );
 	xt_add_attr( node, "xmlns", xmlns );
@@ -749,15 +767,17 @@ xt_status jabber_iq_query_server( struct im_connection *ic, char *jid, char *xml
 	}
 
 	jd->have_streamhosts--;
-	jabber_cache_add( ic, query, jabber_iq_parse_server_features );
+	jabber_cache_add( ic, query, jabber_iq_parse_server_features, NULL );
+	st = jabber_write_packet( ic, query );
+	xt_free_node( query );
 
-	return jabber_write_packet( ic, query ) ? XT_HANDLED : XT_ABORT;
+	return st ? XT_HANDLED : XT_ABORT;
 }
 
 /*
  * Query the server for "items", query each "item" for identities, query each "item" that's a proxy for it's bytestream info
  */
-xt_status jabber_iq_parse_server_features( struct im_connection *ic, struct xt_node *node, struct xt_node *orig )
+xt_status jabber_iq_parse_server_features( struct im_connection *ic, struct xt_node *node, char *ctx )
 {
 	struct xt_node *c;
 	struct jabber_data *jd = ic->proto_data;
@@ -840,7 +860,7 @@ xt_status jabber_iq_parse_server_features( struct im_connection *ic, struct xt_n
 }
 
 static xt_status jabber_iq_version_response( struct im_connection *ic,
-	struct xt_node *node, struct xt_node *orig );
+	struct xt_node *node, char *ctx );
 
 void jabber_iq_version_send( struct im_connection *ic, struct jabber_buddy *bud, void *data )
 {
@@ -849,13 +869,14 @@ void jabber_iq_version_send( struct im_connection *ic, struct jabber_buddy *bud,
 	node = xt_new_node( "query", NULL, NULL );
 	xt_add_attr( node, "xmlns", XMLNS_VERSION );
 	query = jabber_make_packet( "iq", "get", bud->full_jid, node );
-	jabber_cache_add( ic, query, jabber_iq_version_response );
+	jabber_cache_add( ic, query, jabber_iq_version_response, NULL );
 
 	jabber_write_packet( ic, query );
+	xt_free_node( query );
 }
 
 static xt_status jabber_iq_version_response( struct im_connection *ic,
-	struct xt_node *node, struct xt_node *orig )
+	struct xt_node *node, char *ctx )
 {
 	struct xt_node *query;
 	GString *rets;
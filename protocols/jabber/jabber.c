@@ -32,7 +32,6 @@
 #include "bitlbee.h"
 #include "jabber.h"
 #include "oauth.h"
-#include "md5.h"
 
 GSList *jabber_connections;
 
@@ -98,7 +97,6 @@ static void jabber_init( account_t *acc )
 	acc->flags |= ACC_FLAG_AWAY_MESSAGE | ACC_FLAG_STATUS_MESSAGE;
 }
 
-static void jabber_generate_id_hash( struct jabber_data *jd );
 
 static void jabber_login( account_t *acc )
 {
@@ -136,7 +134,7 @@ static void jabber_login( account_t *acc )
 		*s = 0;
 	}
 	
-	jd->node_cache = g_hash_table_new_full( g_str_hash, g_str_equal, NULL, jabber_cache_entry_free );
+	jabber_cache_init( ic );
 	jd->buddies = g_hash_table_new( g_str_hash, g_str_equal );
 	
 	if( set_getbool( &acc->set, "oauth" ) )
@@ -254,24 +252,6 @@ void jabber_connect( struct im_connection *ic )
 		   I think this shouldn't break anything. */
 		imcb_add_buddy( ic, JABBER_XMLCONSOLE_HANDLE, NULL );
 	}
-	
-	jabber_generate_id_hash( jd );
-}
-
-/* This generates an unfinished md5_state_t variable. Every time we generate
-   an ID, we finish the state by adding a sequence number and take the hash. */
-static void jabber_generate_id_hash( struct jabber_data *jd )
-{
-	md5_byte_t binbuf[4];
-	char *s;
-	
-	md5_init( &jd->cached_id_prefix );
-	md5_append( &jd->cached_id_prefix, (unsigned char *) jd->username, strlen( jd->username ) );
-	md5_append( &jd->cached_id_prefix, (unsigned char *) jd->server, strlen( jd->server ) );
-	s = set_getstr( &jd->ic->acc->set, "resource" );
-	md5_append( &jd->cached_id_prefix, (unsigned char *) s, strlen( s ) );
-	random_bytes( binbuf, 4 );
-	md5_append( &jd->cached_id_prefix, binbuf, 4 );
 }
 
 static void jabber_logout( struct im_connection *ic )
@@ -306,11 +286,11 @@ static void jabber_logout( struct im_connection *ic )
 	if( jd->fd >= 0 )
 		closesocket( jd->fd );
 	
-	if( jd->tx_len )
-		g_free( jd->txq );
+	if( jd->txq )
+		g_string_free( jd->txq, TRUE );
 	
-	if( jd->node_cache )
-		g_hash_table_destroy( jd->node_cache );
+	jabber_cache_free( ic );
+	jabber_presence_settle_end( ic );
 	
 	jabber_buddy_remove_all( ic );
 	
@@ -518,12 +498,7 @@ static void jabber_chat_invite_( struct groupchat *c, char *who, char *msg )
 static void jabber_keepalive( struct im_connection *ic )
 {
 	/* Just any whitespace character is enough as a keepalive for XMPP sessions. */
-	if( !jabber_write( ic, "\n", 1 ) )
-		return;
-	
-	/* This runs the garbage collection every minute, which means every packet
-	   is in the cache for about a minute (which should be enough AFAIK). */
-	jabber_cache_clean( ic );
+	jabber_write( ic, "\n", 1 );
 }
 
 static int jabber_send_typing( struct im_connection *ic, char *who, int typing )
@@ -84,8 +84,8 @@ struct jabber_data
 	
 	int fd;
 	void *ssl;
-	char *txq;
-	int tx_len;
+	GString *txq;		/* Output queue, unsent data starts at tx_off. */
+	int tx_off, tx_len;
 	int r_inpa, w_inpa;
 	
 	struct xt_parser *xt;
@@ -103,9 +103,22 @@ struct jabber_data
 	const struct jabber_away_state *away_state;
 	char *away_message;
 	
-	md5_state_t cached_id_prefix;
+	/* Handlers waiting for responses to packets we sent, see
+	   jabber_cache_add(). The hash is indexed by the counter part of
+	   the packet ID, the list is in order of expiry (oldest first). */
+	char cached_id_prefix[16];
+	guint32 cached_id_next;
 	GHashTable *node_cache;
+	struct jabber_cache_entry *cache_head, *cache_tail;
+	gint cache_timer;
 	GHashTable *buddies;
+	
+	/* Bare JIDs with presence changes not passed to the UI yet, only
+	   while presence info is flooding in at login time. */
+	GHashTable *presence_pending;
+	gint presence_settle_id;
+	time_t presence_settle_until;
+	gboolean presence_settle_seen; /* Had any updates yet? */
 
 	GSList *filetransfers;
 	GSList *streamhosts;
@@ -118,13 +131,16 @@ struct jabber_away_state
 	char *full_name;
 };
 
-typedef xt_status (*jabber_cache_event) ( struct im_connection *ic, struct xt_node *node, struct xt_node *orig );
+/* ctx is whatever string was passed to jabber_cache_add() (or NULL). */
+typedef xt_status (*jabber_cache_event) ( struct im_connection *ic, struct xt_node *node, char *ctx );
 
 struct jabber_cache_entry
 {
-	time_t saved_at;
-	struct xt_node *node;
+	guint32 id;
+	time_t expires;
 	jabber_cache_event func;
+	char *ctx;
+	struct jabber_cache_entry *prev, *next;
 };
 
 /* Somewhat messy data structure: We have a hash table with the bare JID as
@@ -199,15 +215,24 @@ struct jabber_transfer
    first one should be used, but when storing a packet in the cache, a
    "special" kind of ID is assigned to make it easier later to figure out
    if we have to do call an event handler for the response packet. Also
-   we'll append a hash to make sure we won't trigger on cached packets from
-   other BitlBee users. :-) */
+   we'll append a random per-connection prefix to make sure we won't
+   trigger on cached packets from other BitlBee users. :-) */
 #define JABBER_PACKET_ID "BeeP"
 #define JABBER_CACHED_ID "BeeC"
 
-/* The number of seconds to keep cached packets before garbage collecting
-   them. This gc is done on every keepalive (every minute). */
+/* The number of seconds to wait for a response to a cached packet before
+   forgetting about it. */
 #define JABBER_CACHE_MAX_AGE 600
 
+/* While settling in after login, pass presence changes to the UI every
+   this many milliseconds, for at most _MAX seconds. */
+#define JABBER_PRESENCE_SETTLE_TIME 500
+#define JABBER_PRESENCE_SETTLE_MAX 30
+
+/* Output queue buffers bigger than this (after some burst, for example)
+   are freed once the queue is empty instead of being reused. */
+#define JABBER_TXQ_KEEP 65536
+
 /* RFC 392[01] stuff */
 #define XMLNS_TLS          "urn:ietf:params:xml:ns:xmpp-tls"
 #define XMLNS_SASL         "urn:ietf:params:xml:ns:xmpp-sasl"
@@ -244,7 +269,7 @@ void jabber_connect( struct im_connection *ic );
 /* iq.c */
 xt_status jabber_pkt_iq( struct xt_node *node, gpointer data );
 int jabber_init_iq_auth( struct im_connection *ic );
-xt_status jabber_pkt_bind_sess( struct im_connection *ic, struct xt_node *node, struct xt_node *orig );
+xt_status jabber_pkt_bind_sess( struct im_connection *ic, struct xt_node *node, char *ctx );
 int jabber_get_roster( struct im_connection *ic );
 int jabber_get_vcard( struct im_connection *ic, char *bare_jid );
 int jabber_add_to_roster( struct im_connection *ic, const char *handle, const char *name, const char *group );
@@ -270,15 +295,17 @@ xt_status jabber_pkt_message( struct xt_node *node, gpointer data );
 xt_status jabber_pkt_presence( struct xt_node *node, gpointer data );
 int presence_send_update( struct im_connection *ic );
 int presence_send_request( struct im_connection *ic, char *handle, char *request );
+void jabber_presence_settle( struct im_connection *ic );
+void jabber_presence_settle_end( struct im_connection *ic );
 
 /* jabber_util.c */
 char *set_eval_priority( set_t *set, char *value );
 char *set_eval_tls( set_t *set, char *value );
 struct xt_node *jabber_make_packet( char *name, char *type, char *to, struct xt_node *children );
 struct xt_node *jabber_make_error_packet( struct xt_node *orig, char *err_cond, char *err_type, char *err_code );
-void jabber_cache_add( struct im_connection *ic, struct xt_node *node, jabber_cache_event func );
-struct xt_node *jabber_cache_get( struct im_connection *ic, char *id );
-void jabber_cache_entry_free( gpointer entry );
+void jabber_cache_add( struct im_connection *ic, struct xt_node *node, jabber_cache_event func, const char *ctx );
+void jabber_cache_init( struct im_connection *ic );
+void jabber_cache_free( struct im_connection *ic );
 void jabber_cache_clean( struct im_connection *ic );
 xt_status jabber_cache_handle_packet( struct im_connection *ic, struct xt_node *node );
 const struct jabber_away_state *jabber_away_state_by_code( char *code );
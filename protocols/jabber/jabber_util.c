@@ -22,8 +22,6 @@
 \***************************************************************************/
 
 #include "jabber.h"
-#include "md5.h"
-#include "base64.h"
 
 static unsigned int next_id = 1;
 
@@ -132,74 +130,136 @@ struct xt_node *jabber_make_error_packet( struct xt_node *orig, char *err_cond,
 	return node;
 }
 
-/* Cache a node/packet for later use. Mainly useful for IQ packets if you need
-   them when you receive the response. Use this BEFORE sending the packet so
-   it'll get a new id= tag, and do NOT free() the packet after sending it! */
-void jabber_cache_add( struct im_connection *ic, struct xt_node *node, jabber_cache_event func )
+static gboolean jabber_cache_timeout( gpointer data, gint fd, b_input_condition cond );
+
+/* Remember we're waiting for a response to this packet. Use this BEFORE
+   sending the packet so it'll get a new id= tag. Only func and a copy of
+   ctx are kept (ctx is passed to func with the response), the packet
+   itself is still the caller's to free after sending it. */
+void jabber_cache_add( struct im_connection *ic, struct xt_node *node, jabber_cache_event func, const char *ctx )
 {
 	struct jabber_data *jd = ic->proto_data;
 	struct jabber_cache_entry *entry = g_new0( struct jabber_cache_entry, 1 );
-	md5_state_t id_hash;
-	md5_byte_t id_sum[16];
-	char *id, *asc_hash;
-	
-	next_id ++;
-	
-	id_hash = jd->cached_id_prefix;
-	md5_append( &id_hash, (md5_byte_t*) &next_id, sizeof( next_id ) );
-	md5_finish( &id_hash, id_sum );
-	asc_hash = base64_encode( id_sum, 12 );
+	char id[32];
 	
-	id = g_strdup_printf( "%s%s", JABBER_CACHED_ID, asc_hash );
+	entry->id = jd->cached_id_next ++;
+	g_snprintf( id, sizeof( id ), "%s%x", jd->cached_id_prefix, entry->id );
 	xt_add_attr( node, "id", id );
-	g_free( id );
-	g_free( asc_hash );
 	
-	entry->node = node;
 	entry->func = func;
-	entry->saved_at = time( NULL );
-	g_hash_table_insert( jd->node_cache, xt_find_attr( node, "id" ), entry );
+	entry->ctx = g_strdup( ctx );
+	entry->expires = time( NULL ) + JABBER_CACHE_MAX_AGE;
+	
+	/* All entries live equally long, so appending keeps the list
+	   sorted by expiry time. */
+	if( ( entry->prev = jd->cache_tail ) )
+		entry->prev->next = entry;
+	else
+		jd->cache_head = entry;
+	jd->cache_tail = entry;
+	
+	g_hash_table_insert( jd->node_cache, GUINT_TO_POINTER( entry->id ), entry );
+	
+	if( jd->cache_timer == 0 )
+		jd->cache_timer = b_timeout_add( JABBER_CACHE_MAX_AGE * 1000, jabber_cache_timeout, ic );
 }
 
-void jabber_cache_entry_free( gpointer data )
+static void jabber_cache_entry_free( gpointer data )
 {
 	struct jabber_cache_entry *entry = data;
 	
-	xt_free_node( entry->node );
+	g_free( entry->ctx );
 	g_free( entry );
 }
 
-gboolean jabber_cache_clean_entry( gpointer key, gpointer entry, gpointer nullpointer );
+/* Unlink an entry without freeing it. */
+static void jabber_cache_steal( struct jabber_data *jd, struct jabber_cache_entry *entry )
+{
+	if( entry->prev )
+		entry->prev->next = entry->next;
+	else
+		jd->cache_head = entry->next;
+	
+	if( entry->next )
+		entry->next->prev = entry->prev;
+	else
+		jd->cache_tail = entry->prev;
+	
+	g_hash_table_steal( jd->node_cache, GUINT_TO_POINTER( entry->id ) );
+}
+
+void jabber_cache_init( struct im_connection *ic )
+{
+	struct jabber_data *jd = ic->proto_data;
+	guint32 rnd;
+	
+	jd->node_cache = g_hash_table_new_full( g_direct_hash, g_direct_equal, NULL, jabber_cache_entry_free );
+	
+	random_bytes( (unsigned char*) &rnd, sizeof( rnd ) );
+	g_snprintf( jd->cached_id_prefix, sizeof( jd->cached_id_prefix ), "%s%08x", JABBER_CACHED_ID, rnd );
+	jd->cached_id_next = 1;
+}
 
-/* This one should be called from time to time (from keepalive, in this case)
-   to make sure things don't stay in the node cache forever. By marking nodes
-   during the first run and deleting marked nodes during a next run, every
-   node should be available in the cache for at least a minute (assuming the
-   function is indeed called every minute). */
+void jabber_cache_free( struct im_connection *ic )
+{
+	struct jabber_data *jd = ic->proto_data;
+	
+	if( jd->cache_timer )
+		b_event_remove( jd->cache_timer );
+	jd->cache_timer = 0;
+	
+	if( jd->node_cache )
+		g_hash_table_destroy( jd->node_cache );
+	jd->node_cache = NULL;
+	jd->cache_head = jd->cache_tail = NULL;
+}
+
+/* Forget about everything that's been waiting for too long. Since the list
+   is sorted by expiry time, this only has to look at the expired entries. */
 void jabber_cache_clean( struct im_connection *ic )
 {
 	struct jabber_data *jd = ic->proto_data;
-	time_t threshold = time( NULL ) - JABBER_CACHE_MAX_AGE;
+	time_t now = time( NULL );
+	
+	while( jd->cache_head && jd->cache_head->expires <= now )
+	{
+		struct jabber_cache_entry *entry = jd->cache_head;
+		
+		jabber_cache_steal( jd, entry );
+		jabber_cache_entry_free( entry );
+	}
 	
-	g_hash_table_foreach_remove( jd->node_cache, jabber_cache_clean_entry, &threshold );
+	if( jd->cache_timer )
+		b_event_remove( jd->cache_timer );
+	jd->cache_timer = 0;
+	
+	if( jd->cache_head )
+		jd->cache_timer = b_timeout_add( ( jd->cache_head->expires - now ) * 1000,
+		                                 jabber_cache_timeout, ic );
 }
 
-gboolean jabber_cache_clean_entry( gpointer key, gpointer entry_, gpointer threshold_ )
+static gboolean jabber_cache_timeout( gpointer data, gint fd, b_input_condition cond )
 {
-	struct jabber_cache_entry *entry = entry_;
-	time_t *threshold = threshold_;
+	struct im_connection *ic = data;
+	struct jabber_data *jd = ic->proto_data;
 	
-	return entry->saved_at < *threshold;
+	jd->cache_timer = 0;
+	jabber_cache_clean( ic );
+	
+	return FALSE;
 }
 
 xt_status jabber_cache_handle_packet( struct im_connection *ic, struct xt_node *node )
 {
 	struct jabber_data *jd = ic->proto_data;
 	struct jabber_cache_entry *entry;
-	char *s;
+	int len = strlen( jd->cached_id_prefix );
+	xt_status st = XT_HANDLED;
+	char *s, *end;
+	guint32 id;
 	
 	if( ( s = xt_find_attr( node, "id" ) ) == NULL ||
-	    strncmp( s, JABBER_CACHED_ID, strlen( JABBER_CACHED_ID ) ) != 0 )
+	    strncmp( s, jd->cached_id_prefix, len ) != 0 )
 	{
 		/* Silently ignore it, without an ID (or a non-cache
 		   ID) we don't know how to handle the packet and we
@@ -207,25 +267,24 @@ xt_status jabber_cache_handle_packet( struct im_connection *ic, struct xt_node *
 		return XT_HANDLED;
 	}
 	
-	entry = g_hash_table_lookup( jd->node_cache, s );
-	
-	if( entry == NULL )
-	{
-		/*
-		There's no longer an easy way to see if we generated this
-		one or someone else, and there's a ten-minute timeout anyway,
-		so meh.
-		
-		imcb_log( ic, "Warning: Received %s-%s packet with unknown/expired ID %s!",
-		              node->name, xt_find_attr( node, "type" ) ? : "(no type)", s );
-		*/
-	}
-	else if( entry->func )
+	id = strtoul( s + len, &end, 16 );
+	if( *end != '\0' ||
+	    ( entry = g_hash_table_lookup( jd->node_cache, GUINT_TO_POINTER( id ) ) ) == NULL )
 	{
-		return entry->func( ic, node, entry->node );
+		/* Unknown or expired (there's a ten-minute timeout). */
+		return XT_HANDLED;
 	}
 	
-	return XT_HANDLED;
+	/* Only one response per request. Unlink the entry before calling
+	   the handler since that one may very well log out. */
+	jabber_cache_steal( jd, entry );
+	
+	if( entry->func )
+		st = entry->func( ic, node, entry->ctx );
+	
+	jabber_cache_entry_free( entry );
+	
+	return st;
 }
 
 const struct jabber_away_state jabber_away_state_list[] =
@@ -23,13 +23,15 @@
 
 #include "jabber.h"
 
+static void jabber_presence_update( struct im_connection *ic, const char *bare_jid );
+
 xt_status jabber_pkt_presence( struct xt_node *node, gpointer data )
 {
 	struct im_connection *ic = data;
 	char *from = xt_find_attr( node, "from" );
 	char *type = xt_find_attr( node, "type" );	/* NULL should mean the person is online. */
 	struct xt_node *c, *cap;
-	struct jabber_buddy *bud, *send_presence = NULL;
+	struct jabber_buddy *bud;
 	int is_chat = 0;
 	char *s;
 	
@@ -97,7 +99,7 @@ xt_status jabber_pkt_presence( struct xt_node *node, gpointer data )
 		if( is_chat )
 			jabber_chat_pkt_presence( ic, bud, node );
 		else
-			send_presence = jabber_buddy_by_jid( ic, bud->bare_jid, 0 );
+			jabber_presence_update( ic, bud->bare_jid );
 	}
 	else if( strcmp( type, "unavailable" ) == 0 )
 	{
@@ -130,20 +132,12 @@ xt_status jabber_pkt_presence( struct xt_node *node, gpointer data )
 		else if( ( s = strchr( from, '/' ) ) )
 		{
 			*s = 0;
-		
-			/* If another resource is still available, send its presence
-			   information. */
-			if( ( send_presence = jabber_buddy_by_jid( ic, from, 0 ) ) == NULL )
-			{
-				/* Otherwise, count him/her as offline now. */
-				imcb_buddy_status( ic, from, 0, NULL, NULL );
-			}
-			
+			jabber_presence_update( ic, from );
 			*s = '/';
 		}
 		else
 		{
-			imcb_buddy_status( ic, from, 0, NULL, NULL );
+			jabber_presence_update( ic, from );
 		}
 	}
 	else if( strcmp( type, "subscribe" ) == 0 )
@@ -181,21 +175,110 @@ xt_status jabber_pkt_presence( struct xt_node *node, gpointer data )
 			jabber_error_free( err );
 		} */
 	}
+	
+	return XT_HANDLED;
+}
 
-	if( send_presence )
+/* Pass the current state of a contact to the UI: the presence of the most
+   important resource that's still available, or offline if there's none. */
+static void jabber_presence_send_status( struct im_connection *ic, const char *bare_jid )
+{
+	struct jabber_buddy *bud;
+	int is_away = 0;
+	
+	if( ( bud = jabber_buddy_by_jid( ic, (char*) bare_jid, 0 ) ) == NULL )
 	{
-		int is_away = 0;
+		imcb_buddy_status( ic, bare_jid, 0, NULL, NULL );
+		return;
+	}
+	
+	if( bud->away_state && strcmp( bud->away_state->code, "chat" ) != 0 )
+		is_away = OPT_AWAY;
+	
+	imcb_buddy_status( ic, bud->bare_jid, OPT_LOGGED_IN | is_away,
+	                   is_away ? bud->away_state->full_name : NULL,
+	                   bud->away_message );
+}
 
-		if( send_presence->away_state &&
-		    strcmp( send_presence->away_state->code, "chat" ) != 0 )
-			is_away = OPT_AWAY;
+static void jabber_presence_update( struct im_connection *ic, const char *bare_jid )
+{
+	struct jabber_data *jd = ic->proto_data;
+	char *key;
+	
+	if( jd->presence_pending == NULL )
+	{
+		jabber_presence_send_status( ic, bare_jid );
+		return;
+	}
+	
+	key = jabber_normalize( bare_jid );
+	if( g_hash_table_lookup( jd->presence_pending, key ) )
+		g_free( key );
+	else
+		g_hash_table_insert( jd->presence_pending, key, key );
+}
 
-		imcb_buddy_status( ic, send_presence->bare_jid, OPT_LOGGED_IN | is_away,
-		                   is_away ? send_presence->away_state->full_name : NULL,
-		                   send_presence->away_message );
+static gboolean jabber_presence_flush_one( gpointer key, gpointer value, gpointer data )
+{
+	jabber_presence_send_status( data, key );
+	return TRUE;
+}
+
+static gboolean jabber_presence_settle_tick( gpointer data, gint fd, b_input_condition cond )
+{
+	struct im_connection *ic = data;
+	struct jabber_data *jd = ic->proto_data;
+	int n = g_hash_table_size( jd->presence_pending );
+	
+	if( n > 0 )
+	{
+		jd->presence_settle_seen = TRUE;
+		imcb_buddy_status_batch( ic, TRUE );
+		g_hash_table_foreach_remove( jd->presence_pending, jabber_presence_flush_one, ic );
+		imcb_buddy_status_batch( ic, FALSE );
 	}
 	
-	return XT_HANDLED;
+	/* Stay in this mode until things calm down. Settling starts before
+	   our own presence goes out, so it may take a few ticks (a round
+	   trip to the server) for the flood to start at all. */
+	if( ( n > 0 || !jd->presence_settle_seen ) &&
+	    time( NULL ) < jd->presence_settle_until )
+		return TRUE;
+	
+	jd->presence_settle_id = 0;
+	jabber_presence_settle_end( ic );
+	return FALSE;
+}
+
+/* At login time, the server sends us the presence of every contact (every
+   resource, even) in one go. Instead of passing all of them to the UI one
+   by one, remember which contacts changed and pass their final state on
+   a few times per second, until the flood is over. */
+void jabber_presence_settle( struct im_connection *ic )
+{
+	struct jabber_data *jd = ic->proto_data;
+	
+	if( jd->presence_pending )
+		return;
+	
+	jd->presence_pending = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, NULL );
+	jd->presence_settle_until = time( NULL ) + JABBER_PRESENCE_SETTLE_MAX;
+	jd->presence_settle_seen = FALSE;
+	jd->presence_settle_id = b_timeout_add( JABBER_PRESENCE_SETTLE_TIME, jabber_presence_settle_tick, ic );
+}
+
+/* Called at logout too, in which case pending updates are just dropped. */
+void jabber_presence_settle_end( struct im_connection *ic )
+{
+	struct jabber_data *jd = ic->proto_data;
+	
+	if( jd->presence_settle_id )
+		b_event_remove( jd->presence_settle_id );
+	jd->presence_settle_id = 0;
+	
+	if( jd->presence_pending )
+		g_hash_table_destroy( jd->presence_pending );
+	jd->presence_pending = NULL;
 }
 
 /* Whenever presence information is updated, call this function to inform the
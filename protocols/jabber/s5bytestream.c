@@ -104,7 +104,7 @@ int jabber_bs_recv_request( struct im_connection *ic, struct xt_node *node, stru
 gboolean jabber_bs_send_handshake_abort( struct bs_transfer *bt, char *error );
 gboolean jabber_bs_send_request( struct jabber_transfer *tf, GSList *streamhosts );
 gboolean jabber_bs_send_handshake( gpointer data, gint fd, b_input_condition cond );
-static xt_status jabber_bs_send_handle_activate( struct im_connection *ic, struct xt_node *node, struct xt_node *orig );
+static xt_status jabber_bs_send_handle_activate( struct im_connection *ic, struct xt_node *node, char *ctx );
 void jabber_bs_send_activate( struct bs_transfer *bt );
 
 /*
@@ -714,13 +714,13 @@ gboolean jabber_bs_send_write( file_transfer_t *ft, char *buffer, unsigned int l
 /*
  * Handles the reply by the receiver containing the used streamhost.
  */
-static xt_status jabber_bs_send_handle_reply(struct im_connection *ic, struct xt_node *node, struct xt_node *orig ) {
+static xt_status jabber_bs_send_handle_reply(struct im_connection *ic, struct xt_node *node, char *ctx ) {
 	struct jabber_transfer *tf = NULL;
 	struct jabber_data *jd = ic->proto_data;
 	struct bs_transfer *bt;
 	GSList *tflist;
 	struct xt_node *c;
-	char *sid, *jid;
+	char *sid = ctx, *jid;
 
 	if( !( c = xt_find_node( node->children, "query" ) ) ||
 	    !( c = xt_find_node( c->children, "streamhost-used" ) ) ||
@@ -731,8 +731,7 @@ static xt_status jabber_bs_send_handle_reply(struct im_connection *ic, struct xt
 		return XT_HANDLED;
 	}
 	
-	if( !( c = xt_find_node( orig->children, "query" ) ) ||
-	    !( sid = xt_find_attr( c, "sid" ) ) )
+	if( !sid )
 	{
 		imcb_log( ic, "WARNING: Error parsing request corresponding to the incoming bytestream reply" );
 		return XT_HANDLED;
@@ -826,26 +825,23 @@ void jabber_bs_send_activate( struct bs_transfer *bt )
 	xt_add_attr( node, "sid", bt->tf->sid );
 	node = jabber_make_packet( "iq", "set", bt->sh->jid, node );
 
-	jabber_cache_add( bt->tf->ic, node, jabber_bs_send_handle_activate );
+	jabber_cache_add( bt->tf->ic, node, jabber_bs_send_handle_activate, bt->tf->sid );
 
 	jabber_write_packet( bt->tf->ic, node );
+	xt_free_node( node );
 }
 
 /*
  * The proxy has activated the bytestream.
  * We can finally start pushing some data out.
  */
-static xt_status jabber_bs_send_handle_activate( struct im_connection *ic, struct xt_node *node, struct xt_node *orig )
+static xt_status jabber_bs_send_handle_activate( struct im_connection *ic, struct xt_node *node, char *ctx )
 {
-	char *sid;
+	char *sid = ctx;
 	GSList *tflist;
 	struct jabber_transfer *tf = NULL;
-	struct xt_node *query;
 	struct jabber_data *jd = ic->proto_data;
 
-	query = xt_find_node( orig->children, "query" );
-	sid = xt_find_attr( query, "sid" );
-
 	for( tflist = jd->filetransfers ; tflist; tflist = g_slist_next(tflist) )
 	{
 		struct jabber_transfer *tft = tflist->data;
@@ -980,6 +976,7 @@ gboolean jabber_bs_send_start( struct jabber_transfer *tf )
 gboolean jabber_bs_send_request( struct jabber_transfer *tf, GSList *streamhosts )
 {
 	struct xt_node *shnode, *query, *iq;
+	int st;
 
 	query = xt_new_node( "query", NULL, NULL );
 	xt_add_attr( query, "xmlns", XMLNS_BYTESTREAMS );
@@ -1002,9 +999,11 @@ gboolean jabber_bs_send_request( struct jabber_transfer *tf, GSList *streamhosts
 	iq = jabber_make_packet( "iq", "set", tf->tgt_jid, query );
 	xt_add_attr( iq, "from", tf->ini_jid );
 
-	jabber_cache_add( tf->ic, iq, jabber_bs_send_handle_reply );
+	jabber_cache_add( tf->ic, iq, jabber_bs_send_handle_reply, tf->sid );
 
-	if( !jabber_write_packet( tf->ic, iq ) )
+	st = jabber_write_packet( tf->ic, iq );
+	xt_free_node( iq );
+	if( !st )
 		imcb_file_canceled( tf->ic, tf->ft, "Error transmitting bytestream request" );
 	return TRUE;
 }
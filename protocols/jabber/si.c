@@ -373,7 +373,7 @@ void jabber_si_answer_request( file_transfer_t *ft ) {
 	xt_free_node( reply );
 }
 
-static xt_status jabber_si_handle_response(struct im_connection *ic, struct xt_node *node, struct xt_node *orig )
+static xt_status jabber_si_handle_response(struct im_connection *ic, struct xt_node *node, char *ctx )
 {
 	struct xt_node *c, *d;
 	char *ini_jid = NULL, *tgt_jid, *iq_id, *cmp;
@@ -460,6 +460,7 @@ int jabber_si_send_request(struct im_connection *ic, char *who, struct jabber_tr
 {
 	struct xt_node *node, *sinode;
 	struct jabber_buddy *bud;
+	int st;
 
 	/* who knows how many bits the future holds :) */
 	char filesizestr[ 1 + ( int ) ( 0.301029995663981198f * sizeof( size_t ) * 8 ) ];
@@ -526,8 +527,10 @@ int jabber_si_send_request(struct im_connection *ic, char *who, struct jabber_tr
 
 	/* and we are there... */
 	node = jabber_make_packet( "iq", "set", bud ? bud->full_jid : who, sinode );
-	jabber_cache_add( ic, node, jabber_si_handle_response );
+	jabber_cache_add( ic, node, jabber_si_handle_response, NULL );
 	tf->iq_id = g_strdup( xt_find_attr( node, "id" ) );
 	
-	return jabber_write_packet( ic, node );
+	st = jabber_write_packet( ic, node );
+	xt_free_node( node );
+	return st;
 }
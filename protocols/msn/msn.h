@@ -59,6 +59,11 @@
 
 #define MSN_SB_NEW         -24062002
 
+/* msn_handler() reads in chunks of this size, and drops its receive buffer
+   once it's empty and bigger than MSN_RXQ_KEEP. */
+#define MSN_RXQ_CHUNK 4096
+#define MSN_RXQ_KEEP  65536
+
 #define MSN_MESSAGE_HEADERS "MIME-Version: 1.0\r\n" \
                             "Content-Type: text/plain; charset=UTF-8\r\n" \
                             "User-Agent: BitlBee " BITLBEE_VERSION "\r\n" \
@@ -94,7 +99,7 @@ typedef enum
 struct msn_handler_data
 {
 	int fd, inpa;
-	int rxlen;
+	int rxlen, rxsize;
 	char *rxq;
 	
 	int msglen;
@@ -267,103 +267,109 @@ char **msn_linesplit( char *line )
 
 int msn_handler( struct msn_handler_data *h )
 {
-	int st;
+	int st, i, pos;
 	
-	h->rxq = g_renew( char, h->rxq, h->rxlen + 1024 );
-	st = read( h->fd, h->rxq + h->rxlen, 1024 );
-	h->rxlen += st;
+	/* One read per wakeup: the socket is blocking, so reading until
+	   it's drained could hang the whole process. There's always one
+	   spare byte after the data, so lines and payloads can be
+	   zero-terminated in place. */
+	if( h->rxsize - h->rxlen < MSN_RXQ_CHUNK + 1 )
+	{
+		h->rxsize = MAX( h->rxsize * 2, h->rxlen + MSN_RXQ_CHUNK + 1 );
+		h->rxq = g_renew( char, h->rxq, h->rxsize );
+	}
 	
+	st = read( h->fd, h->rxq + h->rxlen, h->rxsize - h->rxlen - 1 );
 	if( st <= 0 )
 		return( -1 );
 	
 	if( getenv( "BITLBEE_DEBUG" ) )
 	{
 		write( 2, "->C:", 4 );
-		write( 2, h->rxq + h->rxlen - st, st );
+		write( 2, h->rxq + h->rxlen, st );
 	}
 	
-	while( st )
+	h->rxlen += st;
+	
+	/* Consume complete commands/payloads, pos is the read cursor. */
+	pos = 0;
+	while( pos < h->rxlen )
 	{
-		int i;
+		char **cmd;
+		int count;
 		
 		if( h->msglen == 0 )
 		{
-			for( i = 0; i < h->rxlen; i ++ )
+			for( i = pos; i < h->rxlen && h->rxq[i] != '\r' && h->rxq[i] != '\n'; i ++ );
+			
+			/* There's still an incomplete command there. Wait for
+			   more data. */
+			if( i == h->rxlen )
+				break;
+			
+			h->rxq[i] = 0;
+			cmd = msn_linesplit( h->rxq + pos );
+			for( count = 0; cmd[count]; count ++ );
+			st = h->exec_command( h, cmd, count );
+			
+			/* If the connection broke, don't continue. We don't even exist anymore. */
+			if( !st )
+				return( 0 );
+			
+			if( h->msglen )
 			{
-				if( h->rxq[i] == '\r' || h->rxq[i] == '\n' )
-				{
-					char *cmd_text, **cmd;
-					int count;
-					
-					cmd_text = g_strndup( h->rxq, i );
-					cmd = msn_linesplit( cmd_text );
-					for( count = 0; cmd[count]; count ++ );
-					st = h->exec_command( h, cmd, count );
-					g_free( cmd_text );
-					
-					/* If the connection broke, don't continue. We don't even exist anymore. */
-					if( !st )
-						return( 0 );
-					
-					if( h->msglen )
-						h->cmd_text = g_strndup( h->rxq, i );
-					
-					/* Skip to the next non-emptyline */
-					while( i < h->rxlen && ( h->rxq[i] == '\r' || h->rxq[i] == '\n' ) ) i ++;
-					
-					break;
-				}
+				int j;
+				
+				/* The payload handler wants the original command
+				   line, undo what msn_linesplit() did to it. */
+				for( j = pos; j < i; j ++ )
+					if( h->rxq[j] == 0 )
+						h->rxq[j] = ' ';
+				h->cmd_text = g_strndup( h->rxq + pos, i - pos );
 			}
 			
-			/* If we reached the end of the buffer, there's still an incomplete command there.
-			   Return and wait for more data. */
-			if( i == h->rxlen && h->rxq[i-1] != '\r' && h->rxq[i-1] != '\n' )
-				break;
+			/* Skip to the next non-emptyline */
+			for( pos = i + 1; pos < h->rxlen && ( h->rxq[pos] == '\r' || h->rxq[pos] == '\n' ); pos ++ );
 		}
 		else
 		{
-			char *msg, **cmd;
-			int count;
+			int msglen = h->msglen;
+			char c;
 			
 			/* Do we have the complete message already? */
-			if( h->msglen > h->rxlen )
+			if( msglen > h->rxlen - pos )
 				break;
 			
-			msg = g_strndup( h->rxq, h->msglen );
 			cmd = msn_linesplit( h->cmd_text );
 			for( count = 0; cmd[count]; count ++ );
 			
-			st = h->exec_message( h, msg, h->msglen, cmd, count );
-			g_free( msg );
+			c = h->rxq[pos+msglen];
+			h->rxq[pos+msglen] = 0;
+			st = h->exec_message( h, h->rxq + pos, msglen, cmd, count );
 			g_free( h->cmd_text );
 			h->cmd_text = NULL;
 			
 			if( !st )
 				return( 0 );
 			
-			i = h->msglen;
+			h->rxq[pos+msglen] = c;
+			pos += msglen;
 			h->msglen = 0;
 		}
-		
-		/* More data after this block? */
-		if( i < h->rxlen )
-		{
-			char *tmp;
-			
-			tmp = g_memdup( h->rxq + i, h->rxlen - i );
-			g_free( h->rxq );
-			h->rxq = tmp;
-			h->rxlen -= i;
-			i = 0;
-		}
-		else
-		/* If not, reset the rx queue and get lost. */
-		{
-			g_free( h->rxq );
-			h->rxq = g_new0( char, 1 );
-			h->rxlen = 0;
-			return( 1 );
-		}
+	}
+	
+	/* Compact only once per read: Move the incomplete remainder (if
+	   any) to the front. Don't hang on to huge buffers after a burst. */
+	h->rxlen -= pos;
+	if( h->rxlen > 0 )
+	{
+		memmove( h->rxq, h->rxq + pos, h->rxlen );
+	}
+	else if( h->rxsize > MSN_RXQ_KEEP )
+	{
+		g_free( h->rxq );
+		h->rxq = NULL;
+		h->rxsize = 0;
 	}
 	
 	return( 1 );
@@ -107,8 +107,8 @@ static gboolean msn_ns_connected( gpointer data, gint source, b_input_condition
 	}
 	
 	g_free( handler->rxq );
-	handler->rxlen = 0;
-	handler->rxq = g_new0( char, 1 );
+	handler->rxlen = handler->rxsize = 0;
+	handler->rxq = NULL;
 	
 	if( msn_ns_write( ic, source, "VER %d %s CVR0\r\n", ++md->trId, MSNP_VER ) )
 	{
@@ -131,7 +131,7 @@ void msn_ns_close( struct msn_handler_data *handler )
 	g_free( handler->rxq );
 	g_free( handler->cmd_text );
 	
-	handler->rxlen = 0;
+	handler->rxlen = handler->rxsize = 0;
 	handler->rxq = NULL;
 	handler->cmd_text = NULL;
 }
@@ -325,7 +325,6 @@ gboolean msn_sb_connected( gpointer data, gint source, b_input_condition cond )
 	/* Prepare the callback */
 	sb->handler = g_new0( struct msn_handler_data, 1 );
 	sb->handler->fd = sb->fd;
-	sb->handler->rxq = g_new0( char, 1 );
 	sb->handler->data = sb;
 	sb->handler->exec_command = msn_sb_command;
 	sb->handler->exec_message = msn_sb_message;
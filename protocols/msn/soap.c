@@ -63,6 +63,7 @@ struct msn_soap_req_data
 	
 	char *url, *action, *payload;
 	struct http_request *http_req;
+	struct xt_parser *parser;
 	
 	const struct xt_handler_entry *xml_parser;
 	msn_soap_func build_request, handle_response, free_data;
@@ -115,6 +116,10 @@ static int msn_soap_send_request( struct msn_soap_req_data *soap_req )
 	soap_req->http_req = http_dorequest( url.host, url.port, url.proto == PROTO_HTTPS,
 		http_req, msn_soap_handle_response, soap_req );
 	
+	/* Address books can be big, parse them while they come in. */
+	if( soap_req->http_req )
+		soap_req->http_req->flags |= HTTPC_STREAMING;
+	
 	g_free( http_req );
 	g_free( soap_action );
 	
@@ -124,23 +129,40 @@ static int msn_soap_send_request( struct msn_soap_req_data *soap_req )
 static void msn_soap_handle_response( struct http_request *http_req )
 {
 	struct msn_soap_req_data *soap_req = http_req->data;
+	struct xt_node *err;
 	int st;
 	
 	if( g_slist_find( msn_connections, soap_req->ic ) == NULL )
 	{
+		if( !( http_req->flags & HTTPC_EOF ) )
+			http_close( http_req );
 		msn_soap_free( soap_req );
 		return;
 	}
 	
-	msn_soap_debug_print( http_req->reply_headers, http_req->reply_body );
-	
 	if( http_req->body_size > 0 )
 	{
-		struct xt_parser *parser;
-		struct xt_node *err;
+		if( soap_req->parser == NULL )
+			soap_req->parser = xt_new( soap_req->xml_parser, soap_req );
+		
+		xt_feed( soap_req->parser, http_req->reply_body, http_req->body_size );
+		http_flush_bytes( http_req, http_req->body_size );
+	}
+	
+	if( !( http_req->flags & HTTPC_EOF ) )
+		return;
+	
+	msn_soap_debug_print( http_req->reply_headers, NULL );
+	
+	if( soap_req->parser )
+	{
+		struct xt_parser *parser = soap_req->parser;
+		
+		soap_req->parser = NULL;
+		
+		if( getenv( "BITLBEE_DEBUG" ) && parser->root )
+			xt_print( parser->root );
 		
-		parser = xt_new( soap_req->xml_parser, soap_req );
-		xt_feed( parser, http_req->reply_body, http_req->body_size );
 		if( http_req->status_code == 500 &&
 		    ( err = xt_find_path( parser->root, "soap:Body/soap:Fault/detail/errorcode" ) ) &&
 		    err->text_len > 0 )
@@ -254,6 +276,7 @@ int msn_soapq_flush( struct im_connection *ic, gboolean resend )
 static void msn_soap_free( struct msn_soap_req_data *soap_req )
 {
 	soap_req->free_data( soap_req );
+	xt_free( soap_req->parser );
 	g_free( soap_req->url );
 	g_free( soap_req->action );
 	g_free( soap_req->payload );
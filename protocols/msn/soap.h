@@ -48,7 +48,7 @@ int msn_soapq_flush( struct im_connection *ic, gboolean resend );
 
 
 #define SOAP_HTTP_REQUEST \
-"POST %s HTTP/1.0\r\n" \
+"POST %s HTTP/1.1\r\n" \
 "Host: %s\r\n" \
 "Accept: */*\r\n" \
 "User-Agent: BitlBee " BITLBEE_VERSION "\r\n" \
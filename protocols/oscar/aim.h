@@ -259,6 +259,8 @@ typedef struct aim_frame_s {
 	aim_bstream_t data;	/* payload stream */
 	guint8 handled;		/* 0 = new, !0 = been handled */
 	guint8 nofree;		/* 0 = free data on purge, 1 = only unlink */
+	guint8 rxview;		/* data points into conn's receive buffer */
+	guint32 txoff;		/* bytes of it the socket took already */
 	aim_conn_t *conn;  /* the connection it came in on... */
 	struct aim_frame_s *next;
 } aim_frame_t;
@@ -316,7 +318,9 @@ typedef struct aim_session_s {
 	 *  
 	 */
 	aim_frame_t *queue_outgoing;   
+	aim_frame_t *queue_outgoing_tail;
 	aim_frame_t *queue_incoming; 
+	aim_frame_t *queue_incoming_tail;
 
 	/*
 	 * Tx Enqueuing function.
@@ -328,6 +332,12 @@ typedef struct aim_session_s {
 	 */
 	int (*tx_enqueue)(struct aim_session_s *, aim_frame_t *);
 
+	/*
+	 * In AIM_TX_IMMEDIATE mode, frames are collected until we're
+	 * back in the main loop, so they can go out in one writev().
+	 */
+	gint tx_flush;
+
 	/*
 	 * Outstanding snac handling 
 	 *
@@ -179,8 +179,25 @@ struct rateclass {
 typedef struct aim_conn_inside_s {
 	struct snacgroup *groups;
 	struct rateclass *rates;
+
+	/*
+	 * Receive buffer. Incoming frames point into it, everything
+	 * before rxstart has been parsed already and is dropped at the
+	 * start of the next read.
+	 */
+	guint8 *rxbuf;
+	int rxstart, rxlen, rxsize;
+
+	/*
+	 * Set while the socket doesn't take any more data. The rest of
+	 * the queue for this connection waits until it's writable again.
+	 */
+	gint txwatch;
 } aim_conn_inside_t;
 
+#define AIM_RXBUF_CHUNK 8192	/* Minimum free space for each read */
+#define AIM_RXBUF_KEEP 65536	/* Drop bigger buffers when they're empty */
+
 void aim_conn_addgroup(aim_conn_t *conn, guint16 group);
 
 guint32 aim_getcap(aim_session_t *sess, aim_bstream_t *bs, int len);
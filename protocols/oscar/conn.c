@@ -172,6 +172,7 @@ static void connkill_real(aim_session_t *sess, aim_conn_t **deadconn)
 		connkill_snacgroups(&inside->groups);
 		connkill_rates(&inside->rates);
 
+		g_free(inside->rxbuf);
 		g_free(inside);
 	}
 
@@ -305,7 +306,12 @@ void aim_conn_kill(aim_session_t *sess, aim_conn_t **deadconn)
  */
 void aim_conn_close(aim_conn_t *deadconn)
 {
+	aim_conn_inside_t *ins = (aim_conn_inside_t *)deadconn->inside;
 
+	if (ins->txwatch) {
+		b_event_remove(ins->txwatch);
+		ins->txwatch = 0;
+	}
 	if (deadconn->fd >= 3)
 		closesocket(deadconn->fd);
 	deadconn->fd = -1;
@@ -500,7 +506,9 @@ void aim_session_init(aim_session_t *sess, guint32 flags, int debuglevel)
 	memset(sess, 0, sizeof(aim_session_t));
 	aim_connrst(sess);
 	sess->queue_outgoing = NULL;
+	sess->queue_outgoing_tail = NULL;
 	sess->queue_incoming = NULL;
+	sess->queue_incoming_tail = NULL;
 	aim_initsnachash(sess);
 	sess->msgcookies = NULL;
 	sess->snacid_next = 0x00000001;
@@ -572,6 +580,20 @@ void aim_session_init(aim_session_t *sess, guint32 flags, int debuglevel)
  */
 void aim_session_kill(aim_session_t *sess)
 {
+	aim_frame_t *cur;
+
+	if (sess->tx_flush) {
+		b_event_remove(sess->tx_flush);
+		sess->tx_flush = 0;
+	}
+
+	/* Frames still waiting for the flush, sent or not. */
+	while ((cur = sess->queue_outgoing)) {
+		sess->queue_outgoing = cur->next;
+		aim_frame_destroy(cur);
+	}
+	sess->queue_outgoing_tail = NULL;
+
 	aim_cleansnacs(sess, -1);
 
 	aim_logoff(sess);
@@ -35,33 +35,6 @@ int aim_recv(int fd, void *buf, size_t count)
 	return cur;
 }
 
-/*
- * Read into a byte stream.  Will not read more than count, but may read
- * less if there is not enough room in the stream buffer.
- */
-static int aim_bstream_recv(aim_bstream_t *bs, int fd, size_t count)
-{
-	int red = 0;
-
-	if (!bs || (fd < 0) || (count < 0))
-		return -1;
-	
-	if (count > (bs->len - bs->offset))
-		count = bs->len - bs->offset; /* truncate to remaining space */
-
-	if (count) {
-
-		red = aim_recv(fd, bs->data + bs->offset, count);
-
-		if (red <= 0)
-			return -1;
-	}
-
-	bs->offset += red;
-
-	return red;
-}
-
 int aim_bstream_init(aim_bstream_t *bs, guint8 *data, int len)
 {
 	
@@ -329,22 +302,66 @@ int aimbs_putbs(aim_bstream_t *bs, aim_bstream_t *srcbs, int len)
 void aim_frame_destroy(aim_frame_t *frame)
 {
 
-	g_free(frame->data.data); /* XXX aim_bstream_free */
+	if (!frame->rxview)
+		g_free(frame->data.data); /* XXX aim_bstream_free */
 
 	g_free(frame);
 } 
 
 
 /*
- * Grab a single command sequence off the socket, and enqueue
- * it in the incoming event queue in a seperate struct.
+ * Give queued frames that still point into conn's receive buffer their
+ * own copy of the payload, before the buffer is moved around or freed.
+ */
+static void aim_rxqueue_unview(aim_session_t *sess, aim_conn_t *conn)
+{
+	aim_frame_t *cur;
+
+	for (cur = sess->queue_incoming; cur; cur = cur->next) {
+		if (cur->conn == conn && cur->rxview) {
+			if (cur->data.len)
+				cur->data.data = g_memdup(cur->data.data, cur->data.len);
+			cur->rxview = 0;
+		}
+	}
+}
+
+/*
+ * Move the unparsed remainder of the receive buffer to the front. Frames
+ * still queued at this point (normally none, aim_rxdispatch() runs after
+ * every read) are detached from the buffer first.
+ */
+static void aim_rxbuf_compact(aim_session_t *sess, aim_conn_t *conn)
+{
+	aim_conn_inside_t *ins = (aim_conn_inside_t *)conn->inside;
+
+	if (ins->rxstart == 0)
+		return;
+
+	aim_rxqueue_unview(sess, conn);
+
+	ins->rxlen -= ins->rxstart;
+	memmove(ins->rxbuf, ins->rxbuf + ins->rxstart, ins->rxlen);
+	ins->rxstart = 0;
+
+	if (ins->rxlen == 0 && ins->rxsize > AIM_RXBUF_KEEP) {
+		g_free(ins->rxbuf);
+		ins->rxbuf = NULL;
+		ins->rxsize = 0;
+	}
+}
+
+/*
+ * Grab whatever is available on the socket with a single read, and
+ * enqueue every complete FLAP in it in the incoming event queue. The
+ * payloads aren't copied, the frames point into the receive buffer.
  */
 int aim_get_command(aim_session_t *sess, aim_conn_t *conn)
 {
-	guint8 flaphdr_raw[6];
-	aim_bstream_t flaphdr;
+	aim_conn_inside_t *ins;
 	aim_frame_t *newrx;
 	guint16 payloadlen;
+	int red, pos;
 	
 	if (!sess || !conn)
 		return 0;
@@ -365,85 +382,78 @@ int aim_get_command(aim_session_t *sess, aim_conn_t *conn)
 	if (conn->status & AIM_CONN_STATUS_INPROGRESS)
 		return aim_conn_completeconnect(sess, conn);
 
-	aim_bstream_init(&flaphdr, flaphdr_raw, sizeof(flaphdr_raw));
+	ins = (aim_conn_inside_t *)conn->inside;
 
-	/*
-	 * Read FLAP header.  Six bytes:
-	 *    
-	 *   0 char  -- Always 0x2a
-	 *   1 char  -- Channel ID.  Usually 2 -- 1 and 4 are used during login.
-	 *   2 short -- Sequence number 
-	 *   4 short -- Number of data bytes that follow.
-	 */
-	if (aim_bstream_recv(&flaphdr, conn->fd, 6) < 6) {
-		aim_conn_close(conn);
-		return -1;
+	aim_rxbuf_compact(sess, conn);
+
+	if (ins->rxsize - ins->rxlen < AIM_RXBUF_CHUNK) {
+		ins->rxsize = MAX(ins->rxsize * 2, ins->rxlen + AIM_RXBUF_CHUNK);
+		ins->rxbuf = g_renew(guint8, ins->rxbuf, ins->rxsize);
 	}
 
-	aim_bstream_rewind(&flaphdr);
+	red = recv(conn->fd, ins->rxbuf + ins->rxlen, ins->rxsize - ins->rxlen, 0);
 
-	/*
-	 * This shouldn't happen unless the socket breaks, the server breaks,
-	 * or we break.  We must handle it just in case.
-	 */
-	if (aimbs_get8(&flaphdr) != 0x2a) {
-		aim_bstream_rewind(&flaphdr);
-		aimbs_get8(&flaphdr);
-		imcb_error(sess->aux_data, "FLAP framing disrupted");
+	/* Of course EOF is an error, only morons disagree with that. */
+	if (red == 0 || (red < 0 && !sockerr_again() && errno != EAGAIN)) {
 		aim_conn_close(conn);
 		return -1;
-	}	
-
-	/* allocate a new struct */
-	if (!(newrx = (aim_frame_t *)g_new0(aim_frame_t,1)))
-		return -1;
-
-	/* we're doing FLAP if we're here */
-	newrx->hdrtype = AIM_FRAMETYPE_FLAP;
-	
-	newrx->hdr.flap.type = aimbs_get8(&flaphdr);
-	newrx->hdr.flap.seqnum = aimbs_get16(&flaphdr);
-	payloadlen = aimbs_get16(&flaphdr);
-
-	newrx->nofree = 0; /* free by default */
+	} else if (red < 0) {
+		return 0;
+	}
 
-	if (payloadlen) {
-		guint8 *payload = NULL;
+	ins->rxlen += red;
 
-		if (!(payload = (guint8 *) g_malloc(payloadlen))) {
-			aim_frame_destroy(newrx);
+	/*
+	 * Parse all complete FLAPs. The header is six bytes:
+	 *    
+	 *   0 char  -- Always 0x2a
+	 *   1 char  -- Channel ID.  Usually 2 -- 1 and 4 are used during login.
+	 *   2 short -- Sequence number 
+	 *   4 short -- Number of data bytes that follow.
+	 */
+	for (pos = ins->rxstart; ins->rxlen - pos >= 6; pos += 6 + payloadlen) {
+		guint8 *flaphdr = ins->rxbuf + pos;
+
+		/*
+		 * This shouldn't happen unless the socket breaks, the server breaks,
+		 * or we break.  We must handle it just in case.
+		 */
+		if (aimutil_get8(flaphdr) != 0x2a) {
+			imcb_error(sess->aux_data, "FLAP framing disrupted");
+			aim_conn_close(conn);
 			return -1;
 		}
 
-		aim_bstream_init(&newrx->data, payload, payloadlen);
+		payloadlen = aimutil_get16(flaphdr + 4);
+		if (ins->rxlen - pos < 6 + payloadlen)
+			break; /* The rest will come with the next read */
 
-		/* read the payload */
-		if (aim_bstream_recv(&newrx->data, conn->fd, payloadlen) < payloadlen) {
-			aim_frame_destroy(newrx); /* free's payload */
-			aim_conn_close(conn);
-			return -1;
-		}
-	} else
-		aim_bstream_init(&newrx->data, NULL, 0);
+		newrx = g_new0(aim_frame_t, 1);
 
+		/* we're doing FLAP if we're here */
+		newrx->hdrtype = AIM_FRAMETYPE_FLAP;
+		newrx->hdr.flap.type = aimutil_get8(flaphdr + 1);
+		newrx->hdr.flap.seqnum = aimutil_get16(flaphdr + 2);
 
-	aim_bstream_rewind(&newrx->data);
+		newrx->nofree = 0; /* free by default */
+		newrx->rxview = 1;
 
-	newrx->conn = conn;
+		aim_bstream_init(&newrx->data, payloadlen ? flaphdr + 6 : NULL, payloadlen);
 
-	newrx->next = NULL;  /* this will always be at the bottom */
+		newrx->conn = conn;
 
-	if (!sess->queue_incoming)
-		sess->queue_incoming = newrx;
-	else {
-		aim_frame_t *cur;
+		newrx->next = NULL;  /* this will always be at the bottom */
 
-		for (cur = sess->queue_incoming; cur->next; cur = cur->next)
-			;
-		cur->next = newrx;
+		if (sess->queue_incoming_tail)
+			sess->queue_incoming_tail->next = newrx;
+		else
+			sess->queue_incoming = newrx;
+		sess->queue_incoming_tail = newrx;
+
+		conn->lastactivity = time(NULL);
 	}
 
-	newrx->conn->lastactivity = time(NULL);
+	ins->rxstart = pos;
 
 	return 0;  
 }
@@ -463,6 +473,8 @@ void aim_purge_rxqueue(aim_session_t *sess)
 {
 	aim_frame_t *cur, **prev;
 
+	sess->queue_incoming_tail = NULL;
+
 	for (prev = &sess->queue_incoming; (cur = *prev); ) {
 		if (cur->handled) {
 
@@ -471,8 +483,10 @@ void aim_purge_rxqueue(aim_session_t *sess)
 			if (!cur->nofree)
 				aim_frame_destroy(cur);
 
-		} else
+		} else {
+			sess->queue_incoming_tail = cur;
 			prev = &cur->next;
+		}
 	}
 
 	return;
@@ -489,6 +503,10 @@ void aim_rxqueue_cleanbyconn(aim_session_t *sess, aim_conn_t *conn)
 {
 	aim_frame_t *currx;
 
+	/* The receive buffer is about to go, and the frame that's being
+	   dispatched right now may still be read from. */
+	aim_rxqueue_unview(sess, conn);
+
 	for (currx = sess->queue_incoming; currx; currx = currx->next) {
 		if ((!currx->handled) && (currx->conn == conn))
 			currx->handled = 1;
@@ -7,11 +7,20 @@
 
 #include <aim.h>
 #include "im.h"
+#include "sock.h"
 
 #ifndef _WIN32
 #include <sys/socket.h>
+#include <sys/uio.h>
+#else
+struct iovec {
+	void *iov_base;
+	size_t iov_len;
+};
 #endif
 
+#define AIM_TX_BATCH 32 /* max. frames per writev() in aim_tx_flushqueue() */
+
 /*
  * Allocate a new tx frame.
  *
@@ -75,6 +84,16 @@ aim_frame_t *aim_tx_new(aim_session_t *sess, aim_conn_t *conn, guint8 framing, g
  * that is, when sess->tx_enqueue is set to &aim_tx_enqueue__queuebased.
  *
  */
+static void aim_tx_append(aim_session_t *sess, aim_frame_t *fr)
+{
+	fr->next = NULL;
+	if (sess->queue_outgoing_tail)
+		sess->queue_outgoing_tail->next = fr;
+	else
+		sess->queue_outgoing = fr;
+	sess->queue_outgoing_tail = fr;
+}
+
 static int aim_tx_enqueue__queuebased(aim_session_t *sess, aim_frame_t *fr)
 {
 
@@ -90,29 +109,30 @@ static int aim_tx_enqueue__queuebased(aim_session_t *sess, aim_frame_t *fr)
 
 	fr->handled = 0; /* not sent yet */
 
-	/* see overhead note in aim_rxqueue counterpart */
-	if (!sess->queue_outgoing)
-		sess->queue_outgoing = fr;
-	else {
-		aim_frame_t *cur;
-
-		for (cur = sess->queue_outgoing; cur->next; cur = cur->next)
-			;
-		cur->next = fr;
-	}
+	aim_tx_append(sess, fr);
 
 	return 0;
 }
 
+static gboolean aim_tx_flush_event(gpointer data, gint fd, b_input_condition cond)
+{
+	aim_session_t *sess = data;
+
+	sess->tx_flush = 0;
+	aim_tx_flushqueue(sess);
+
+	return FALSE;
+}
+
 /*
  * aim_tx_enqueue__immediate()
  *
  * Parallel to aim_tx_enqueue__queuebased, however, this bypasses
  * the whole queue mess when you want immediate writes to happen.
  *
- * Basically the same as its __queuebased couterpart, however
- * instead of doing a list append, it just calls aim_tx_sendframe()
- * right here. 
+ * "Immediate" means as soon as we're back in the main loop: all the
+ * frames created until then (usually all the replies to one incoming
+ * packet) are sent together by aim_tx_flushqueue().
  * 
  */
 static int aim_tx_enqueue__immediate(aim_session_t *sess, aim_frame_t *fr)
@@ -129,9 +149,10 @@ static int aim_tx_enqueue__immediate(aim_session_t *sess, aim_frame_t *fr)
 
 	fr->handled = 0; /* not sent yet */
 
-	aim_tx_sendframe(sess, fr);
+	aim_tx_append(sess, fr);
 
-	aim_frame_destroy(fr);
+	if (!sess->tx_flush)
+		sess->tx_flush = b_timeout_add(0, aim_tx_flush_event, sess);
 
 	return 0;
 }
@@ -187,87 +208,160 @@ flap_seqnum_t aim_get_next_txseqnum(aim_conn_t *conn)
 	return ret;
 }
 
-static int aim_send(int fd, const void *buf, size_t count)
+/*
+ * Write a list of buffers, with as few syscalls as possible. Returns the
+ * number of bytes written. If that's less than everything, errno says
+ * why (EAGAIN if the socket is just full).
+ */
+static int aim_sendv(int fd, struct iovec *iov, int iovcnt)
 {
-	int left, cur;
+	int cur = 0;
 
-	for (cur = 0, left = count; left; ) {
+	while (iovcnt > 0) {
 		int ret;
 
-		ret = send(fd, ((unsigned char *)buf)+cur, left, 0);
-		if (ret == -1)
-			return -1;
-		else if (ret == 0)
+#ifndef _WIN32
+		ret = writev(fd, iov, iovcnt);
+#else
+		ret = send(fd, iov->iov_base, iov->iov_len, 0);
+#endif
+		if (ret == -1 && errno == EINTR)
+			continue;
+		else if (ret == -1)
+			return cur;
+		else if (ret == 0) {
+			errno = EAGAIN;
 			return cur;
+		}
 
 		cur += ret;
-		left -= ret;
+
+		/* Skip what's written completely, and move into the rest. */
+		while (iovcnt > 0 && ret >= (int)iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (guint8 *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
 	}
 
 	return cur;
 }
 
-static int aim_bstream_send(aim_bstream_t *bs, aim_conn_t *conn, size_t count)
+/*
+ * Fill in the FLAP header for fr in hdr (six bytes), and point iov at
+ * the header and the payload. The payload isn't copied. Returns the
+ * number of iovecs used.
+ */
+static int flap_iov(aim_frame_t *fr, guint8 *hdr, struct iovec *iov)
 {
-	int wrote = 0;
-	if (!bs || !conn || (count < 0))
-		return -EINVAL;
+	int payloadlen = aim_bstream_curpos(&fr->data);
 
-	if (count > aim_bstream_empty(bs))
-		count = aim_bstream_empty(bs); /* truncate to remaining space */
+	aimutil_put8(hdr, 0x2a);
+	aimutil_put8(hdr + 1, fr->hdr.flap.type);
+	aimutil_put16(hdr + 2, fr->hdr.flap.seqnum);
+	aimutil_put16(hdr + 4, payloadlen);
 
-	if (count) {
-		if (count - wrote) {
-			wrote = wrote + aim_send(conn->fd, bs->data + bs->offset + wrote, count - wrote);
-		}
-		
-	}
-	
-	bs->offset += wrote;
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = 6;
+
+	if (payloadlen == 0)
+		return 1;
 
-	return wrote;	
+	iov[1].iov_base = fr->data.data;
+	iov[1].iov_len = payloadlen;
+
+	return 2;
 }
 
-static int sendframe_flap(aim_session_t *sess, aim_frame_t *fr)
+static gboolean aim_tx_writable(gpointer data, gint fd, b_input_condition cond)
 {
-	aim_bstream_t obs;
-	guint8 *obs_raw;
-	int payloadlen, err = 0, obslen;
+	aim_conn_t *conn = data;
 
-	payloadlen = aim_bstream_curpos(&fr->data);
+	((aim_conn_inside_t *)conn->inside)->txwatch = 0;
+	aim_tx_flushqueue(conn->sessv);
 
-	if (!(obs_raw = g_malloc(6 + payloadlen)))
-		return -ENOMEM;
+	return FALSE;
+}
 
-	aim_bstream_init(&obs, obs_raw, 6 + payloadlen);
+/*
+ * Send fr and the unsent FLAPs right behind it for the same connection,
+ * in one writev(). Only if that connection isn't being paced with
+ * forcedlatency, which has to be respected frame by frame.
+ *
+ * Whatever the socket doesn't take stays queued (->txoff says how much
+ * of the first frame went out) until the socket is writable again. On
+ * errors, the connection's queue is dropped. Returns the last frame of
+ * the batch.
+ */
+static aim_frame_t *sendbatch_flap(aim_session_t *sess, aim_frame_t *fr)
+{
+	aim_conn_t *conn = fr->conn;
+	aim_frame_t *cur, *batch[AIM_TX_BATCH];
+	guint8 hdr[AIM_TX_BATCH][6];
+	struct iovec iov[AIM_TX_BATCH * 2];
+	int i, n = 0, niov = 0, first = 0, len = 0, st;
+	guint32 skip;
+
+	for (cur = fr; cur && n < AIM_TX_BATCH; cur = cur->next) {
+		if (cur->handled || cur->conn != conn ||
+		    cur->hdrtype != AIM_FRAMETYPE_FLAP ||
+		    (n > 0 && conn->forcedlatency))
+			break;
+
+		niov += flap_iov(cur, hdr[n], iov + niov);
+		len += 6 + aim_bstream_curpos(&cur->data);
+		batch[n++] = cur;
+	}
 
-	/* FLAP header */
-	aimbs_put8(&obs, 0x2a);
-	aimbs_put8(&obs, fr->hdr.flap.type);
-	aimbs_put16(&obs, fr->hdr.flap.seqnum);
-	aimbs_put16(&obs, payloadlen);
+	/* Don't send again what went out last time. */
+	for (skip = fr->txoff; skip >= iov[first].iov_len; first++)
+		skip -= iov[first].iov_len;
+	iov[first].iov_base = (guint8 *)iov[first].iov_base + skip;
+	iov[first].iov_len -= skip;
+	len -= fr->txoff;
 
-	/* payload */
-	aim_bstream_rewind(&fr->data);
-	aimbs_putbs(&obs, &fr->data, payloadlen);
+	st = aim_sendv(conn->fd, iov + first, niov - first);
 
-	obslen = aim_bstream_curpos(&obs);
-	aim_bstream_rewind(&obs);
-	if (aim_bstream_send(&obs, fr->conn, obslen) != obslen)
-		err = -errno;
-	
-	g_free(obs_raw); /* XXX aim_bstream_free */
+	if (st < len && errno != EAGAIN && !sockerr_again()) {
+		imcb_error(sess->aux_data, "Error while sending to the server: %s",
+		           strerror(errno));
+		aim_tx_cleanqueue(sess, conn);
+		return batch[n - 1];
+	}
+
+	if (st > 0)
+		conn->lastactivity = time(NULL);
 
-	fr->handled = 1;
-	fr->conn->lastactivity = time(NULL);
+	/* Mark what went out completely, remember where we are in the rest. */
+	st += fr->txoff;
+	for (i = 0; i < n; i++) {
+		int flen = 6 + aim_bstream_curpos(&batch[i]->data);
 
-	return err;
+		if (st < flen) {
+			batch[i]->txoff = st;
+			break;
+		}
+		st -= flen;
+		batch[i]->handled = 1;
+	}
+
+	if (i < n)
+		((aim_conn_inside_t *)conn->inside)->txwatch =
+			b_input_add(conn->fd, B_EV_IO_WRITE, aim_tx_writable, conn);
+
+	return batch[n - 1];
 }
 
 int aim_tx_sendframe(aim_session_t *sess, aim_frame_t *fr)
 {
-	if (fr->hdrtype == AIM_FRAMETYPE_FLAP)
-		return sendframe_flap(sess, fr);
+	if (fr->hdrtype == AIM_FRAMETYPE_FLAP) {
+		sendbatch_flap(sess, fr);
+		return 0;
+	}
 	return -1;
 }
 
@@ -283,6 +377,16 @@ int aim_tx_flushqueue(aim_session_t *sess)
 		if (cur->conn && (cur->conn->status & AIM_CONN_STATUS_INPROGRESS))
 			continue;
 
+		/* Still waiting for the socket to take the earlier frames. */
+		if (((aim_conn_inside_t *)cur->conn->inside)->txwatch)
+			continue;
+
+		/* Closed already, nowhere to send it anymore. */
+		if (cur->conn->fd == -1) {
+			cur->handled = 1;
+			continue;
+		}
+
 		/*
 		 * And now for the meager attempt to force transmit
 		 * latency and avoid missed messages.
@@ -299,7 +403,13 @@ int aim_tx_flushqueue(aim_session_t *sess)
 		}
 
 		/* XXX this should call the custom "queuing" function!! */
-		aim_tx_sendframe(sess, cur);
+		if (cur->hdrtype != AIM_FRAMETYPE_FLAP) {
+			aim_tx_sendframe(sess, cur);
+			continue;
+		}
+
+		/* Continue after the last frame of this batch. */
+		cur = sendbatch_flap(sess, cur);
 	}
 
 	/* purge sent commands from queue */
@@ -320,6 +430,8 @@ void aim_tx_purgequeue(aim_session_t *sess)
 {
 	aim_frame_t *cur, **prev;
 
+	sess->queue_outgoing_tail = NULL;
+
 	for (prev = &sess->queue_outgoing; (cur = *prev); ) {
 
 		if (cur->handled) {
@@ -327,8 +439,10 @@ void aim_tx_purgequeue(aim_session_t *sess)
 
 			aim_frame_destroy(cur);
 
-		} else
+		} else {
+			sess->queue_outgoing_tail = cur;
 			prev = &cur->next;
+		}
 	}
 
 	return;
@@ -29,7 +29,9 @@
 #include <glib.h>
 #include <purple.h>
 
-GSList *purple_connections;
+/* PurpleAccount -> im_connection, libpurple callbacks only give us the
+   former and they come in a lot (every buddy status update). */
+static GHashTable *purple_connections;
 
 /* This makes me VERY sad... :-( But some libpurple callbacks come in without
    any context so this is the only way to get that. Don't want to support
@@ -40,13 +42,10 @@ static char *set_eval_display_name( set_t *set, char *value );
 
 struct im_connection *purple_ic_by_pa( PurpleAccount *pa )
 {
-	GSList *i;
-	
-	for( i = purple_connections; i; i = i->next )
-		if( ((struct im_connection *)i->data)->proto_data == pa )
-			return i->data;
+	if( purple_connections == NULL || pa == NULL )
+		return NULL;
 	
-	return NULL;
+	return g_hash_table_lookup( purple_connections, pa );
 }
 
 static struct im_connection *purple_ic_by_gc( PurpleConnection *gc )
@@ -288,12 +287,14 @@ static void purple_login( account_t *acc )
 	}
 	local_bee = acc->bee;
 	
+	ic->proto_data = pa = purple_account_new( acc->user, (char*) acc->prpl->data );
+	
 	/* For now this is needed in the _connected() handlers if using
 	   GLib event handling, to make sure we're not handling events
 	   on dead connections. */
-	purple_connections = g_slist_prepend( purple_connections, ic );
-	
-	ic->proto_data = pa = purple_account_new( acc->user, (char*) acc->prpl->data );
+	if( purple_connections == NULL )
+		purple_connections = g_hash_table_new( g_direct_hash, g_direct_equal );
+	g_hash_table_insert( purple_connections, pa, ic );
 	purple_account_set_password( pa, acc->pass );
 	purple_sync_settings( acc, pa );
 	
@@ -305,7 +306,7 @@ static void purple_logout( struct im_connection *ic )
 	PurpleAccount *pa = ic->proto_data;
 	
 	purple_account_set_enabled( pa, "BitlBee", FALSE );
-	purple_connections = g_slist_remove( purple_connections, ic );
+	g_hash_table_remove( purple_connections, pa );
 	purple_accounts_remove( pa );
 }
 
@@ -734,39 +735,85 @@ static PurpleConnectionUiOps bee_conn_uiops =
 	prplcb_conn_report_disconnect_reason,
 };
 
-static void prplcb_blist_update( PurpleBuddyList *list, PurpleBlistNode *node )
+/* libpurple calls the update op several times for one change (and lots of
+   times for one buddy while logging in), so just remember which buddies
+   changed and pass them to the bee layer once, from the next main loop
+   iteration. */
+static GHashTable *prplcb_blist_pending;
+static gint prplcb_blist_pending_id;
+
+static void prplcb_blist_update_buddy( gpointer key, gpointer value, gpointer data )
 {
-	if( node->type == PURPLE_BLIST_BUDDY_NODE )
+	PurpleBuddy *bud = key;
+	struct im_connection **batch_ic = data;
+	PurpleGroup *group = purple_buddy_get_group( bud );
+	struct im_connection *ic = purple_ic_by_pa( bud->account );
+	PurpleStatus *as;
+	int flags = 0;
+	
+	/* Could've logged out in the meantime. */
+	if( ic == NULL )
+		return;
+	
+	if( *batch_ic == NULL )
 	{
-		PurpleBuddy *bud = (PurpleBuddy*) node;
-		PurpleGroup *group = purple_buddy_get_group( bud );
-		struct im_connection *ic = purple_ic_by_pa( bud->account );
-		PurpleStatus *as;
-		int flags = 0;
-		
-		if( ic == NULL )
-			return;
-		
-		if( bud->server_alias )
-			imcb_rename_buddy( ic, bud->name, bud->server_alias );
-		else if( bud->alias )
-			imcb_rename_buddy( ic, bud->name, bud->alias );
-		
-		if( group )
-			imcb_add_buddy( ic, bud->name, purple_group_get_name( group ) );
-		
-		flags |= purple_presence_is_online( bud->presence ) ? OPT_LOGGED_IN : 0;
-		flags |= purple_presence_is_available( bud->presence ) ? 0 : OPT_AWAY;
-		
-		as = purple_presence_get_active_status( bud->presence );
-		
-		imcb_buddy_status( ic, bud->name, flags, purple_status_get_name( as ),
-		                   purple_status_get_attr_string( as, "message" ) );
-		
-		imcb_buddy_times( ic, bud->name,
-		                  purple_presence_get_login_time( bud->presence ),
-		                  purple_presence_get_idle_time( bud->presence ) );
+		*batch_ic = ic;
+		imcb_buddy_status_batch( ic, TRUE );
 	}
+	
+	if( bud->server_alias )
+		imcb_rename_buddy( ic, bud->name, bud->server_alias );
+	else if( bud->alias )
+		imcb_rename_buddy( ic, bud->name, bud->alias );
+	
+	if( group )
+		imcb_add_buddy( ic, bud->name, purple_group_get_name( group ) );
+	
+	flags |= purple_presence_is_online( bud->presence ) ? OPT_LOGGED_IN : 0;
+	flags |= purple_presence_is_available( bud->presence ) ? 0 : OPT_AWAY;
+	
+	as = purple_presence_get_active_status( bud->presence );
+	
+	imcb_buddy_status( ic, bud->name, flags, purple_status_get_name( as ),
+	                   purple_status_get_attr_string( as, "message" ) );
+	
+	imcb_buddy_times( ic, bud->name,
+	                  purple_presence_get_login_time( bud->presence ),
+	                  purple_presence_get_idle_time( bud->presence ) );
+}
+
+static gboolean prplcb_blist_flush( gpointer data, gint fd, b_input_condition cond )
+{
+	GHashTable *pending = prplcb_blist_pending;
+	struct im_connection *batch_ic = NULL;
+	
+	prplcb_blist_pending = NULL;
+	prplcb_blist_pending_id = 0;
+	
+	if( pending == NULL )
+		return FALSE;
+	
+	g_hash_table_foreach( pending, prplcb_blist_update_buddy, &batch_ic );
+	g_hash_table_destroy( pending );
+	
+	if( batch_ic )
+		imcb_buddy_status_batch( batch_ic, FALSE );
+	
+	return FALSE;
+}
+
+static void prplcb_blist_update( PurpleBuddyList *list, PurpleBlistNode *node )
+{
+	if( node->type != PURPLE_BLIST_BUDDY_NODE ||
+	    purple_ic_by_pa( ((PurpleBuddy*) node)->account ) == NULL )
+		return;
+	
+	if( prplcb_blist_pending == NULL )
+		prplcb_blist_pending = g_hash_table_new( g_direct_hash, g_direct_equal );
+	g_hash_table_insert( prplcb_blist_pending, node, node );
+	
+	if( prplcb_blist_pending_id == 0 )
+		prplcb_blist_pending_id = b_timeout_add( 0, prplcb_blist_flush, NULL );
 }
 
 static void prplcb_blist_new( PurpleBlistNode *node )
@@ -787,6 +834,10 @@ static void prplcb_blist_new( PurpleBlistNode *node )
 
 static void prplcb_blist_remove( PurpleBuddyList *list, PurpleBlistNode *node )
 {
+	/* The buddy is about to be freed, don't touch it in the next flush. */
+	if( prplcb_blist_pending )
+		g_hash_table_remove( prplcb_blist_pending, node );
+	
 /*
 	PurpleBuddy *bud = (PurpleBuddy*) node;
 	
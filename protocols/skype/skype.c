@@ -113,6 +113,8 @@ struct skype_data {
 	/* Pending user which has to be added to the next group which is
 	 * created. */
 	char *pending_user;
+	/* Incomplete line received from skyped, see skype_read_callback(). */
+	GString *rbuf;
 };
 
 struct skype_away_state {
@@ -186,6 +188,31 @@ int skype_printf(struct im_connection *ic, char *fmt, ...)
 	return skype_write(ic, str, strlen(str));
 }
 
+/* Send a bunch of commands (one per line) with as few writes as possible.
+ * skyped reads at most IRC_LINE_SIZE bytes at once and doesn't handle lines
+ * split over two reads, so never put more than that in one write. */
+static int skype_write_lines(struct im_connection *ic, GString *cmds)
+{
+	char *s = cmds->str, *end = cmds->str + cmds->len;
+
+	while (s < end) {
+		char *cut = s + MIN(end - s, IRC_LINE_SIZE);
+
+		/* Only split at the end of a line. */
+		if (cut < end)
+			while (cut > s && cut[-1] != '\n')
+				cut--;
+		if (cut == s)
+			cut = s + MIN(end - s, IRC_LINE_SIZE);
+
+		if (!skype_write(ic, s, cut - s))
+			return FALSE;
+		s = cut;
+	}
+
+	return TRUE;
+}
+
 static void skype_buddy_ask_yes(void *data)
 {
 	struct skype_buddy_ask_data *bla = data;
@@ -314,11 +341,17 @@ static struct skype_group *skype_group_by_name(struct im_connection *ic, char *n
 static void skype_parse_users(struct im_connection *ic, char *line)
 {
 	char **i, **nicks;
+	GString *cmds = g_string_new("");
 
+	/* Ask for everybody's status in one go instead of one write (and
+	 * poll()) per contact. */
 	nicks = g_strsplit(line + 6, ", ", 0);
 	for (i = nicks; *i; i++)
-		skype_printf(ic, "GET USER %s ONLINESTATUS\n", *i);
+		g_string_append_printf(cmds, "GET USER %s ONLINESTATUS\n", *i);
 	g_strfreev(nicks);
+
+	skype_write_lines(ic, cmds);
+	g_string_free(cmds, TRUE);
 }
 
 static void skype_parse_user(struct im_connection *ic, char *line)
@@ -1008,28 +1041,36 @@ static void skype_parse_chats(struct im_connection *ic, char *line)
 {
 	char **i;
 	char **chats = g_strsplit(line + 6, ", ", 0);
+	GString *cmds = g_string_new("");
 
 	i = chats;
 	while (*i) {
-		skype_printf(ic, "GET CHAT %s STATUS\n", *i);
-		skype_printf(ic, "GET CHAT %s ACTIVEMEMBERS\n", *i);
+		g_string_append_printf(cmds, "GET CHAT %s STATUS\n", *i);
+		g_string_append_printf(cmds, "GET CHAT %s ACTIVEMEMBERS\n", *i);
 		i++;
 	}
 	g_strfreev(chats);
+
+	skype_write_lines(ic, cmds);
+	g_string_free(cmds, TRUE);
 }
 
 static void skype_parse_groups(struct im_connection *ic, char *line)
 {
 	char **i;
 	char **groups = g_strsplit(line + 7, ", ", 0);
+	GString *cmds = g_string_new("");
 
 	i = groups;
 	while (*i) {
-		skype_printf(ic, "GET GROUP %s DISPLAYNAME\n", *i);
-		skype_printf(ic, "GET GROUP %s USERS\n", *i);
+		g_string_append_printf(cmds, "GET GROUP %s DISPLAYNAME\n", *i);
+		g_string_append_printf(cmds, "GET GROUP %s USERS\n", *i);
 		i++;
 	}
 	g_strfreev(groups);
+
+	skype_write_lines(ic, cmds);
+	g_string_free(cmds, TRUE);
 }
 
 static void skype_parse_alter_group(struct im_connection *ic, char *line)
@@ -1063,32 +1104,66 @@ static void skype_parse_alter_group(struct im_connection *ic, char *line)
 
 typedef void (*skype_parser)(struct im_connection *ic, char *line);
 
+struct skype_parser_entry {
+	char *k;
+	skype_parser v;
+};
+
+static const struct skype_parser_entry skype_parsers[] = {
+	{ "USERS ", skype_parse_users },
+	{ "USER ", skype_parse_user },
+	{ "CHATMESSAGE ", skype_parse_chatmessage },
+	{ "CALL ", skype_parse_call },
+	{ "FILETRANSFER ", skype_parse_filetransfer },
+	{ "CHAT ", skype_parse_chat },
+	{ "GROUP ", skype_parse_group },
+	{ "PASSWORD ", skype_parse_password },
+	{ "PROFILE PSTN_BALANCE ", skype_parse_profile },
+	{ "PING", skype_parse_ping },
+	{ "CHATS ", skype_parse_chats },
+	{ "GROUPS ", skype_parse_groups },
+	{ "ALTER GROUP ", skype_parse_alter_group },
+};
+
+/* Find the parser for a line by its first word instead of trying all the
+ * prefixes one by one. The table is built on first use. */
+static void skype_parse_line(struct im_connection *ic, char *line)
+{
+	static GHashTable *parsers;
+	const struct skype_parser_entry *p;
+	char *s;
+	int i;
+
+	if (!parsers) {
+		parsers = g_hash_table_new(g_str_hash, g_str_equal);
+		for (i = 0; i < ARRAY_SIZE(skype_parsers); i++) {
+			char *k = g_strdup(skype_parsers[i].k);
+			if ((s = strchr(k, ' ')))
+				*s = '\0';
+			g_hash_table_insert(parsers, k,
+				(gpointer) &skype_parsers[i]);
+		}
+	}
+
+	if ((s = strchr(line, ' ')))
+		*s = '\0';
+	p = g_hash_table_lookup(parsers, line);
+	if (s)
+		*s = ' ';
+
+	/* Only the first word is checked so far. */
+	if (p && !strncmp(line, p->k, strlen(p->k)))
+		p->v(ic, line);
+}
+
 static gboolean skype_read_callback(gpointer data, gint fd,
 				    b_input_condition cond)
 {
 	struct im_connection *ic = data;
 	struct skype_data *sd = ic->proto_data;
 	char buf[IRC_LINE_SIZE];
-	int st, i;
-	char **lines, **lineptr, *line;
-	static struct parse_map {
-		char *k;
-		skype_parser v;
-	} parsers[] = {
-		{ "USERS ", skype_parse_users },
-		{ "USER ", skype_parse_user },
-		{ "CHATMESSAGE ", skype_parse_chatmessage },
-		{ "CALL ", skype_parse_call },
-		{ "FILETRANSFER ", skype_parse_filetransfer },
-		{ "CHAT ", skype_parse_chat },
-		{ "GROUP ", skype_parse_group },
-		{ "PASSWORD ", skype_parse_password },
-		{ "PROFILE PSTN_BALANCE ", skype_parse_profile },
-		{ "PING", skype_parse_ping },
-		{ "CHATS ", skype_parse_chats },
-		{ "GROUPS ", skype_parse_groups },
-		{ "ALTER GROUP ", skype_parse_alter_group },
-	};
+	int st;
+	char *lines, *line, *end;
 
 	/* Unused parameters */
 	fd = fd;
@@ -1099,24 +1174,26 @@ static gboolean skype_read_callback(gpointer data, gint fd,
 	/* Read the whole data. */
 	st = ssl_read(sd->ssl, buf, sizeof(buf));
 	if (st > 0) {
-		buf[st] = '\0';
-		/* Then split it up to lines. */
-		lines = g_strsplit(buf, "\n", 0);
-		lineptr = lines;
-		while ((line = *lineptr)) {
-			if (!strlen(line))
-				break;
+		/* Lines may be split over more than one read, so keep any
+		 * incomplete line around until the rest comes in. */
+		if (!sd->rbuf)
+			sd->rbuf = g_string_sized_new(sizeof(buf));
+		g_string_append_len(sd->rbuf, buf, st);
+		if (!(end = strrchr(sd->rbuf->str, '\n')))
+			return TRUE;
+		lines = g_strndup(sd->rbuf->str, end - sd->rbuf->str);
+		g_string_erase(sd->rbuf, 0, end - sd->rbuf->str + 1);
+
+		for (line = lines; line; line = end) {
+			if ((end = strchr(line, '\n')))
+				*end++ = '\0';
+			if (!*line)
+				continue;
 			if (set_getbool(&ic->acc->set, "skypeconsole_receive"))
 				imcb_buddy_msg(ic, "skypeconsole", line, 0, 0);
-			for (i = 0; i < ARRAY_SIZE(parsers); i++)
-				if (!strncmp(line, parsers[i].k,
-					strlen(parsers[i].k))) {
-					parsers[i].v(ic, line);
-					break;
-				}
-			lineptr++;
+			skype_parse_line(ic, line);
 		}
-		g_strfreev(lines);
+		g_free(lines);
 	} else if (st == 0 || (st < 0 && !sockerr_again())) {
 		closesocket(sd->fd);
 		sd->fd = -1;
@@ -1210,6 +1287,8 @@ static void skype_logout(struct im_connection *ic)
 	}
 	g_free(sd->username);
 	g_free(sd->handle);
+	if (sd->rbuf)
+		g_string_free(sd->rbuf, TRUE);
 	g_free(sd);
 	ic->proto_data = NULL;
 }
@@ -45,13 +45,19 @@ GSList *twitter_connections = NULL;
 gboolean twitter_main_loop(gpointer data, gint fd, b_input_condition cond)
 {
 	struct im_connection *ic = data;
+	struct twitter_data *td;
 
 	// Check if we are still logged in...
 	if (!g_slist_find(twitter_connections, ic))
 		return 0;
 
-	// Do stuff..
-	twitter_get_timeline(ic, -1);
+	td = ic->proto_data;
+
+	// Do stuff.. Unless the stream is still open, it gives us everything.
+	if (td->stream == NULL) {
+		twitter_get_timeline(ic, -1);
+		twitter_open_stream(ic);
+	}
 
 	// If we are still logged in run this function again after timeout.
 	return (ic->flags & OPT_LOGGED_IN) == OPT_LOGGED_IN;
@@ -245,6 +251,9 @@ static void twitter_init(account_t * acc)
 	s->flags |= ACC_SET_OFFLINE_ONLY;
 
 	s = set_add(&acc->set, "show_old_mentions", "true", set_eval_bool, acc);
+
+	s = set_add(&acc->set, "stream_url", NULL, NULL, acc);
+	s->flags |= ACC_SET_OFFLINE_ONLY;
 }
 
 /**
@@ -329,6 +338,9 @@ static void twitter_logout(struct im_connection *ic)
 		imcb_chat_free(td->timeline_gc);
 
 	if (td) {
+		if (td->stream)
+			http_close(td->stream);
+		twitter_cache_free(td);
 		oauth_info_free(td->oauth_info);
 		g_free(td->user);
 		g_free(td->prefix);
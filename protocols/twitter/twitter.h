@@ -56,6 +56,9 @@ struct twitter_data
 	
 	guint64 last_status_id; /* For undo */
 	gint main_loop_id;
+	struct http_request *stream; /* Set while stream_url is open. */
+	int stream_fails; /* Stream attempts that failed in a row. */
+	int stream_wait; /* Polls to go before trying the stream again. */
 	struct groupchat *timeline_gc;
 	gint http_fails;
 	twitter_flags_t flags;
@@ -71,6 +74,10 @@ struct twitter_data
 	/* set show_ids */
 	struct twitter_log_data *log;
 	int log_id;
+
+	GHashTable *users; /* id -> struct twitter_xml_user */
+	GHashTable *seen; /* Status ids shown already, LRU ordered in seen_order. */
+	GQueue *seen_order;
 };
 
 struct twitter_user_data
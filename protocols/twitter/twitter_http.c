@@ -43,11 +43,12 @@
 static char *twitter_url_append(char *url, char *key, char *value);
 
 /**
- * Do a request.
- * This is actually pretty generic function... Perhaps it should move to the lib/http_client.c
+ * Do a request. path is what goes into the request line, full_url is used
+ * for OAuth signing.
  */
-void *twitter_http(struct im_connection *ic, char *url_string, http_input_function func,
-		   gpointer data, int is_post, char **arguments, int arguments_len)
+static void *twitter_http_do(struct im_connection *ic, char *host, int port, int ssl,
+			     const char *path, const char *full_url, http_input_function func,
+			     gpointer data, int is_post, char **arguments, int arguments_len)
 {
 	struct twitter_data *td = ic->proto_data;
 	char *tmp;
@@ -67,25 +68,21 @@ void *twitter_http(struct im_connection *ic, char *url_string, http_input_functi
 		}
 	}
 	// Make the request.
-	g_string_printf(request, "%s %s%s%s%s HTTP/1.0\r\n"
+	g_string_printf(request, "%s %s%s%s HTTP/1.1\r\n"
 			"Host: %s\r\n"
 			"User-Agent: BitlBee " BITLBEE_VERSION " " ARCH "/" CPU "\r\n",
-			is_post ? "POST" : "GET",
-			td->url_path, url_string,
-			is_post ? "" : "?", is_post ? "" : url_arguments, td->url_host);
+			is_post ? "POST" : "GET", path,
+			is_post ? "" : "?", is_post ? "" : url_arguments, host);
 
 	// If a pass and user are given we append them to the request.
 	if (td->oauth_info) {
 		char *full_header;
-		char *full_url;
 
-		full_url = g_strconcat(set_getstr(&ic->acc->set, "base_url"), url_string, NULL);
 		full_header = oauth_http_header(td->oauth_info, is_post ? "POST" : "GET",
 						full_url, url_arguments);
 
 		g_string_append_printf(request, "Authorization: %s\r\n", full_header);
 		g_free(full_header);
-		g_free(full_url);
 	} else {
 		char userpass[strlen(ic->acc->user) + 2 + strlen(ic->acc->pass)];
 		char *userpass_base64;
@@ -108,13 +105,58 @@ void *twitter_http(struct im_connection *ic, char *url_string, http_input_functi
 		g_string_append(request, "\r\n");
 	}
 
-	ret = http_dorequest(td->url_host, td->url_port, td->url_ssl, request->str, func, data);
+	ret = http_dorequest(host, port, ssl, request->str, func, data);
 
 	g_free(url_arguments);
 	g_string_free(request, TRUE);
 	return ret;
 }
 
+/**
+ * Do a request to the API at base_url.
+ */
+void *twitter_http(struct im_connection *ic, char *url_string, http_input_function func,
+		   gpointer data, int is_post, char **arguments, int arguments_len)
+{
+	struct twitter_data *td = ic->proto_data;
+	char *path, *full_url;
+	void *ret;
+
+	path = g_strconcat(td->url_path, url_string, NULL);
+	full_url = g_strconcat(set_getstr(&ic->acc->set, "base_url"), url_string, NULL);
+
+	ret = twitter_http_do(ic, td->url_host, td->url_port, td->url_ssl, path, full_url,
+			      func, data, is_post, arguments, arguments_len);
+
+	g_free(path);
+	g_free(full_url);
+	return ret;
+}
+
+/**
+ * Open a streaming GET request to a full URL (the streaming API lives on a
+ * different host). func gets called every time more data comes in, see
+ * http_flush_bytes().
+ */
+struct http_request *twitter_http_stream(struct im_connection *ic, char *url_string,
+					 http_input_function func, gpointer data,
+					 char **arguments, int arguments_len)
+{
+	struct http_request *req;
+	url_t url;
+
+	if (!url_set(&url, url_string) ||
+	    (url.proto != PROTO_HTTP && url.proto != PROTO_HTTPS))
+		return NULL;
+
+	req = twitter_http_do(ic, url.host, url.port, url.proto == PROTO_HTTPS, url.file,
+			      url_string, func, data, 0, arguments, arguments_len);
+	if (req)
+		req->flags |= HTTPC_STREAMING;
+
+	return req;
+}
+
 static char *twitter_url_append(char *url, char *key, char *value)
 {
 	char *key_encoded = g_strndup(key, 3 * strlen(key));
@@ -57,11 +57,6 @@ struct twitter_xml_list {
 	GSList *list;
 };
 
-struct twitter_xml_user {
-	char *name;
-	char *screen_name;
-};
-
 struct twitter_xml_status {
 	time_t created_at;
 	char *text;
@@ -72,11 +67,12 @@ struct twitter_xml_status {
 static void twitter_groupchat_init(struct im_connection *ic);
 
 /**
- * Frees a twitter_xml_user struct.
+ * Drops a reference to a twitter_xml_user struct, frees it if that was the
+ * last one.
  */
-static void txu_free(struct twitter_xml_user *txu)
+static void txu_unref(struct twitter_xml_user *txu)
 {
-	if (txu == NULL)
+	if (txu == NULL || --txu->ref > 0)
 		return;
 
 	g_free(txu->name);
@@ -93,7 +89,7 @@ static void txs_free(struct twitter_xml_status *txs)
 		return;
 
 	g_free(txs->text);
-	txu_free(txs->user);
+	txu_unref(txs->user);
 	g_free(txs);
 }
 
@@ -113,7 +109,7 @@ static void txl_free(struct twitter_xml_list *txl)
 		} else if (txl->type == TXL_ID) {
 			g_free(l->data);
 		} else if (txl->type == TXL_USER) {
-			txu_free(l->data);
+			txu_unref(l->data);
 		}
 	}
 
@@ -122,7 +118,8 @@ static void txl_free(struct twitter_xml_list *txl)
 }
 
 /**
- * Compare status elements
+ * Compare status elements. Ties are broken by id so that a status that is
+ * in both the home timeline and mentions ends up twice in a row.
  */
 static gint twitter_compare_elements(gconstpointer a, gconstpointer b)
 {
@@ -133,6 +130,10 @@ static gint twitter_compare_elements(gconstpointer a, gconstpointer b)
 		return -1;
 	} else if (a_status->created_at > b_status->created_at) {
 		return 1;
+	} else if (a_status->id < b_status->id) {
+		return -1;
+	} else if (a_status->id > b_status->id) {
+		return 1;
 	} else {
 		return 0;
 	}
@@ -140,26 +141,30 @@ static gint twitter_compare_elements(gconstpointer a, gconstpointer b)
 
 /**
  * Add a buddy if it is not already added, set the status to logged in.
+ * Returns the buddy.
  */
-static void twitter_add_buddy(struct im_connection *ic, char *name, const char *fullname)
+static bee_user_t *twitter_add_buddy(struct im_connection *ic, char *name, const char *fullname)
 {
 	struct twitter_data *td = ic->proto_data;
+	char *mode = set_getstr(&ic->acc->set, "mode");
+	bee_user_t *bu;
 
 	// Check if the buddy is already in the buddy list.
-	if (!bee_user_by_handle(ic->bee, ic, name)) {
-		char *mode = set_getstr(&ic->acc->set, "mode");
-
-		// The buddy is not in the list, add the buddy and set the status to logged in.
-		imcb_add_buddy(ic, name, NULL);
-		imcb_rename_buddy(ic, name, fullname);
-		if (g_strcasecmp(mode, "chat") == 0) {
-			/* Necessary so that nicks always get translated to the
-			   exact Twitter username. */
-			imcb_buddy_nick_hint(ic, name, name);
-			imcb_chat_add_buddy(td->timeline_gc, name);
-		} else if (g_strcasecmp(mode, "many") == 0)
-			imcb_buddy_status(ic, name, OPT_LOGGED_IN, NULL, NULL);
-	}
+	if ((bu = bee_user_by_handle(ic->bee, ic, name)))
+		return bu;
+
+	// The buddy is not in the list, add the buddy and set the status to logged in.
+	imcb_add_buddy(ic, name, NULL);
+	imcb_rename_buddy(ic, name, fullname);
+	if (g_strcasecmp(mode, "chat") == 0) {
+		/* Necessary so that nicks always get translated to the
+		   exact Twitter username. */
+		imcb_buddy_nick_hint(ic, name, name);
+		imcb_chat_add_buddy(td->timeline_gc, name);
+	} else if (g_strcasecmp(mode, "many") == 0)
+		imcb_buddy_status(ic, name, OPT_LOGGED_IN, NULL, NULL);
+
+	return bee_user_by_handle(ic->bee, ic, name);
 }
 
 /* Warning: May return a malloc()ed value, which will be free()d on the next
@@ -309,7 +314,8 @@ static void twitter_http_get_friends_ids(struct http_request *req)
 	txl_free(txl);
 }
 
-static xt_status twitter_xt_get_users(struct xt_node *node, struct twitter_xml_list *txl);
+static xt_status twitter_xt_get_users(struct twitter_data *td, struct xt_node *node,
+				      struct twitter_xml_list *txl);
 static void twitter_http_get_users_lookup(struct http_request *req);
 
 static void twitter_get_users_lookup(struct im_connection *ic)
@@ -380,7 +386,7 @@ static void twitter_http_get_users_lookup(struct http_request *req)
 	xt_feed(parser, req->reply_body, req->body_size);
 
 	// Get the user list from the parsed xml feed.
-	twitter_xt_get_users(parser->root, txl);
+	twitter_xt_get_users(td, parser->root, txl);
 	xt_free(parser);
 
 	// Add the users as buddies.
@@ -395,25 +401,148 @@ static void twitter_http_get_users_lookup(struct http_request *req)
 	twitter_get_users_lookup(ic);
 }
 
+static guint twitter_id_hash(gconstpointer key)
+{
+	guint64 id = *(const guint64 *) key;
+
+	return (guint) (id ^ (id >> 32));
+}
+
+static gboolean twitter_id_equal(gconstpointer a, gconstpointer b)
+{
+	return *(const guint64 *) a == *(const guint64 *) b;
+}
+
+static gboolean twitter_user_unused(gpointer key, gpointer value, gpointer data)
+{
+	struct twitter_xml_user *txu = value;
+
+	if (txu->ref > 1 && !data)
+		return FALSE;
+
+	txu_unref(txu);
+	return TRUE;
+}
+
+static void twitter_user_set(char **s, struct xt_node *node)
+{
+	// Usually it didn't change since the last time.
+	if (node->text && *s && strcmp(*s, node->text) == 0)
+		return;
+
+	g_free(*s);
+	*s = g_memdup(node->text, node->text_len + 1);
+}
+
 /**
- * Function to fill a twitter_xml_user struct.
- * It sets:
- *  - the name and
- *  - the screen_name.
+ * Get the twitter_xml_user struct for a <user>, with a new reference.
+ * Users are kept in a table by id and shared by all their statuses, so
+ * every poll doesn't have to allocate the same people again. Whenever the
+ * table gets bigger than TWITTER_USERS_MAX, users without any status
+ * referring to them are dropped.
  */
-static xt_status twitter_xt_get_user(struct xt_node *node, struct twitter_xml_user *txu)
+struct twitter_xml_user *twitter_xt_get_user(struct twitter_data *td, struct xt_node *node)
 {
+	struct twitter_xml_user *txu = NULL;
 	struct xt_node *child;
+	guint64 id = 0;
+
+	if ((child = xt_find_node(node->children, "id")) && child->text)
+		id = g_ascii_strtoull(child->text, NULL, 10);
+
+	if (id && td->users)
+		txu = g_hash_table_lookup(td->users, &id);
+
+	if (txu == NULL) {
+		txu = g_new0(struct twitter_xml_user, 1);
+		txu->id = id;
+
+		if (id) {
+			if (td->users == NULL)
+				td->users = g_hash_table_new(twitter_id_hash, twitter_id_equal);
+			else if (g_hash_table_size(td->users) >= TWITTER_USERS_MAX)
+				g_hash_table_foreach_remove(td->users, twitter_user_unused, NULL);
+
+			// The table has a reference of its own.
+			g_hash_table_insert(td->users, &txu->id, txu);
+			txu->ref++;
+		}
+	}
+	txu->ref++;
 
 	// Walk over the nodes children.
 	for (child = node->children; child; child = child->next) {
 		if (g_strcasecmp("name", child->name) == 0) {
-			txu->name = g_memdup(child->text, child->text_len + 1);
+			twitter_user_set(&txu->name, child);
 		} else if (g_strcasecmp("screen_name", child->name) == 0) {
-			txu->screen_name = g_memdup(child->text, child->text_len + 1);
+			twitter_user_set(&txu->screen_name, child);
 		}
 	}
-	return XT_HANDLED;
+
+	return txu;
+}
+
+/**
+ * Check whether a status was shown already, and remember it if add is set.
+ * Only the TWITTER_SEEN_MAX most recently seen ids are kept.
+ */
+gboolean twitter_seen(struct twitter_data *td, guint64 id, gboolean add)
+{
+	GList *link;
+	guint64 *key;
+
+	if (td->seen == NULL) {
+		if (!add)
+			return FALSE;
+		td->seen = g_hash_table_new(twitter_id_hash, twitter_id_equal);
+		td->seen_order = g_queue_new();
+	}
+
+	if ((link = g_hash_table_lookup(td->seen, &id))) {
+		// Move it to the front.
+		g_queue_unlink(td->seen_order, link);
+		g_queue_push_head_link(td->seen_order, link);
+		return TRUE;
+	}
+
+	if (!add)
+		return FALSE;
+
+	if (td->seen_order->length >= TWITTER_SEEN_MAX) {
+		key = g_queue_pop_tail(td->seen_order);
+		g_hash_table_remove(td->seen, key);
+		g_free(key);
+	}
+
+	key = g_new(guint64, 1);
+	*key = id;
+	g_queue_push_head(td->seen_order, key);
+	g_hash_table_insert(td->seen, key, td->seen_order->head);
+
+	return FALSE;
+}
+
+/**
+ * Free the user table and seen statuses.
+ */
+void twitter_cache_free(struct twitter_data *td)
+{
+	if (td->users) {
+		g_hash_table_foreach_remove(td->users, twitter_user_unused, td);
+		g_hash_table_destroy(td->users);
+		td->users = NULL;
+	}
+
+	if (td->seen) {
+		GList *l;
+
+		for (l = td->seen_order->head; l; l = l->next)
+			g_free(l->data);
+		g_queue_free(td->seen_order);
+		g_hash_table_destroy(td->seen);
+		td->seen = NULL;
+		td->seen_order = NULL;
+	}
 }
 
 /**
@@ -421,7 +550,8 @@ static xt_status twitter_xt_get_user(struct xt_node *node, struct twitter_xml_us
  * It sets:
  *  - all <user>s from the <users> element.
  */
-static xt_status twitter_xt_get_users(struct xt_node *node, struct twitter_xml_list *txl)
+static xt_status twitter_xt_get_users(struct twitter_data *td, struct xt_node *node,
+				      struct twitter_xml_list *txl)
 {
 	struct twitter_xml_user *txu;
 	struct xt_node *child;
@@ -433,8 +563,7 @@ static xt_status twitter_xt_get_users(struct xt_node *node, struct twitter_xml_l
 	// Walk over the nodes children.
 	for (child = node->children; child; child = child->next) {
 		if (g_strcasecmp("user", child->name) == 0) {
-			txu = g_new0(struct twitter_xml_user, 1);
-			twitter_xt_get_user(child, txu);
+			txu = twitter_xt_get_user(td, child);
 			// Put the item in the front of the list.
 			txl->list = g_slist_prepend(txl->list, txu);
 		}
@@ -457,7 +586,8 @@ static xt_status twitter_xt_get_users(struct xt_node *node, struct twitter_xml_l
  *  - the status id and
  *  - the user in a twitter_xml_user struct.
  */
-static xt_status twitter_xt_get_status(struct xt_node *node, struct twitter_xml_status *txs)
+static xt_status twitter_xt_get_status(struct twitter_data *td, struct xt_node *node,
+					struct twitter_xml_status *txs)
 {
 	struct xt_node *child, *rt = NULL;
 
@@ -476,8 +606,8 @@ static xt_status twitter_xt_get_status(struct xt_node *node, struct twitter_xml_
 			if (strptime(child->text, TWITTER_TIME_FORMAT, &parsed) != NULL)
 				txs->created_at = mktime_utc(&parsed);
 		} else if (g_strcasecmp("user", child->name) == 0) {
-			txs->user = g_new0(struct twitter_xml_user, 1);
-			twitter_xt_get_user(child, txs->user);
+			txu_unref(txs->user);
+			txs->user = twitter_xt_get_user(td, child);
 		} else if (g_strcasecmp("id", child->name) == 0) {
 			txs->id = g_ascii_strtoull(child->text, NULL, 10);
 		} else if (g_strcasecmp("in_reply_to_status_id", child->name) == 0) {
@@ -489,7 +619,7 @@ static xt_status twitter_xt_get_status(struct xt_node *node, struct twitter_xml_
 	   wasn't truncated because it may be lying. */
 	if (rt) {
 		struct twitter_xml_status *rtxs = g_new0(struct twitter_xml_status, 1);
-		if (twitter_xt_get_status(rt, rtxs) != XT_HANDLED) {
+		if (twitter_xt_get_status(td, rt, rtxs) != XT_HANDLED) {
 			txs_free(rtxs);
 			return XT_HANDLED;
 		}
@@ -532,9 +662,9 @@ static xt_status twitter_xt_get_status(struct xt_node *node, struct twitter_xml_
 static xt_status twitter_xt_get_status_list(struct im_connection *ic, struct xt_node *node,
 					    struct twitter_xml_list *txl)
 {
+	struct twitter_data *td = ic->proto_data;
 	struct twitter_xml_status *txs;
-	struct xt_node *child;
-	bee_user_t *bu;
+	struct xt_node *child, *id;
 
 	// Set the type of the list.
 	txl->type = TXL_STATUS;
@@ -543,20 +673,15 @@ static xt_status twitter_xt_get_status_list(struct im_connection *ic, struct xt_
 	// Walk over the nodes children.
 	for (child = node->children; child; child = child->next) {
 		if (g_strcasecmp("status", child->name) == 0) {
+			// Don't bother with statuses that were shown already.
+			if ((id = xt_find_node(child->children, "id")) && id->text &&
+			    twitter_seen(td, g_ascii_strtoull(id->text, NULL, 10), FALSE))
+				continue;
+
 			txs = g_new0(struct twitter_xml_status, 1);
-			twitter_xt_get_status(child, txs);
+			twitter_xt_get_status(td, child, txs);
 			// Put the item in the front of the list.
 			txl->list = g_slist_prepend(txl->list, txs);
-
-			if (txs->user && txs->user->screen_name &&
-			    (bu = bee_user_by_handle(ic->bee, ic, txs->user->screen_name))) {
-				struct twitter_user_data *tud = bu->data;
-
-				if (txs->id > tud->last_id) {
-					tud->last_id = txs->id;
-					tud->last_time = txs->created_at;
-				}
-			}
 		} else if (g_strcasecmp("next_cursor", child->name) == 0) {
 			twitter_xt_next_cursor(child, txl);
 		}
@@ -565,8 +690,35 @@ static xt_status twitter_xt_get_status_list(struct im_connection *ic, struct xt_
 	return XT_HANDLED;
 }
 
-static char *twitter_msg_add_id(struct im_connection *ic,
-				struct twitter_xml_status *txs, const char *prefix)
+/**
+ * Get the buddy who posted txs (adding them first if add is set) and
+ * remember it as the newest status from them. Call this only once per
+ * status, bee_user_by_handle() isn't cheap with lots of contacts.
+ */
+static bee_user_t *twitter_status_user(struct im_connection *ic,
+				       struct twitter_xml_status *txs, gboolean add)
+{
+	bee_user_t *bu;
+
+	if (add)
+		bu = twitter_add_buddy(ic, txs->user->screen_name, txs->user->name);
+	else
+		bu = bee_user_by_handle(ic->bee, ic, txs->user->screen_name);
+
+	if (bu) {
+		struct twitter_user_data *tud = bu->data;
+
+		if (txs->id > tud->last_id) {
+			tud->last_id = txs->id;
+			tud->last_time = txs->created_at;
+		}
+	}
+
+	return bu;
+}
+
+static char *twitter_msg_add_id(struct im_connection *ic, struct twitter_xml_status *txs,
+				bee_user_t *bu, const char *prefix)
 {
 	struct twitter_data *td = ic->proto_data;
 	char *ret = NULL;
@@ -579,7 +731,7 @@ static char *twitter_msg_add_id(struct im_connection *ic,
 	}
 
 	td->log[td->log_id].id = txs->id;
-	td->log[td->log_id].bu = bee_user_by_handle(ic->bee, ic, txs->user->screen_name);
+	td->log[td->log_id].bu = bu;
 	if (txs->reply_to) {
 		int i;
 		for (i = 0; i < TWITTER_LOG_LENGTH; i++)
@@ -625,7 +777,6 @@ static void twitter_groupchat(struct im_connection *ic, GSList * list)
 	GSList *l = NULL;
 	struct twitter_xml_status *status;
 	struct groupchat *gc;
-	guint64 last_id = 0;
 
 	// Create a new groupchat if it does not exsist.
 	if (!td->timeline_gc)
@@ -636,24 +787,25 @@ static void twitter_groupchat(struct im_connection *ic, GSList * list)
 		imcb_chat_add_buddy(gc, ic->acc->user);
 
 	for (l = list; l; l = g_slist_next(l)) {
+		gboolean me;
+		bee_user_t *bu;
 		char *msg;
 
 		status = l->data;
-		if (status->user == NULL || status->text == NULL || last_id == status->id)
+		if (status->user == NULL || status->text == NULL ||
+		    twitter_seen(td, status->id, TRUE))
 			continue;
 
-		last_id = status->id;
-
 		strip_html(status->text);
 
-		msg = twitter_msg_add_id(ic, status, "");
+		me = g_strcasecmp(td->user, status->user->screen_name) == 0;
+		bu = twitter_status_user(ic, status, !me);
+		msg = twitter_msg_add_id(ic, status, bu, "");
 
 		// Say it!
-		if (g_strcasecmp(td->user, status->user->screen_name) == 0) {
+		if (me) {
 			imcb_chat_log(gc, "You: %s", msg ? msg : status->text);
 		} else {
-			twitter_add_buddy(ic, status->user->screen_name, status->user->name);
-
 			imcb_chat_msg(gc, status->user->screen_name,
 				      msg ? msg : status->text, 0, status->created_at);
 		}
@@ -676,7 +828,6 @@ static void twitter_private_message_chat(struct im_connection *ic, GSList * list
 	struct twitter_xml_status *status;
 	char from[MAX_STRING];
 	gboolean mode_one;
-	guint64 last_id = 0;
 
 	mode_one = g_strcasecmp(set_getstr(&ic->acc->set, "mode"), "one") == 0;
 
@@ -687,21 +838,20 @@ static void twitter_private_message_chat(struct im_connection *ic, GSList * list
 
 	for (l = list; l; l = g_slist_next(l)) {
 		char *prefix = NULL, *text = NULL;
+		bee_user_t *bu;
 
 		status = l->data;
-		if (status->user == NULL || status->text == NULL || last_id == status->id)
+		if (status->user == NULL || status->text == NULL ||
+		    twitter_seen(td, status->id, TRUE))
 			continue;
 
-		last_id = status->id;
-
 		strip_html(status->text);
 		if (mode_one)
 			prefix = g_strdup_printf("\002<\002%s\002>\002 ",
 						 status->user->screen_name);
-		else
-			twitter_add_buddy(ic, status->user->screen_name, status->user->name);
 
-		text = twitter_msg_add_id(ic, status, prefix ? prefix : "");
+		bu = twitter_status_user(ic, status, !mode_one);
+		text = twitter_msg_add_id(ic, status, bu, prefix ? prefix : "");
 
 		imcb_buddy_msg(ic,
 			       mode_one ? from : status->user->screen_name,
@@ -716,8 +866,21 @@ static void twitter_private_message_chat(struct im_connection *ic, GSList * list
 	}
 }
 
+/**
+ * Show a (sorted) list of statuses in the way the user wants to see them.
+ */
+static void twitter_show_statuses(struct im_connection *ic, GSList *list)
+{
+	// See if the user wants to see the messages in a groupchat window or as private messages.
+	if (g_strcasecmp(set_getstr(&ic->acc->set, "mode"), "chat") == 0)
+		twitter_groupchat(ic, list);
+	else
+		twitter_private_message_chat(ic, list);
+}
+
 static void twitter_http_get_home_timeline(struct http_request *req);
 static void twitter_http_get_mentions(struct http_request *req);
+static void twitter_http_get_stream(struct http_request *req);
 
 /**
  * Get the timeline with optionally mentions
@@ -753,6 +916,7 @@ void twitter_flush_timeline(struct im_connection *ic)
 	struct twitter_xml_list *mentions = td->mentions_obj;
 	GSList *output = NULL;
 	GSList *l;
+	struct twitter_xml_status *oldest = NULL;
 
 	if (!(td->flags & TWITTER_GOT_TIMELINE)) {
 		return;
@@ -762,27 +926,28 @@ void twitter_flush_timeline(struct im_connection *ic)
 		return;
 	}
 
+	/* Collect both lists and sort them in one go (g_slist_sort() is a
+	   merge sort) instead of inserting everything one by one. */
 	if (home_timeline && home_timeline->list) {
 		for (l = home_timeline->list; l; l = g_slist_next(l)) {
-			output = g_slist_insert_sorted(output, l->data, twitter_compare_elements);
+			if (!oldest || twitter_compare_elements(l->data, oldest) < 0)
+				oldest = l->data;
+			output = g_slist_prepend(output, l->data);
 		}
 	}
 
 	if (include_mentions && mentions && mentions->list) {
 		for (l = mentions->list; l; l = g_slist_next(l)) {
-			if (!show_old_mentions && output && twitter_compare_elements(l->data, output->data) < 0) {
+			if (!show_old_mentions && oldest && twitter_compare_elements(l->data, oldest) < 0) {
 				continue;
 			}
 
-			output = g_slist_insert_sorted(output, l->data, twitter_compare_elements);
+			output = g_slist_prepend(output, l->data);
 		}
 	}
 
-	// See if the user wants to see the messages in a groupchat window or as private messages.
-	if (g_strcasecmp(set_getstr(&ic->acc->set, "mode"), "chat") == 0)
-		twitter_groupchat(ic, output);
-	else
-		twitter_private_message_chat(ic, output);
+	output = g_slist_sort(output, twitter_compare_elements);
+	twitter_show_statuses(ic, output);
 
 	g_slist_free(output);
 
@@ -969,6 +1134,171 @@ static void twitter_http_get_mentions(struct http_request *req)
 	twitter_flush_timeline(ic);
 }
 
+/**
+ * Find the next message in a stream read with delimited=length: every
+ * message is preceded by a line with its length in bytes, and empty lines
+ * are sent as keep-alives. Returns the number of bytes that can be flushed,
+ * 0 if more data is needed or -1 if the stream doesn't look like that.
+ * *msg_len is 0 if only a keep-alive was found.
+ */
+int twitter_stream_next(const char *buf, int len, int *msg_start, int *msg_len)
+{
+	const char *eol;
+	int i, n = 0;
+
+	*msg_start = *msg_len = 0;
+
+	if ((eol = memchr(buf, '\n', len)) == NULL)
+		return len > 16 ? -1 : 0;
+
+	for (i = 0; buf + i < eol && isdigit(buf[i]); i++) {
+		n = n * 10 + buf[i] - '0';
+		if (n > TWITTER_STREAM_MAX_MSG)
+			return -1;
+	}
+	if (buf + i < eol && !(buf[i] == '\r' && buf + i + 1 == eol))
+		return -1;
+
+	/* Keep-alive. */
+	if (i == 0)
+		return eol + 1 - buf;
+
+	if (eol + 1 - buf + n > len)
+		return 0;
+
+	*msg_start = eol + 1 - buf;
+	*msg_len = n;
+	return *msg_start + n;
+}
+
+/**
+ * Handle one message from the stream. Only statuses are interesting, the
+ * stream also has deletes, friends lists, etc.
+ */
+static void twitter_stream_handle(struct im_connection *ic, const char *msg, int len)
+{
+	struct twitter_data *td = ic->proto_data;
+	struct xt_parser *parser;
+	struct twitter_xml_status *txs;
+
+	parser = xt_new(NULL, NULL);
+	xt_feed(parser, msg, len);
+
+	if (parser->root && g_strcasecmp(parser->root->name, "status") == 0) {
+		txs = g_new0(struct twitter_xml_status, 1);
+		twitter_xt_get_status(td, parser->root, txs);
+
+		/* Could've come in through polling already. */
+		if (txs->id > td->timeline_id) {
+			GSList *list = g_slist_prepend(NULL, txs);
+			twitter_show_statuses(ic, list);
+			g_slist_free(list);
+		}
+
+		txs_free(txs);
+	}
+
+	xt_free(parser);
+}
+
+/**
+ * The stream failed. Say why, but only the first time in a row, and skip
+ * twice as many polls as last time (up to TWITTER_STREAM_MAX_WAIT) before
+ * trying it again.
+ */
+static void twitter_stream_fail(struct im_connection *ic, const char *fmt, ...)
+{
+	struct twitter_data *td = ic->proto_data;
+	va_list params;
+	char *msg;
+
+	if (td->stream_fails == 0) {
+		va_start(params, fmt);
+		msg = g_strdup_vprintf(fmt, params);
+		va_end(params);
+		imcb_log(ic, "%s, polling instead", msg);
+		g_free(msg);
+	}
+
+	// Skip 0, 1, 3, 7, ... polls. (The shift is capped so it can't overflow.)
+	td->stream_wait = MIN(1 << MIN(td->stream_fails, 16), TWITTER_STREAM_MAX_WAIT) - 1;
+	td->stream_fails++;
+}
+
+/**
+ * Open a connection to stream_url (if set) which stays open to pass on new
+ * statuses as soon as they're posted. Polling stops while it's open.
+ */
+void twitter_open_stream(struct im_connection *ic)
+{
+	struct twitter_data *td = ic->proto_data;
+	char *url = set_getstr(&ic->acc->set, "stream_url");
+	char *args[2] = { "delimited", "length" };
+
+	if (td->stream || url == NULL || *url == '\0')
+		return;
+
+	if (td->stream_wait > 0) {
+		td->stream_wait--;
+		return;
+	}
+
+	td->stream = twitter_http_stream(ic, url, twitter_http_get_stream, ic, args, 2);
+	if (td->stream == NULL)
+		twitter_stream_fail(ic, "Could not open stream %s", url);
+}
+
+/**
+ * Callback for the stream, gets called every time more data comes in.
+ */
+static void twitter_http_get_stream(struct http_request *req)
+{
+	struct im_connection *ic = req->data;
+	struct twitter_data *td;
+	int st, start, len, done = 0;
+
+	// Check if the connection is still active.
+	if (!g_slist_find(twitter_connections, ic)) {
+		if (!(req->flags & HTTPC_EOF))
+			http_close(req);
+		return;
+	}
+
+	td = ic->proto_data;
+
+	if (req->status_code != 200) {
+		twitter_stream_fail(ic, "Stream failed: %s", twitter_parse_error(req));
+		goto end;
+	}
+
+	while ((st = twitter_stream_next(req->reply_body + done, req->body_size - done,
+					 &start, &len)) > 0) {
+		if (len > 0)
+			twitter_stream_handle(ic, req->reply_body + done + start, len);
+		done += st;
+	}
+	http_flush_bytes(req, done);
+
+	// It works (again), so the next failure is news.
+	if (done > 0)
+		td->stream_fails = td->stream_wait = 0;
+
+	if (st < 0) {
+		twitter_stream_fail(ic, "Stream garbled");
+		goto end;
+	}
+
+	if (!(req->flags & HTTPC_EOF))
+		return;
+
+	twitter_stream_fail(ic, "Stream closed");
+
+      end:
+	if (!(req->flags & HTTPC_EOF))
+		http_close(req);
+	td->stream = NULL;
+}
+
 /**
  * Callback to use after sending a POST request to twitter.
  * (Generic, used for a few kinds of queries.)
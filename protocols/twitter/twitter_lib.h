@@ -26,6 +26,8 @@
 #define _TWITTER_LIB_H
 
 #include "nogaim.h"
+#include "xmltree.h"
+#include "twitter.h"
 #include "twitter_http.h"
 
 #define TWITTER_API_URL "http://api.twitter.com/1"
@@ -75,11 +77,35 @@
 #define TWITTER_BLOCKS_CREATE_URL "/blocks/create/"
 #define TWITTER_BLOCKS_DESTROY_URL "/blocks/destroy/"
 
+/* Users are shared by all their statuses, see twitter_xt_get_user(). */
+struct twitter_xml_user {
+	guint64 id;
+	int ref;
+	char *name;
+	char *screen_name;
+};
+
+/* When there are more users than this, drop the ones not in use. */
+#define TWITTER_USERS_MAX 5000
+/* Remember this many ids of shown statuses to avoid showing them twice. */
+#define TWITTER_SEEN_MAX 1000
+
+/* Messages from the stream longer than this are considered garbage. */
+#define TWITTER_STREAM_MAX_MSG 1048576
+/* After the stream failed, wait at most this many polls to retry it. */
+#define TWITTER_STREAM_MAX_WAIT 32
+
 void twitter_get_timeline(struct im_connection *ic, gint64 next_cursor);
 void twitter_get_friends_ids(struct im_connection *ic, gint64 next_cursor);
 void twitter_get_home_timeline(struct im_connection *ic, gint64 next_cursor);
 void twitter_get_mentions(struct im_connection *ic, gint64 next_cursor);
 void twitter_get_statuses_friends(struct im_connection *ic, gint64 next_cursor);
+void twitter_open_stream(struct im_connection *ic);
+int twitter_stream_next(const char *buf, int len, int *msg_start, int *msg_len);
+
+struct twitter_xml_user *twitter_xt_get_user(struct twitter_data *td, struct xt_node *node);
+gboolean twitter_seen(struct twitter_data *td, guint64 id, gboolean add);
+void twitter_cache_free(struct twitter_data *td);
 
 void twitter_post_status(struct im_connection *ic, char *msg, guint64 in_reply_to);
 void twitter_direct_messages_new(struct im_connection *ic, char *who, char *message);
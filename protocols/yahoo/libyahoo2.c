@@ -177,6 +177,7 @@ struct yahoo_packet {
 	unsigned int status;
 	unsigned int id;
 	YList *hash;
+	YList *hash_tail;	/* Last pair, so appending doesn't walk the list. */
 };
 
 struct yahoo_search_state {
@@ -335,54 +336,63 @@ static void yahoo_free_server_settings(struct yahoo_server_settings *yss)
 	free(yss);
 }
 
-static YList *conns = NULL;
-static YList *inputs = NULL;
+/* All connections by client id, and all inputs (as a set, to check if one
+   is still alive). Every connection also has a list of its own inputs, so
+   finding one never involves connections of other users. */
+static GHashTable *conns = NULL;
+static GHashTable *inputs = NULL;
 static int last_id = 0;
 
 static void add_to_list(struct yahoo_data *yd)
 {
-	conns = y_list_prepend(conns, yd);
+	if (!conns)
+		conns = g_hash_table_new(g_direct_hash, g_direct_equal);
+	g_hash_table_insert(conns, GINT_TO_POINTER(yd->client_id), yd);
 }
 
 static struct yahoo_data *find_conn_by_id(int id)
 {
-	YList *l;
-	for (l = conns; l; l = y_list_next(l)) {
-		struct yahoo_data *yd = l->data;
-		if (yd->client_id == id)
-			return yd;
-	}
-	return NULL;
+	if (!conns)
+		return NULL;
+	return g_hash_table_lookup(conns, GINT_TO_POINTER(id));
 }
 
 static void del_from_list(struct yahoo_data *yd)
 {
-	conns = y_list_remove(conns, yd);
+	if (conns)
+		g_hash_table_remove(conns, GINT_TO_POINTER(yd->client_id));
 }
 
-/* call repeatedly to get the next one */
-/*
-static struct yahoo_input_data * find_input_by_id(int id)
+static void add_input(struct yahoo_input_data *yid)
 {
-	YList *l;
-	for(l = inputs; l; l = y_list_next(l)) {
-		struct yahoo_input_data *yid = l->data;
-		if(yid->yd->client_id == id)
-			return yid;
-	}
-	return NULL;
+	if (!inputs)
+		inputs = g_hash_table_new(g_direct_hash, g_direct_equal);
+	g_hash_table_insert(inputs, yid, yid);
+	yid->yd->inputs = y_list_prepend(yid->yd->inputs, yid);
+}
+
+static void del_input(struct yahoo_input_data *yid)
+{
+	if (inputs)
+		g_hash_table_remove(inputs, yid);
+	yid->yd->inputs = y_list_remove(yid->yd->inputs, yid);
+}
+
+static int input_exists(struct yahoo_input_data *yid)
+{
+	return inputs && g_hash_table_lookup(inputs, yid) != NULL;
 }
-*/
 
 static struct yahoo_input_data *find_input_by_id_and_webcam_user(int id,
 	const char *who)
 {
+	struct yahoo_data *yd = find_conn_by_id(id);
 	YList *l;
 	LOG(("find_input_by_id_and_webcam_user"));
-	for (l = inputs; l; l = y_list_next(l)) {
+	for (l = yd ? yd->inputs : NULL; l; l = y_list_next(l)) {
 		struct yahoo_input_data *yid = l->data;
 		if (yid->type == YAHOO_CONNECTION_WEBCAM
-			&& yid->yd->client_id == id && yid->wcm && ((who
+			&& yid->wcm && ((who
 					&& yid->wcm->user
 					&& !strcmp(who, yid->wcm->user))
 				|| !(yid->wcm->user && !who)))
@@ -394,11 +404,12 @@ static struct yahoo_input_data *find_input_by_id_and_webcam_user(int id,
 static struct yahoo_input_data *find_input_by_id_and_type(int id,
 	enum yahoo_connection_type type)
 {
+	struct yahoo_data *yd = find_conn_by_id(id);
 	YList *l;
 	LOG(("find_input_by_id_and_type"));
-	for (l = inputs; l; l = y_list_next(l)) {
+	for (l = yd ? yd->inputs : NULL; l; l = y_list_next(l)) {
 		struct yahoo_input_data *yid = l->data;
-		if (yid->type == type && yid->yd->client_id == id)
+		if (yid->type == type)
 			return yid;
 	}
 	return NULL;
@@ -406,11 +417,12 @@ static struct yahoo_input_data *find_input_by_id_and_type(int id,
 
 static struct yahoo_input_data *find_input_by_id_and_fd(int id, void *fd)
 {
+	struct yahoo_data *yd = find_conn_by_id(id);
 	YList *l;
 	LOG(("find_input_by_id_and_fd"));
-	for (l = inputs; l; l = y_list_next(l)) {
+	for (l = yd ? yd->inputs : NULL; l; l = y_list_next(l)) {
 		struct yahoo_input_data *yid = l->data;
-		if (yid->fd == fd && yid->yd->client_id == id)
+		if (yid->fd == fd)
 			return yid;
 	}
 	return NULL;
@@ -418,15 +430,9 @@ static struct yahoo_input_data *find_input_by_id_and_fd(int id, void *fd)
 
 static int count_inputs_with_id(int id)
 {
-	int c = 0;
-	YList *l;
-	LOG(("counting %d", id));
-	for (l = inputs; l; l = y_list_next(l)) {
-		struct yahoo_input_data *yid = l->data;
-		if (yid->yd->client_id == id)
-			c++;
-	}
-	LOG(("%d", c));
+	struct yahoo_data *yd = find_conn_by_id(id);
+	int c = yd ? y_list_length(yd->inputs) : 0;
+	LOG(("counting %d: %d", id, c));
 	return c;
 }
 
@@ -521,13 +527,27 @@ static struct yahoo_packet *yahoo_packet_new(enum yahoo_service service,
 	return pkt;
 }
 
+static void yahoo_packet_append(struct yahoo_packet *pkt,
+	struct yahoo_pair *pair)
+{
+	YList *l = y_list_prepend(NULL, pair);
+
+	if (pkt->hash_tail) {
+		pkt->hash_tail->next = l;
+		l->prev = pkt->hash_tail;
+	} else {
+		pkt->hash = l;
+	}
+	pkt->hash_tail = l;
+}
+
 static void yahoo_packet_hash(struct yahoo_packet *pkt, int key,
 	const char *value)
 {
 	struct yahoo_pair *pair = y_new0(struct yahoo_pair, 1);
 	pair->key = key;
 	pair->value = strdup(value);
-	pkt->hash = y_list_append(pkt->hash, pair);
+	yahoo_packet_append(pkt, pair);
 }
 
 static int yahoo_packet_length(struct yahoo_packet *pkt)
@@ -620,7 +640,7 @@ static void yahoo_packet_read(struct yahoo_packet *pkt, unsigned char *data,
 		if (accept) {
 			pair->value = strdup(value);
 			FREE(value);
-			pkt->hash = y_list_append(pkt->hash, pair);
+			yahoo_packet_append(pkt, pair);
 			DEBUG_MSG(("Key: %d  \tValue: %s", pair->key,
 					pair->value));
 		} else {
@@ -797,7 +817,7 @@ void yahoo_close(int id)
 
 static void yahoo_input_close(struct yahoo_input_data *yid)
 {
-	inputs = y_list_remove(inputs, yid);
+	del_input(yid);
 
 	LOG(("yahoo_input_close(read)"));
 	YAHOO_CALLBACK(ext_yahoo_remove_handler) (yid->yd->client_id,
@@ -1720,7 +1740,7 @@ void yahoo_login(int id, int initial)
 	struct yahoo_input_data *yid = y_new0(struct yahoo_input_data, 1);
 	yid->yd = yd;
 	yid->type = YAHOO_CONNECTION_PAGER;
-	inputs = y_list_prepend(inputs, yid);
+	add_input(yid);
 
 	yd->initial_status = initial;
 	yss = yd->server_settings;
@@ -1836,7 +1856,7 @@ static void yahoo_https_auth_token_finish(struct http_request *req)
 	struct yahoo_data *yd;
 	int st;
 	
-	if (y_list_find(inputs, had->yid) == NULL)
+	if (!input_exists(had->yid))
 		return;
 	
 	yid = had->yid;
@@ -1887,7 +1907,7 @@ static void yahoo_https_auth_finish(struct http_request *req)
 	char *crumb = NULL;
 	int st;
 	
-	if (y_list_find(inputs, had->yid) == NULL)
+	if (!input_exists(had->yid))
 		return;
 	
 	yid = had->yid;
@@ -2364,7 +2384,7 @@ static void _yahoo_webcam_get_server_connected(void *fd, int error, void *d)
 	}
 
 	yid->fd = fd;
-	inputs = y_list_prepend(inputs, yid);
+	add_input(yid);
 
 	/* send initial packet */
 	if (who)
@@ -3267,7 +3287,7 @@ static void _yahoo_webcam_connected(void *fd, int error, void *d)
 	}
 
 	yid->fd = fd;
-	inputs = y_list_prepend(inputs, yid);
+	add_input(yid);
 
 	LOG(("Connected"));
 	/* send initial packet */
@@ -3746,7 +3766,7 @@ static void _yahoo_http_connected(int id, void *fd, int error, void *data)
 {
 	struct yahoo_input_data *yid = data;
 	if (fd == NULL || error) {
-		inputs = y_list_remove(inputs, yid);
+		del_input(yid);
 		FREE(yid);
 		return;
 	}
@@ -3780,7 +3800,7 @@ void yahoo_get_yab(int id)
 
 	snprintf(buff, sizeof(buff), "Y=%s; T=%s", yd->cookie_y, yd->cookie_t);
 
-	inputs = y_list_prepend(inputs, yid);
+	add_input(yid);
 
 	yahoo_http_get(yid->yd->client_id, url, buff, 0, 0,
 		_yahoo_http_connected, yid);
@@ -3798,7 +3818,7 @@ static void _yahoo_http_post_connected(int id, void *fd, int error, void *data)
 	char *buff = yad->data;
 
 	if (!fd) {
-		inputs = y_list_remove(inputs, yid);
+		del_input(yid);
 		FREE(yid);
 		return;
 	}
@@ -3853,7 +3873,7 @@ void yahoo_set_yab(int id, struct yab *yab)
 
 	snprintf(buff, sizeof(buff), "Y=%s; T=%s", yd->cookie_y, yd->cookie_t);
 
-	inputs = y_list_prepend(inputs, yid);
+	add_input(yid);
 
 	yahoo_http_post(yid->yd->client_id, url, buff, size,
 		_yahoo_http_post_connected, yad);
@@ -4314,7 +4334,7 @@ void yahoo_get_chatrooms(int id, int chatroomid)
 
 	snprintf(buff, sizeof(buff), "Y=%s; T=%s", yd->cookie_y, yd->cookie_t);
 
-	inputs = y_list_prepend(inputs, yid);
+	add_input(yid);
 
 	yahoo_http_get(yid->yd->client_id, url, buff, 0, 0,
 		_yahoo_http_connected, yid);
@@ -4674,7 +4694,7 @@ static void yahoo_search_internal(int id, int t, const char *text, int g,
 
 	snprintf(buff, sizeof(buff), "Y=%s; T=%s", yd->cookie_y, yd->cookie_t);
 
-	inputs = y_list_prepend(inputs, yid);
+	add_input(yid);
 	yahoo_http_get(yid->yd->client_id, url, buff, 0, 0,
 		_yahoo_http_connected, yid);
 }
@@ -4847,7 +4867,7 @@ static void _yahoo_ft_upload_connected(int id, void *fd, int error, void *data)
 	struct yahoo_input_data *yid = sfd->yid;
 
 	if (!fd) {
-		inputs = y_list_remove(inputs, yid);
+		del_input(yid);
 		FREE(yid);
 		return;
 	}
@@ -4872,7 +4892,7 @@ static void yahoo_file_transfer_upload(struct yahoo_data *yd,
 	yid->yd = yd;
 	yid->type = YAHOO_CONNECTION_FT;
 
-	inputs = y_list_prepend(inputs, yid);
+	add_input(yid);
 	sfd->yid = yid;
 	sfd->state = FT_STATE_SEND;
 
@@ -4906,7 +4926,7 @@ static void yahoo_init_ft_recv(struct yahoo_data *yd,
 	yid->yd = yd;
 	yid->type = YAHOO_CONNECTION_FT;
 
-	inputs = y_list_prepend(inputs, yid);
+	add_input(yid);
 	sfd->yid = yid;
 	sfd->state = FT_STATE_HEAD;
 
@@ -5279,7 +5299,7 @@ static void yahoo_process_ft_connection(struct yahoo_input_data *yid, int over)
 		yid_ft->yd = yid->yd;
 		yid_ft->type = YAHOO_CONNECTION_FT;
         
-		inputs = y_list_prepend(inputs, yid_ft);
+		add_input(yid_ft);
 		sfd->yid = yid_ft;
 		sfd->state = FT_STATE_RECV;
 
@@ -302,6 +302,8 @@ extern "C" {
 		void *server_settings;
 
 		struct yahoo_process_status_entry *half_user;
+
+		YList *inputs;	/* Open connections (struct yahoo_input_data). */
 	};
 
 	struct yab {
@@ -1360,6 +1360,55 @@ static void cmd_nick( irc_t *irc, char **cmd )
 	irc_rootmsg( irc, "This command is deprecated. Try: account %s set display_name", cmd[1] );
 }
 
+static void cmd_profile( irc_t *irc, char **cmd )
+{
+	GSList *lines, *l;
+	
+	if( !strchr( irc->umode, 'o' ) )
+	{
+		irc_rootmsg( irc, "This command is only available to operators" );
+		return;
+	}
+	
+	if( cmd[1] && g_strcasecmp( cmd[1], "on" ) == 0 )
+	{
+		b_event_profile_enable( TRUE );
+		irc_rootmsg( irc, "Event loop profiling enabled" );
+		return;
+	}
+	else if( cmd[1] && g_strcasecmp( cmd[1], "off" ) == 0 )
+	{
+		b_event_profile_enable( FALSE );
+		irc_rootmsg( irc, "Event loop profiling disabled" );
+		return;
+	}
+	else if( cmd[1] && g_strcasecmp( cmd[1], "reset" ) == 0 )
+	{
+		b_event_profile_reset();
+		irc_rootmsg( irc, "Event loop profile cleared" );
+		return;
+	}
+	else if( cmd[1] )
+	{
+		irc_rootmsg( irc, "Unknown command: %s %s. Please use \x02help commands\x02 to get a list of available commands.", "profile", cmd[1] );
+		return;
+	}
+	
+	lines = b_event_profile_report( 10 );
+	for( l = lines; l; l = l->next )
+	{
+		irc_rootmsg( irc, "%s", (char*) l->data );
+		g_free( l->data );
+	}
+	g_slist_free( lines );
+	
+	irc_rootmsg( irc, "IRC lines in/out: %llu/%llu without charset conversion, %llu/%llu through iconv",
+	             (unsigned long long) irc_charset_stats.in_fast,
+	             (unsigned long long) irc_charset_stats.out_fast,
+	             (unsigned long long) irc_charset_stats.in_iconv,
+	             (unsigned long long) irc_charset_stats.out_iconv );
+}
+
 /* Maybe this should be a stand-alone command as well? */
 static void bitlbee_whatsnew( irc_t *irc )
 {
@@ -1400,6 +1449,7 @@ command_t root_commands[] = {
 	{ "info",           1, cmd_info,           0 },
 	{ "nick",           1, cmd_nick,           0 },
 	{ "no",             0, cmd_yesno,          0 },
+	{ "profile",        0, cmd_profile,        0 },
 	{ "qlist",          0, cmd_qlist,          0 },
 	{ "register",       0, cmd_register,       0 },
 	{ "remove",         1, cmd_remove,         0 },
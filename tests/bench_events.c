@@ -0,0 +1,205 @@
+/* Micro-benchmark for the event loop backends (lib/events_*.c).
+
+   Build it for every backend and compare the numbers:
+     ./configure --events=glib && make && make -C tests bench
+     ./configure --events=libevent && ...
+     ./configure --events=epoll && ...
+
+   The tests mimic what BitlBee does a lot: irc_vawrite() adding and
+   removing a write watch for every line, timers that get added and
+   removed before they fire, removing IDs that are gone already, and
+   going through the loop with many idle connections around. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <glib.h>
+#include "bitlbee.h"
+
+#if defined( EVENTS_LIBEVENT )
+#define BACKEND "libevent"
+#elif defined( EVENTS_EPOLL )
+#define BACKEND "epoll"
+#else
+#define BACKEND "glib"
+#endif
+
+/* Only the event loop is used, but the rest of BitlBee is linked in. */
+global_t global;
+
+/* irc.c wants this, it lives in unix.c normally. */
+double gettime()
+{
+	struct timeval time[1];
+
+	gettimeofday( time, 0 );
+	return( (double) time->tv_sec + (double) time->tv_usec / 1000000 );
+}
+
+static gint64 bench_now()
+{
+	struct timeval tv;
+
+	gettimeofday( &tv, NULL );
+	return (gint64) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void bench_report( const char *name, int n, gint64 start )
+{
+	gint64 took = bench_now() - start;
+
+	printf( "%-10s %-28s %10d ops %10.1f ns/op\n", BACKEND, name, n,
+	        took * 1000.0 / n );
+}
+
+static gboolean bench_nop( gpointer data, gint fd, b_input_condition cond )
+{
+	return TRUE;
+}
+
+/* irc_vawrite(): one write watch added and removed per line, with the
+   read watch for the same fd in place. */
+static void bench_write_churn( int n )
+{
+	int sv[2], i;
+	gint rd;
+	gint64 start;
+
+	if( socketpair( AF_UNIX, SOCK_STREAM, 0, sv ) != 0 )
+		return;
+
+	rd = b_input_add( sv[0], B_EV_IO_READ, bench_nop, NULL );
+
+	start = bench_now();
+	for( i = 0; i < n; i ++ )
+		b_event_remove( b_input_add( sv[0], B_EV_IO_WRITE, bench_nop, NULL ) );
+	bench_report( "write watch add/remove", n, start );
+
+	b_event_remove( rd );
+	closesocket( sv[0] );
+	closesocket( sv[1] );
+}
+
+/* Timeouts (pings, keepalives) that are removed before they fire, with a
+   few thousand others pending. */
+static void bench_timer_churn( int n )
+{
+	gint pending[4096];
+	gint64 start;
+	int i;
+
+	for( i = 0; i < 4096; i ++ )
+		pending[i] = b_timeout_add( 60000 + i * 10, bench_nop, NULL );
+
+	start = bench_now();
+	for( i = 0; i < n; i ++ )
+		b_event_remove( b_timeout_add( ( i % 2 ) ? 50 : 30000 + i % 1000, bench_nop, NULL ) );
+	bench_report( "timeout add/remove", n, start );
+
+	for( i = 0; i < 4096; i ++ )
+		b_event_remove( pending[i] );
+}
+
+/* BitlBee removes lots of IDs that are gone already. */
+static void bench_stale_remove( int n )
+{
+	gint id = b_timeout_add( 1000, bench_nop, NULL );
+	gint64 start;
+	int i;
+
+	b_event_remove( id );
+
+	start = bench_now();
+	for( i = 0; i < n; i ++ )
+		b_event_remove( id );
+	bench_report( "stale remove", n, start );
+}
+
+/* Bounce a byte between two sockets through the main loop, with idle
+   connections registered as well. */
+struct bench_pingpong
+{
+	int fd[2];
+	int left;
+};
+
+static gboolean bench_pong( gpointer data, gint fd, b_input_condition cond )
+{
+	struct bench_pingpong *bp = data;
+	char c;
+
+	if( read( fd, &c, 1 ) != 1 || -- bp->left <= 0 )
+	{
+		b_main_quit();
+		return FALSE;
+	}
+
+	if( write( fd, &c, 1 ) != 1 )
+		b_main_quit();
+
+	return TRUE;
+}
+
+static void bench_loop( int n, int idle )
+{
+	struct bench_pingpong bp;
+	int *idle_fds = g_new0( int, idle * 2 );
+	gint *idle_ids = g_new0( gint, idle );
+	gint ids[2];
+	gint64 start;
+	char name[64];
+	int i;
+
+	for( i = 0; i < idle; i ++ )
+	{
+		if( socketpair( AF_UNIX, SOCK_STREAM, 0, idle_fds + i * 2 ) != 0 )
+		{
+			idle = i;
+			break;
+		}
+		idle_ids[i] = b_input_add( idle_fds[i*2], B_EV_IO_READ, bench_nop, NULL );
+	}
+
+	if( socketpair( AF_UNIX, SOCK_STREAM, 0, bp.fd ) != 0 )
+		return;
+	bp.left = n;
+	ids[0] = b_input_add( bp.fd[0], B_EV_IO_READ, bench_pong, &bp );
+	ids[1] = b_input_add( bp.fd[1], B_EV_IO_READ, bench_pong, &bp );
+
+	start = bench_now();
+	if( write( bp.fd[0], "x", 1 ) == 1 )
+		b_main_run();
+	g_snprintf( name, sizeof( name ), "loop, %d idle fds", idle );
+	bench_report( name, n - bp.left, start );
+
+	b_event_remove( ids[0] );
+	b_event_remove( ids[1] );
+	closesocket( bp.fd[0] );
+	closesocket( bp.fd[1] );
+	for( i = 0; i < idle; i ++ )
+	{
+		b_event_remove( idle_ids[i] );
+		closesocket( idle_fds[i*2] );
+		closesocket( idle_fds[i*2+1] );
+	}
+	g_free( idle_ids );
+	g_free( idle_fds );
+}
+
+int main( int argc, char *argv[] )
+{
+	int n = argc > 1 ? atoi( argv[1] ) : 1000000;
+
+	b_main_init();
+
+	bench_write_churn( n );
+	bench_timer_churn( n );
+	bench_stale_remove( n );
+	bench_loop( n / 10, 0 );
+	bench_loop( n / 10, 400 );
+
+	return 0;
+}
@@ -0,0 +1,161 @@
+/* Micro-benchmark for incoming messages: strip_html() on its own, and
+   the whole path from imcb_buddy_msg() through bee_irc_user_msg() to the
+   IRC send buffer.
+
+     make && make -C tests bench_msg && tests/bench_msg [rounds]
+
+   The corpus looks like what the HTML-speaking protocols (OSCAR, MSN)
+   send: font tags around short lines, links with escaped query strings,
+   lots of entities, long pastes with <br>s that need word wrapping, and
+   some plain text for comparison. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <glib.h>
+#include "bitlbee.h"
+
+global_t global;
+
+/* irc.c wants this, it lives in unix.c normally. */
+double gettime()
+{
+	struct timeval time[1];
+
+	gettimeofday( time, 0 );
+	return( (double) time->tv_sec + (double) time->tv_usec / 1000000 );
+}
+
+static const char *corpus[] =
+{
+	"<HTML><BODY BGCOLOR=\"#ffffff\"><FONT LANG=\"0\" FACE=\"Arial\" SIZE=2>hey, are you coming tonight? &lt;3</FONT></BODY></HTML>",
+	"<HTML><BODY><FONT COLOR=\"#000080\"><B>ok</B></FONT></BODY></HTML>",
+	"check <a href=\"http://www.example.com/some/long/path?id=12345&amp;ref=chat&amp;lang=en\">this</a> out, it&apos;s &quot;great&quot;",
+	"<font face=\"Tahoma\" size=\"2\">&gt; did you see the &lt;b&gt; tags?<br>&gt; yes &amp; no<br>hmm&nbsp;&nbsp;well</font>",
+	"just plain text without any markup at all, which is what most messages look like on most networks",
+	NULL, /* long paste, filled in below */
+	NULL
+};
+
+static gint64 bench_now()
+{
+	struct timeval tv;
+
+	gettimeofday( &tv, NULL );
+	return (gint64) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void bench_report( const char *name, int n, gsize bytes, gint64 took )
+{
+	printf( "%-30s %10d msgs %10.1f ns/msg %8.1f MB/s\n", name, n,
+	        took * 1000.0 / n, took ? bytes / (double) took : 0 );
+}
+
+static void bench_corpus_init()
+{
+	GString *paste = g_string_new( "<HTML><BODY><FONT FACE=\"Courier New\">" );
+	int i;
+
+	for( i = 0; i < 40; i ++ )
+		g_string_append_printf( paste, "line %d of the log: user&lt;%d&gt; said &quot;foo &amp; bar&quot;<br>", i, i );
+	g_string_append( paste, "</FONT></BODY></HTML>" );
+
+	for( i = 0; corpus[i]; i ++ );
+	corpus[i] = g_string_free( paste, FALSE );
+}
+
+static gsize bench_corpus_size()
+{
+	gsize n = 0;
+	int i;
+
+	for( i = 0; corpus[i]; i ++ )
+		n += strlen( corpus[i] );
+
+	return n;
+}
+
+static void bench_strip_html( int rounds )
+{
+	char *copies[G_N_ELEMENTS( corpus )];
+	gint64 start, took = 0;
+	int i, r, n = 0;
+
+	for( r = 0; r < rounds; r ++ )
+	{
+		/* strip_html() works in place, so it needs fresh copies every
+		   round. Those aren't part of what's measured. */
+		for( i = 0; corpus[i]; i ++ )
+			copies[i] = g_strdup( corpus[i] );
+
+		start = bench_now();
+		for( i = 0; corpus[i]; i ++ )
+			strip_html( copies[i] );
+		took += bench_now() - start;
+
+		for( i = 0; corpus[i]; i ++ )
+			g_free( copies[i] );
+		n += i;
+	}
+
+	bench_report( "strip_html()", n, bench_corpus_size() * rounds, took );
+}
+
+/* Same corpus through the IM -> IRC path, with a real irc_t, account and
+   contact. The send buffer is emptied after every message instead of
+   being written to the socket, so only the formatting is measured. */
+static void bench_user_msg( int rounds )
+{
+	struct prpl prpl;
+	struct im_connection *ic;
+	account_t *acc;
+	irc_t *irc;
+	gint64 start;
+	int sv[2], i, r, n = 0;
+
+	if( socketpair( AF_UNIX, SOCK_STREAM, 0, sv ) != 0 )
+		return;
+
+	irc = irc_new( sv[0] );
+	irc->user->nick = g_strdup( "bench" );
+
+	memset( &prpl, 0, sizeof( prpl ) );
+	prpl.name = "bench";
+	prpl.handle_cmp = g_strcasecmp;
+	acc = account_add( irc->b, &prpl, "me", "secret" );
+	ic = imcb_new( acc );
+	ic->flags |= OPT_LOGGED_IN | OPT_DOES_HTML;
+	bee_user_new( irc->b, ic, "buddy", 0 );
+	g_string_truncate( irc->sendbuffer, 0 );
+
+	start = bench_now();
+	for( r = 0; r < rounds; r ++ )
+		for( i = 0; corpus[i]; i ++ )
+		{
+			imcb_buddy_msg( ic, "buddy", (char*) corpus[i], 0, 0 );
+			g_string_truncate( irc->sendbuffer, 0 );
+			n ++;
+		}
+	bench_report( "imcb_buddy_msg()", n, bench_corpus_size() * rounds, bench_now() - start );
+
+	closesocket( sv[1] );
+}
+
+int main( int argc, char *argv[] )
+{
+	int rounds = argc > 1 ? atoi( argv[1] ) : 100000;
+
+	log_init();
+	b_main_init();
+	global.conf = conf_load( 0, NULL );
+	global.conf->runmode = RUNMODE_DAEMON;
+
+	bench_corpus_init();
+	bench_strip_html( rounds );
+	bench_user_msg( rounds );
+
+	return 0;
+}
@@ -0,0 +1,171 @@
+/* Time-to-key for many OTR key generations requested at once, see
+   otr_keygen(). Only built with OTR support built in:
+     ./configure --otr=1 && make && make -C tests bench_otr
+     ./bench_otr [keys [users [workers]]]
+
+   The keys are spread over a number of users (IRC connections in this
+   process) like in daemon mode, so this also shows whether the users with
+   few accounts have to wait for the ones with many. workers sets
+   OTRKeygenWorkers, 0 is one per CPU core. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <glib.h>
+#include "bitlbee.h"
+#include "otr.h"
+
+global_t global;
+
+/* irc.c wants this, it lives in unix.c normally. */
+double gettime()
+{
+	struct timeval time[1];
+
+	gettimeofday( time, 0 );
+	return( (double) time->tv_sec + (double) time->tv_usec / 1000000 );
+}
+
+struct bench_key
+{
+	irc_t *irc;
+	char *account;
+	gint64 done;    /* usec after the start, 0 while pending, -1 failed. */
+};
+
+static struct bench_key *keys;
+static int nkeys;
+static gint64 start;
+
+static gint64 bench_now()
+{
+	struct timeval tv;
+
+	gettimeofday( &tv, NULL );
+	return (gint64) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* Throw away whatever root says to the "clients". */
+static gboolean bench_drain( gpointer data, gint fd, b_input_condition cond )
+{
+	char buf[1024];
+
+	return read( fd, buf, sizeof( buf ) ) > 0;
+}
+
+static gboolean bench_check( gpointer data, gint fd, b_input_condition cond )
+{
+	int i, pending = 0;
+
+	for( i = 0; i < nkeys; i ++ )
+	{
+		struct bench_key *k = keys + i;
+
+		if( k->done != 0 )
+			continue;
+
+		if( otrl_privkey_find( k->irc->otr->us, k->account, "jabber" ) )
+			k->done = bench_now() - start;
+		else if( !keygen_in_progress( k->irc, k->account, "jabber" ) )
+			k->done = -1;
+		else
+			pending ++;
+	}
+
+	if( pending == 0 )
+	{
+		b_main_quit();
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+int main( int argc, char *argv[] )
+{
+	char dir[] = "/tmp/bitlbee-bench-XXXXXX";
+	int users, i, failed = 0;
+	gint64 sum = 0, max = 0, *first;
+	irc_t **ircs;
+
+	nkeys = argc > 1 ? atoi( argv[1] ) : 50;
+	users = argc > 2 ? atoi( argv[2] ) : 10;
+	if( nkeys < 1 || users < 1 || users > nkeys )
+		return 1;
+
+	log_init();
+	b_main_init();
+	global.conf = conf_load( 0, NULL );
+	global.conf->runmode = RUNMODE_DAEMON;
+	global.conf->otr_keygen_workers = argc > 3 ? atoi( argv[3] ) : 0;
+	if( mkdtemp( dir ) == NULL )
+		return 1;
+	global.conf->configdir = g_strdup_printf( "%s/", dir );
+	otr_init();
+
+	ircs = g_new0( irc_t*, users );
+	for( i = 0; i < users; i ++ )
+	{
+		int sv[2];
+
+		if( socketpair( AF_UNIX, SOCK_STREAM, 0, sv ) != 0 )
+			return 1;
+		ircs[i] = irc_new( sv[0] );
+		ircs[i]->user->nick = g_strdup_printf( "bench%d", i );
+		b_input_add( sv[1], B_EV_IO_READ, bench_drain, NULL );
+	}
+
+	/* User 0 gets the most accounts: the first keys go round-robin,
+	   like everybody connecting at once, the rest all go to user 0. */
+	keys = g_new0( struct bench_key, nkeys );
+	start = bench_now();
+	for( i = 0; i < nkeys; i ++ )
+	{
+		keys[i].irc = ircs[i < users ? i : 0];
+		keys[i].account = g_strdup_printf( "account%d@bench", i );
+		otr_keygen( keys[i].irc, keys[i].account, "jabber" );
+	}
+
+	b_timeout_add( 20, bench_check, NULL );
+	b_main_run();
+
+	first = g_new0( gint64, users );
+	for( i = 0; i < nkeys; i ++ )
+	{
+		int u = i < users ? i : 0;
+
+		if( keys[i].done < 0 )
+		{
+			failed ++;
+			continue;
+		}
+		sum += keys[i].done;
+		max = MAX( max, keys[i].done );
+		if( first[u] == 0 || keys[i].done < first[u] )
+			first[u] = keys[i].done;
+	}
+
+	printf( "%d keys for %d users, %d failed\n", nkeys, users, failed );
+	if( failed < nkeys )
+		printf( "time to key: mean %.2f s, max %.2f s\n",
+		        sum / 1000000.0 / ( nkeys - failed ), max / 1000000.0 );
+	for( i = 0; i < users; i ++ )
+		printf( "user %d (%d key%s): first key after %.2f s\n", i,
+		        i == 0 ? nkeys - users + 1 : 1, i == 0 && nkeys > users ? "s" : "",
+		        first[i] / 1000000.0 );
+
+	for( i = 0; i < users; i ++ )
+		irc_free( ircs[i] );
+	for( i = 0; i < users; i ++ )
+	{
+		char *kf = g_strdup_printf( "%s/bench%d.otr_keys", dir, i );
+		unlink( kf );
+		g_free( kf );
+	}
+	rmdir( dir );
+
+	return failed > 0;
+}
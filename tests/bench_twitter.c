@@ -0,0 +1,157 @@
+/* Memory use of the Twitter user table and seen-status LRU
+   (twitter_xt_get_user() and twitter_seen()) for an account that follows
+   2000 people.
+
+     make && make -C tests bench_twitter && tests/bench_twitter [polls]
+
+   First everyone followed is looked up, like at login. Then every poll
+   brings 200 statuses, with some overlap with the previous poll, from
+   random people followed. In the second half a quarter of them come from
+   people not followed (retweets, mentions), so the table fills up and has
+   to be swept. Heap use is printed every few polls and should level off
+   once both tables are at their bounds. What's left at the end, after
+   twitter_cache_free(), is GLib's own allocator caches. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <glib.h>
+#include "bitlbee.h"
+#include "xmltree.h"
+#include "twitter/twitter_lib.h"
+
+#define BENCH_FOLLOWED 2000
+#define BENCH_PER_POLL 200
+#define BENCH_OVERLAP 20
+
+global_t global;
+
+/* irc.c wants this, it lives in unix.c normally. */
+double gettime()
+{
+	struct timeval time[1];
+
+	gettimeofday(time, 0);
+	return((double) time->tv_sec + (double) time->tv_usec / 1000000);
+}
+
+static gint64 bench_now()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (gint64) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* Bytes allocated on the heap right now, or -1 if that's not known. */
+static long bench_heap()
+{
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+	return (long) mallinfo2().uordblks;
+#elif defined(__GLIBC__)
+	return mallinfo().uordblks;
+#else
+	return -1;
+#endif
+}
+
+static struct twitter_xml_user *bench_user(struct twitter_data *td, guint64 id)
+{
+	char *s = g_strdup_printf("<user><id>%llu</id><name>Person number %llu</name>"
+	                          "<screen_name>person%llu</screen_name></user>",
+	                          (unsigned long long) id, (unsigned long long) id,
+	                          (unsigned long long) id);
+	struct xt_node *node = xt_from_string(s);
+	struct twitter_xml_user *txu = twitter_xt_get_user(td, node);
+
+	xt_free_node(node);
+	g_free(s);
+
+	return txu;
+}
+
+/* Like a status going away after it was shown: drop its reference.
+   Users in the table never get to 0 here since the table has one too. */
+static void bench_user_done(struct twitter_xml_user *txu)
+{
+	if (--txu->ref == 0) {
+		g_free(txu->name);
+		g_free(txu->screen_name);
+		g_free(txu);
+	}
+}
+
+static void bench_report(struct twitter_data *td, const char *what, long base)
+{
+	long heap = bench_heap();
+
+	printf("%-24s users %5d/%d  seen %5d/%d  heap ",
+	       what, td->users ? g_hash_table_size(td->users) : 0, TWITTER_USERS_MAX,
+	       td->seen ? g_hash_table_size(td->seen) : 0, TWITTER_SEEN_MAX);
+	if (heap >= 0)
+		printf("%8.1f KB\n", (heap - base) / 1024.0);
+	else
+		printf("n/a\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int polls = argc > 1 ? atoi(argv[1]) : 200;
+	struct twitter_data td;
+	guint64 status = 1, stranger = 1000000000;
+	gint64 start, took = 0;
+	long base;
+	int p, i, n = 0, shown = 0;
+	char what[32];
+
+	memset(&td, 0, sizeof(td));
+	srand(1);
+	base = bench_heap();
+
+	for (i = 1; i <= BENCH_FOLLOWED; i++)
+		bench_user_done(bench_user(&td, i));
+	bench_report(&td, "login", base);
+
+	for (p = 1; p <= polls; p++) {
+		/* Each poll starts a bit before where the previous one ended. */
+		if (status > BENCH_OVERLAP)
+			status -= BENCH_OVERLAP;
+
+		start = bench_now();
+		for (i = 0; i < BENCH_PER_POLL; i++, status++, n++) {
+			struct twitter_xml_user *txu;
+			guint64 id;
+
+			if (twitter_seen(&td, status, FALSE))
+				continue;
+
+			if (p > polls / 2 && i % 4 == 0)
+				id = stranger++;
+			else
+				id = 1 + rand() % BENCH_FOLLOWED;
+
+			txu = bench_user(&td, id);
+			twitter_seen(&td, status, TRUE);
+			bench_user_done(txu);
+			shown++;
+		}
+		took += bench_now() - start;
+
+		if (p % 10 == 0 || p == polls) {
+			g_snprintf(what, sizeof(what), "poll %d", p);
+			bench_report(&td, what, base);
+		}
+	}
+
+	twitter_cache_free(&td);
+	bench_report(&td, "freed", base);
+
+	printf("%d statuses, %d shown, %.1f ns/status\n", n, shown,
+	       n ? took * 1000.0 / n : 0);
+
+	return 0;
+}
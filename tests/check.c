@@ -69,6 +69,24 @@ Suite *jabber_sasl_suite(void);
 /* From check_jabber_sasl.c */
 Suite *jabber_util_suite(void);
 
+/* From check_xmltree.c */
+Suite *xmltree_suite(void);
+
+/* From check_http.c */
+Suite *http_suite(void);
+
+/* From check_ssl_cache.c */
+Suite *ssl_cache_suite(void);
+
+/* From check_events.c */
+Suite *events_suite(void);
+
+/* From check_twitter.c */
+Suite *twitter_suite(void);
+
+/* From check_skype.c */
+Suite *skype_suite(void);
+
 int main (int argc, char **argv)
 {
 	int nf;
@@ -117,6 +135,12 @@ int main (int argc, char **argv)
 	srunner_add_suite(sr, set_suite());
 	srunner_add_suite(sr, jabber_sasl_suite());
 	srunner_add_suite(sr, jabber_util_suite());
+	srunner_add_suite(sr, xmltree_suite());
+	srunner_add_suite(sr, http_suite());
+	srunner_add_suite(sr, ssl_cache_suite());
+	srunner_add_suite(sr, events_suite());
+	srunner_add_suite(sr, twitter_suite());
+	srunner_add_suite(sr, skype_suite());
 	if (no_fork)
 		srunner_set_fork_status(sr, CK_NOFORK);
 	srunner_run_all (sr, verbose?CK_VERBOSE:CK_NORMAL);
@@ -0,0 +1,66 @@
+#include <stdlib.h>
+#include <glib.h>
+#include <gmodule.h>
+#include <check.h>
+#include <string.h>
+#include <stdio.h>
+#include "events.h"
+
+static gboolean check_handler( gpointer data, gint fd, b_input_condition cond )
+{
+	( *(int*) data ) ++;
+	return fd == 1;
+}
+
+static void check_profile(int l)
+{
+	GSList *lines, *s;
+	int calls = 0, found = 0;
+
+	fail_if( b_event_profiling );
+
+	/* When disabled, B_EV_CALL() should just call the handler. */
+	fail_unless( B_EV_CALL( check_handler, &calls, 1, 0 ) == TRUE );
+	fail_unless( calls == 1 );
+
+	b_event_profile_enable( TRUE );
+	fail_unless( B_EV_CALL( check_handler, &calls, 1, 0 ) == TRUE );
+	fail_unless( B_EV_CALL( check_handler, &calls, -1, 0 ) == FALSE );
+	fail_unless( calls == 3 );
+
+	b_event_profile_wake();
+	b_event_profile_wake();
+	b_event_profile_sleep();
+	b_event_profile_sleep();
+
+	lines = b_event_profile_report( 10 );
+	fail_unless( g_slist_length( lines ) == 3 );
+	fail_unless( strstr( lines->data, " 1 iterations" ) != NULL, "%s", lines->data );
+	fail_unless( strstr( lines->next->data, "<0.1 ms: 1" ) != NULL, "%s", lines->next->data );
+	for( s = lines; s; s = s->next )
+	{
+		found += strstr( s->data, ": 2 calls" ) != NULL;
+		g_free( s->data );
+	}
+	g_slist_free( lines );
+	fail_unless( found == 1 );
+
+	b_event_profile_reset();
+	lines = b_event_profile_report( 10 );
+	fail_unless( g_slist_length( lines ) == 2 );
+	for( s = lines; s; s = s->next )
+		g_free( s->data );
+	g_slist_free( lines );
+
+	b_event_profile_enable( FALSE );
+	fail_if( b_event_profiling );
+}
+
+Suite *events_suite (void)
+{
+	Suite *s = suite_create("Events");
+	TCase *tc_core = tcase_create("Core");
+	suite_add_tcase (s, tc_core);
+	tcase_add_test (tc_core, check_profile);
+	return s;
+}
@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include <glib.h>
+#include <gmodule.h>
+#include <check.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "events.h"
+#include "http_client.h"
+
+static void check_keepalive(int l)
+{
+	/* Only HTTP/1.1 without Connection: close may keep the connection. */
+	fail_unless( http_request_keepalive( "GET / HTTP/1.1\r\nHost: example.com\r\n\r\n" ) );
+	fail_unless( http_request_keepalive( "POST /x HTTP/1.1\r\nHost: example.com\r\n"
+	                                     "Connection: Keep-Alive\r\n\r\nConnection: close" ) );
+	fail_if( http_request_keepalive( "GET / HTTP/1.0\r\nHost: example.com\r\n\r\n" ) );
+	fail_if( http_request_keepalive( "GET / HTTP/1.1\r\nHost: example.com\r\n"
+	                                 "connection: Close\r\n\r\n" ) );
+	fail_if( http_request_keepalive( "GET / HTTP/1.1" ) );
+}
+
+/* A local keep-alive server: answers every request on a connection with a
+   small Content-Length framed reply and leaves the connection open. */
+struct pool_server
+{
+	int listen_fd;
+	int port;
+	int open;               /* Connections open right now, */
+	int max_open;           /* at most this many at the same time, */
+	int accepted;           /* and this many in total. */
+	int replies;            /* Replies to wait for before stopping. */
+};
+
+struct pool_server_conn
+{
+	struct pool_server *ps;
+	int fd;
+	GString *buf;
+};
+
+static gboolean pool_server_read( gpointer data, gint fd, b_input_condition cond )
+{
+	struct pool_server_conn *psc = data;
+	const char *reply = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+	char buf[512];
+	char *end;
+	int st;
+	
+	if( ( st = read( fd, buf, sizeof( buf ) ) ) <= 0 )
+	{
+		psc->ps->open --;
+		close( fd );
+		g_string_free( psc->buf, TRUE );
+		g_free( psc );
+		return FALSE;
+	}
+	
+	g_string_append_len( psc->buf, buf, st );
+	while( ( end = strstr( psc->buf->str, "\r\n\r\n" ) ) )
+	{
+		fail_unless( write( fd, reply, strlen( reply ) ) == strlen( reply ) );
+		g_string_erase( psc->buf, 0, end + 4 - psc->buf->str );
+	}
+	
+	return TRUE;
+}
+
+static gboolean pool_server_accept( gpointer data, gint fd, b_input_condition cond )
+{
+	struct pool_server *ps = data;
+	struct pool_server_conn *psc = g_new0( struct pool_server_conn, 1 );
+	
+	psc->ps = ps;
+	psc->buf = g_string_new( "" );
+	psc->fd = accept( ps->listen_fd, NULL, NULL );
+	fail_if( psc->fd < 0 );
+	
+	ps->accepted ++;
+	if( ++ ps->open > ps->max_open )
+		ps->max_open = ps->open;
+	
+	b_input_add( psc->fd, B_EV_IO_READ, pool_server_read, psc );
+	
+	return TRUE;
+}
+
+static void pool_server_start( struct pool_server *ps )
+{
+	struct sockaddr_in sin;
+	socklen_t sinlen = sizeof( sin );
+	
+	memset( ps, 0, sizeof( *ps ) );
+	memset( &sin, 0, sizeof( sin ) );
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+	
+	ps->listen_fd = socket( AF_INET, SOCK_STREAM, 0 );
+	fail_if( ps->listen_fd < 0 );
+	fail_if( bind( ps->listen_fd, (struct sockaddr*) &sin, sizeof( sin ) ) != 0 );
+	fail_if( listen( ps->listen_fd, 16 ) != 0 );
+	fail_if( getsockname( ps->listen_fd, (struct sockaddr*) &sin, &sinlen ) != 0 );
+	ps->port = ntohs( sin.sin_port );
+	
+	b_input_add( ps->listen_fd, B_EV_IO_READ, pool_server_accept, ps );
+}
+
+static void pool_client( struct http_request *req )
+{
+	struct pool_server *ps = req->data;
+	
+	fail_unless( req->finished && req->status_code == 200 );
+	fail_unless( req->body_size == 2 && strcmp( req->reply_body, "ok" ) == 0 );
+	
+	if( -- ps->replies == 0 )
+		b_main_quit();
+}
+
+static gboolean pool_timeout( gpointer data, gint fd, b_input_condition cond )
+{
+	b_main_quit();
+	return FALSE;
+}
+
+/* Send n requests at once and wait for all the replies. */
+static void pool_run( struct pool_server *ps, int n )
+{
+	gint timeout;
+	int i;
+	
+	ps->replies = n;
+	for( i = 0; i < n; i ++ )
+		fail_if( http_dorequest( "127.0.0.1", ps->port, 0, "GET / HTTP/1.1\r\n"
+		                         "Host: 127.0.0.1\r\n\r\n", pool_client, ps ) == NULL );
+	
+	timeout = b_timeout_add( 5000, pool_timeout, NULL );
+	b_main_run();
+	b_event_remove( timeout );
+	
+	fail_unless( ps->replies == 0, "%d replies missing", ps->replies );
+}
+
+static void check_pool(int l)
+{
+	const struct http_pool_stats *stats = http_pool_get_stats();
+	struct http_pool_stats before;
+	struct pool_server ps;
+	
+	pool_server_start( &ps );
+	before = *stats;
+	
+	/* One after the other: the second request reuses the connection. */
+	pool_run( &ps, 1 );
+	pool_run( &ps, 1 );
+	fail_unless( ps.accepted == 1 );
+	fail_unless( stats->reuses - before.reuses == 1 );
+	fail_unless( stats->idle == 1 );
+	
+	/* Lots at once: never more than the per-host limit of connections
+	   (idle or busy), the rest waits for one to be released. */
+	pool_run( &ps, 10 );
+	fail_unless( ps.max_open == 4, "%d connections", ps.max_open );
+	fail_unless( ps.accepted == 4 );
+	fail_unless( stats->queued - before.queued == 6 );
+	fail_unless( stats->reuses - before.reuses == 1 + 7 );
+	fail_unless( stats->idle == 4 );
+	
+	close( ps.listen_fd );
+}
+
+Suite *http_suite (void)
+{
+	Suite *s = suite_create("HTTP");
+	TCase *tc_core = tcase_create("Core");
+	suite_add_tcase (s, tc_core);
+	tcase_add_test (tc_core, check_keepalive);
+	tcase_add_test (tc_core, check_pool);
+	return s;
+}
@@ -94,6 +94,66 @@ static void check_buddy_add(int l)
 	fail_unless( jabber_buddy_remove( ic, "bugtest@google.com/C" ) );
 }
 
+static int cache_calls;
+static char *cache_ctx;
+
+static xt_status check_cache_handler( struct im_connection *ic, struct xt_node *node, char *ctx )
+{
+	cache_calls ++;
+	g_free( cache_ctx );
+	cache_ctx = g_strdup( ctx );
+	return XT_HANDLED;
+}
+
+static void check_cache(int l)
+{
+	struct jabber_data *jd = ic->proto_data;
+	struct xt_node *a, *b, *reply;
+	char *id;
+	
+	jabber_cache_init( ic );
+	
+	a = jabber_make_packet( "iq", "get", "a@example.com", NULL );
+	b = jabber_make_packet( "iq", "get", "b@example.com", NULL );
+	jabber_cache_add( ic, a, check_cache_handler, "a" );
+	jabber_cache_add( ic, b, check_cache_handler, NULL );
+	
+	fail_unless( strncmp( xt_find_attr( a, "id" ), JABBER_CACHED_ID, strlen( JABBER_CACHED_ID ) ) == 0 );
+	fail_if( strcmp( xt_find_attr( a, "id" ), xt_find_attr( b, "id" ) ) == 0 );
+	fail_unless( jd->cache_head && jd->cache_head->next == jd->cache_tail );
+	
+	/* Unknown IDs are ignored. */
+	reply = jabber_make_packet( "iq", "result", NULL, NULL );
+	id = g_strdup_printf( "%s%x", jd->cached_id_prefix, 1000 );
+	xt_add_attr( reply, "id", id );
+	fail_unless( jabber_cache_handle_packet( ic, reply ) == XT_HANDLED );
+	fail_unless( cache_calls == 0 );
+	g_free( id );
+	
+	/* The handler gets its context, and only once. */
+	xt_add_attr( reply, "id", xt_find_attr( a, "id" ) );
+	jabber_cache_handle_packet( ic, reply );
+	jabber_cache_handle_packet( ic, reply );
+	fail_unless( cache_calls == 1 );
+	fail_unless( cache_ctx && strcmp( cache_ctx, "a" ) == 0 );
+	fail_unless( jd->cache_head == jd->cache_tail );
+	
+	/* Expired entries are dropped without calling the handler. */
+	jd->cache_head->expires = 0;
+	jabber_cache_clean( ic );
+	fail_unless( jd->cache_head == NULL && jd->cache_tail == NULL );
+	xt_add_attr( reply, "id", xt_find_attr( b, "id" ) );
+	jabber_cache_handle_packet( ic, reply );
+	fail_unless( cache_calls == 1 );
+	
+	xt_free_node( a );
+	xt_free_node( b );
+	xt_free_node( reply );
+	jabber_cache_free( ic );
+	g_free( cache_ctx );
+	cache_ctx = NULL;
+}
+
 Suite *jabber_util_suite (void)
 {
 	Suite *s = suite_create("jabber/util");
@@ -109,5 +169,6 @@ Suite *jabber_util_suite (void)
 	
 	suite_add_tcase (s, tc_core);
 	tcase_add_test (tc_core, check_buddy_add);
+	tcase_add_test (tc_core, check_cache);
 	return s;
 }
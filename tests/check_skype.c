@@ -0,0 +1,183 @@
+#define _XOPEN_SOURCE
+#define _BSD_SOURCE
+#include <stdlib.h>
+#include <glib.h>
+#include <check.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "bitlbee.h"
+
+/* The Skype module is only built as a plugin, so build it into the test
+   instead (with the same feature macros as above, which it needs).
+   skyped is replaced by one end of a socketpair, without SSL. */
+static GSList *skype_test_writes;
+
+static int skype_test_read(void *conn, char *buf, int len)
+{
+	return read(*(int*) conn, buf, len);
+}
+
+static int skype_test_write(void *conn, const char *buf, int len)
+{
+	skype_test_writes = g_slist_append(skype_test_writes, g_strndup(buf, len));
+	return write(*(int*) conn, buf, len);
+}
+
+#define ssl_read skype_test_read
+#define ssl_write skype_test_write
+#include "../protocols/skype/skype.c"
+#undef ssl_read
+#undef ssl_write
+
+struct skype_test {
+	int fd[2];
+	struct im_connection *ic;
+	struct skype_data *sd;
+};
+
+static void skype_test_init(struct skype_test *st)
+{
+	memset(st, 0, sizeof(*st));
+	fail_if(socketpair(AF_UNIX, SOCK_STREAM, 0, st->fd) != 0);
+	sock_make_nonblocking(st->fd[1]);
+
+	st->ic = g_new0(struct im_connection, 1);
+	st->ic->acc = g_new0(account_t, 1);
+	st->ic->proto_data = st->sd = g_new0(struct skype_data, 1);
+	st->sd->ic = st->ic;
+	st->sd->fd = st->fd[0];
+	st->sd->ssl = &st->sd->fd;
+}
+
+static void skype_test_free(struct skype_test *st)
+{
+	GSList *l;
+
+	for (l = skype_test_writes; l; l = l->next)
+		g_free(l->data);
+	g_slist_free(skype_test_writes);
+	skype_test_writes = NULL;
+
+	if (st->sd->rbuf)
+		g_string_free(st->sd->rbuf, TRUE);
+	g_free(st->sd);
+	g_free(st->ic->acc);
+	g_free(st->ic);
+	close(st->fd[0]);
+	close(st->fd[1]);
+}
+
+/* Send data from "skyped" and let the module read it (once). */
+static void skype_test_send(struct skype_test *st, const char *s, int len)
+{
+	fail_unless(write(st->fd[1], s, len) == len);
+	fail_unless(skype_read_callback(st->ic, st->fd[0], B_EV_IO_READ));
+}
+
+/* Everything the module sent to "skyped" so far. */
+static GString *skype_test_recv(struct skype_test *st)
+{
+	GString *ret = g_string_new("");
+	char buf[1024];
+	int n;
+
+	while ((n = read(st->fd[1], buf, sizeof(buf))) > 0)
+		g_string_append_len(ret, buf, n);
+
+	return ret;
+}
+
+static void check_lines_split(int l)
+{
+	const char *s = "PING\nPING\n";
+	int split;
+
+	/* Each PING gets a PONG, no matter how the lines come in. */
+	for (split = 1; split < strlen(s); split++) {
+		struct skype_test st;
+		GString *out;
+
+		skype_test_init(&st);
+		skype_test_send(&st, s, split);
+		skype_test_send(&st, s + split, strlen(s) - split);
+
+		out = skype_test_recv(&st);
+		fail_unless(strcmp(out->str, "PONG\nPONG\n") == 0,
+		            "split at %d: %s", split, out->str);
+		fail_unless(st.sd->rbuf->len == 0);
+		g_string_free(out, TRUE);
+		skype_test_free(&st);
+	}
+}
+
+static void check_lines_many(int l)
+{
+	struct skype_test st;
+	GString *out;
+
+	skype_test_init(&st);
+	skype_test_send(&st, "PING\n\nPING\nPING\nPI", 19);
+	out = skype_test_recv(&st);
+	fail_unless(strcmp(out->str, "PONG\nPONG\nPONG\n") == 0, "%s", out->str);
+	fail_unless(strcmp(st.sd->rbuf->str, "PI") == 0);
+	g_string_free(out, TRUE);
+	skype_test_free(&st);
+}
+
+/* A roster longer than one read, answered with one GET per contact, in
+   writes that skyped can read in one go and that don't split lines. */
+static void check_lines_long(int l)
+{
+	struct skype_test st;
+	GString *in = g_string_new("USERS "), *expect = g_string_new("");
+	GString *out;
+	GSList *w;
+	int i, reads;
+
+	for (i = 0; i < 300; i++) {
+		g_string_append_printf(in, "%suser%d", i ? ", " : "", i);
+		g_string_append_printf(expect, "GET USER user%d ONLINESTATUS\n", i);
+	}
+	g_string_append_c(in, '\n');
+	fail_unless(in->len > IRC_LINE_SIZE * 2);
+
+	skype_test_init(&st);
+	fail_unless(write(st.fd[1], in->str, in->len) == in->len);
+	/* Nothing happens until the whole line is in. */
+	reads = (in->len + IRC_LINE_SIZE - 1) / IRC_LINE_SIZE;
+	for (i = 0; i < reads; i++) {
+		fail_unless(skype_test_writes == NULL);
+		fail_unless(skype_read_callback(st.ic, st.fd[0], B_EV_IO_READ));
+	}
+	fail_unless(st.sd->rbuf->len == 0);
+
+	out = skype_test_recv(&st);
+	fail_unless(strcmp(out->str, expect->str) == 0);
+
+	fail_unless(g_slist_length(skype_test_writes) <= expect->len / IRC_LINE_SIZE + 2,
+	            "%d writes", g_slist_length(skype_test_writes));
+	for (w = skype_test_writes; w; w = w->next) {
+		char *s = w->data;
+
+		fail_unless(strlen(s) <= IRC_LINE_SIZE);
+		fail_unless(s[strlen(s) - 1] == '\n');
+	}
+
+	g_string_free(in, TRUE);
+	g_string_free(expect, TRUE);
+	g_string_free(out, TRUE);
+	skype_test_free(&st);
+}
+
+Suite *skype_suite (void)
+{
+	Suite *s = suite_create("Skype");
+	TCase *tc_core = tcase_create("Core");
+	suite_add_tcase (s, tc_core);
+	tcase_add_test (tc_core, check_lines_split);
+	tcase_add_test (tc_core, check_lines_many);
+	tcase_add_test (tc_core, check_lines_long);
+	return s;
+}
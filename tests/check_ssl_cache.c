@@ -0,0 +1,60 @@
+#include <stdlib.h>
+#include <glib.h>
+#include <gmodule.h>
+#include <check.h>
+#include <string.h>
+#include <stdio.h>
+#include "ssl_client.h"
+
+static void check_lookup(int l)
+{
+	size_t len = 0;
+	char *data;
+
+	ssl_cache_store( "example.com", 443, "session1", 8 );
+	ssl_cache_store( "example.com", 5223, "session2", 8 );
+
+	data = ssl_cache_lookup( "EXAMPLE.com", 443, &len );
+	fail_unless( data != NULL && len == 8 && memcmp( data, "session1", 8 ) == 0 );
+
+	/* Replacing an entry must not leave the old one around. */
+	ssl_cache_store( "example.com", 443, "new", 3 );
+	data = ssl_cache_lookup( "example.com", 443, &len );
+	fail_unless( data != NULL && len == 3 && memcmp( data, "new", 3 ) == 0 );
+
+	ssl_cache_remove( "example.com", 443 );
+	fail_unless( ssl_cache_lookup( "example.com", 443, &len ) == NULL );
+	fail_unless( ssl_cache_lookup( "example.com", 5223, &len ) != NULL );
+	fail_unless( ssl_cache_lookup( "example.org", 5223, &len ) == NULL );
+}
+
+static void check_bounded(int l)
+{
+	size_t len;
+	int i;
+
+	for( i = 0; i < SSL_CACHE_SIZE; i ++ )
+	{
+		char host[32];
+		g_snprintf( host, sizeof( host ), "host%d", i );
+		ssl_cache_store( host, 443, host, strlen( host ) );
+	}
+
+	/* Use host0 so host1 becomes the least recently used one. */
+	fail_unless( ssl_cache_lookup( "host0", 443, &len ) != NULL );
+	ssl_cache_store( "one-too-many", 443, "x", 1 );
+
+	fail_unless( ssl_cache_lookup( "host0", 443, &len ) != NULL );
+	fail_unless( ssl_cache_lookup( "host1", 443, &len ) == NULL );
+	fail_unless( ssl_cache_lookup( "one-too-many", 443, &len ) != NULL );
+}
+
+Suite *ssl_cache_suite (void)
+{
+	Suite *s = suite_create("SSLCache");
+	TCase *tc_core = tcase_create("Core");
+	suite_add_tcase (s, tc_core);
+	tcase_add_test (tc_core, check_lookup);
+	tcase_add_test (tc_core, check_bounded);
+	return s;
+}
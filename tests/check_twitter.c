@@ -0,0 +1,314 @@
+#include <stdlib.h>
+#include <glib.h>
+#include <gmodule.h>
+#include <check.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "events.h"
+#include "xmltree.h"
+#include "twitter/twitter_lib.h"
+
+static const char *stream_msgs[] = {
+	"<status><id>1</id><text>hello</text></status>",
+	"<status><id>2</id><text>world\n</text></status>",
+	"<delete><status><id>1</id></status></delete>",
+	NULL
+};
+
+/* Synthetic stream: length-delimited messages with keep-alives in between. */
+static GString *stream_build()
+{
+	GString *ret = g_string_new("\r\n");
+	int i;
+
+	for (i = 0; stream_msgs[i]; i++)
+		g_string_append_printf(ret, "%d\r\n%s\r\n", (int) strlen(stream_msgs[i]), stream_msgs[i]);
+
+	return ret;
+}
+
+/* Feed buf to twitter_stream_next() like the stream callback does, collect
+   the messages found in msgs and return how many bytes were used. */
+static int stream_parse(const char *buf, int len, GSList **msgs)
+{
+	int st, start, msglen, done = 0;
+
+	while ((st = twitter_stream_next(buf + done, len - done, &start, &msglen)) > 0) {
+		if (msglen > 0)
+			*msgs = g_slist_append(*msgs, g_strndup(buf + done + start, msglen));
+		done += st;
+	}
+
+	return st < 0 ? -1 : done;
+}
+
+static void stream_check_msgs(GSList *msgs)
+{
+	GSList *l;
+	int i;
+
+	for (l = msgs, i = 0; l; l = l->next, i++) {
+		fail_if(stream_msgs[i] == NULL);
+		fail_unless(strcmp(l->data, stream_msgs[i]) == 0, "%s", l->data);
+		g_free(l->data);
+	}
+	fail_unless(stream_msgs[i] == NULL);
+	g_slist_free(msgs);
+}
+
+static void check_stream_next(int l)
+{
+	GString *stream = stream_build();
+	int split;
+
+	/* Data can come in in any size of pieces. */
+	for (split = 0; split <= stream->len; split++) {
+		GString *buf = g_string_new_len(stream->str, split);
+		GSList *msgs = NULL;
+		int done;
+
+		done = stream_parse(buf->str, buf->len, &msgs);
+		fail_if(done < 0);
+		g_string_erase(buf, 0, done);
+		g_string_append_len(buf, stream->str + split, stream->len - split);
+
+		done = stream_parse(buf->str, buf->len, &msgs);
+		fail_unless(done == buf->len, "split at %d: %d left", split, (int) buf->len - done);
+
+		stream_check_msgs(msgs);
+		g_string_free(buf, TRUE);
+	}
+
+	g_string_free(stream, TRUE);
+}
+
+static void check_stream_garbage(int l)
+{
+	int start, len;
+
+	fail_unless(twitter_stream_next("<status>\n", 9, &start, &len) == -1);
+	fail_unless(twitter_stream_next("12 \r\n", 5, &start, &len) == -1);
+	fail_unless(twitter_stream_next("99999999999\r\n", 13, &start, &len) == -1);
+	fail_unless(twitter_stream_next("<status><id>1</id>", 18, &start, &len) == -1);
+	fail_unless(twitter_stream_next("123", 3, &start, &len) == 0);
+	fail_unless(twitter_stream_next("5\r\nabc", 6, &start, &len) == 0);
+	fail_unless(twitter_stream_next("3\nabc", 5, &start, &len) == 5 && start == 2 && len == 3);
+}
+
+/* A local server that sends the synthetic stream in small chunked pieces,
+   with pauses in between, like a real streaming API would. */
+struct stream_server {
+	int listen_fd, fd;
+	GString *body;
+	int pos;
+	GSList *msgs;
+	gboolean eof, finished;
+};
+
+static gboolean stream_server_write(gpointer data, gint fd, b_input_condition cond)
+{
+	struct stream_server *ss = data;
+	int n = MIN(7, ss->body->len - ss->pos);
+	char *s;
+
+	if (n == 0) {
+		s = g_strdup("0\r\n\r\n");
+	} else {
+		s = g_strdup_printf("%x\r\n%.*s\r\n", n, n, ss->body->str + ss->pos);
+		ss->pos += n;
+	}
+	fail_unless(write(ss->fd, s, strlen(s)) == strlen(s));
+	g_free(s);
+
+	if (n == 0) {
+		close(ss->fd);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean stream_server_accept(gpointer data, gint fd, b_input_condition cond)
+{
+	struct stream_server *ss = data;
+	const char *hdr = "HTTP/1.1 200 OK\r\nContent-Type: text/xml\r\n"
+	                  "Transfer-Encoding: chunked\r\n\r\n";
+
+	ss->fd = accept(ss->listen_fd, NULL, NULL);
+	fail_if(ss->fd < 0);
+	fail_unless(write(ss->fd, hdr, strlen(hdr)) == strlen(hdr));
+
+	b_timeout_add(5, stream_server_write, ss);
+
+	return FALSE;
+}
+
+static void stream_client(struct http_request *req)
+{
+	struct stream_server *ss = req->data;
+	int done;
+
+	fail_unless(req->status_code == 200);
+
+	done = stream_parse(req->reply_body, req->body_size, &ss->msgs);
+	fail_if(done < 0);
+	http_flush_bytes(req, done);
+
+	if (req->flags & HTTPC_EOF) {
+		ss->eof = TRUE;
+		ss->finished = req->finished;
+		b_main_quit();
+	}
+}
+
+static gboolean stream_timeout(gpointer data, gint fd, b_input_condition cond)
+{
+	b_main_quit();
+	return FALSE;
+}
+
+static void check_stream_http(int l)
+{
+	struct stream_server ss;
+	struct sockaddr_in sin;
+	socklen_t sinlen = sizeof(sin);
+	struct http_request *req;
+	gint timeout;
+
+	memset(&ss, 0, sizeof(ss));
+	ss.body = stream_build();
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	ss.listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	fail_if(ss.listen_fd < 0);
+	fail_if(bind(ss.listen_fd, (struct sockaddr*) &sin, sizeof(sin)) != 0);
+	fail_if(listen(ss.listen_fd, 1) != 0);
+	fail_if(getsockname(ss.listen_fd, (struct sockaddr*) &sin, &sinlen) != 0);
+	b_input_add(ss.listen_fd, B_EV_IO_READ, stream_server_accept, &ss);
+
+	req = http_dorequest("127.0.0.1", ntohs(sin.sin_port), 0,
+	                     "GET /stream.xml?delimited=length HTTP/1.1\r\n"
+	                     "Host: 127.0.0.1\r\n\r\n", stream_client, &ss);
+	fail_if(req == NULL);
+	req->flags |= HTTPC_STREAMING;
+
+	timeout = b_timeout_add(5000, stream_timeout, NULL);
+	b_main_run();
+	b_event_remove(timeout);
+
+	fail_unless(ss.eof);
+	fail_unless(ss.finished);
+	stream_check_msgs(ss.msgs);
+
+	close(ss.listen_fd);
+	g_string_free(ss.body, TRUE);
+}
+
+static struct twitter_xml_user *users_get(struct twitter_data *td, guint64 id, const char *name)
+{
+	char *s = g_strdup_printf("<user><id>%llu</id><name>%s</name>"
+	                          "<screen_name>u%llu</screen_name></user>",
+	                          (unsigned long long) id, name, (unsigned long long) id);
+	struct xt_node *node = xt_from_string(s);
+	struct twitter_xml_user *txu = twitter_xt_get_user(td, node);
+
+	xt_free_node(node);
+	g_free(s);
+
+	return txu;
+}
+
+static void check_users(int l)
+{
+	struct twitter_data td;
+	struct twitter_xml_user *a, *b, *b42;
+	struct xt_node *node;
+	int i, j;
+
+	memset(&td, 0, sizeof(td));
+
+	/* Same user, so same struct, with the newest name. */
+	a = users_get(&td, 42, "A");
+	b = users_get(&td, 42, "A B");
+	fail_unless(a == b);
+	fail_unless(strcmp(b->name, "A B") == 0 && strcmp(b->screen_name, "u42") == 0);
+	fail_unless(b->ref == 3);
+	b42 = b;
+
+	/* Users without id can't be shared. */
+	node = xt_from_string("<user><screen_name>x</screen_name></user>");
+	a = twitter_xt_get_user(&td, node);
+	b = twitter_xt_get_user(&td, node);
+	fail_if(a == b);
+	fail_unless(a->ref == 1 && strcmp(a->screen_name, "x") == 0);
+	xt_free_node(node);
+	g_free(a->screen_name);
+	g_free(a);
+	g_free(b->screen_name);
+	g_free(b);
+
+	/* Following 2000 people who post a few times per poll: only one
+	   struct per person. */
+	for (j = 0; j < 3; j++)
+		for (i = 1; i <= 2000; i++) {
+			a = users_get(&td, 1000000 + i, "Someone");
+			fail_unless(a->ref == 2 && a->id == 1000000 + i);
+			a->ref--;
+		}
+	fail_unless(g_hash_table_size(td.users) == 2001);
+
+	/* When the table is full, users not in use are dropped. */
+	for (i = 2001; i < TWITTER_USERS_MAX; i++)
+		users_get(&td, 1000000 + i, "Someone")->ref--;
+	fail_unless(g_hash_table_size(td.users) == TWITTER_USERS_MAX);
+	users_get(&td, 1, "Someone");
+	fail_unless(g_hash_table_size(td.users) == 2);
+	fail_unless(users_get(&td, 42, "A") == b42);
+
+	twitter_cache_free(&td);
+	fail_unless(td.users == NULL);
+}
+
+static void check_seen(int l)
+{
+	struct twitter_data td;
+	int i;
+
+	memset(&td, 0, sizeof(td));
+	fail_if(twitter_seen(&td, 1, FALSE));
+	fail_if(twitter_seen(&td, 1, FALSE));
+
+	for (i = 1; i <= TWITTER_SEEN_MAX; i++)
+		fail_if(twitter_seen(&td, i, TRUE));
+	fail_unless(twitter_seen(&td, 1, TRUE));
+
+	/* 2 is least recently seen now (1 just got looked up). */
+	fail_if(twitter_seen(&td, TWITTER_SEEN_MAX + 1, TRUE));
+	fail_unless(twitter_seen(&td, 1, FALSE));
+	fail_if(twitter_seen(&td, 2, FALSE));
+	fail_unless(twitter_seen(&td, 3, FALSE));
+	fail_if(twitter_seen(&td, G_GINT64_CONSTANT(0x100000003), FALSE));
+	fail_unless(g_hash_table_size(td.seen) == TWITTER_SEEN_MAX);
+
+	twitter_cache_free(&td);
+	fail_unless(td.seen == NULL);
+}
+
+Suite *twitter_suite (void)
+{
+	Suite *s = suite_create("Twitter");
+	TCase *tc_core = tcase_create("Core");
+	suite_add_tcase (s, tc_core);
+	tcase_add_test (tc_core, check_stream_next);
+	tcase_add_test (tc_core, check_stream_garbage);
+	tcase_add_test (tc_core, check_stream_http);
+	tcase_add_test (tc_core, check_users);
+	tcase_add_test (tc_core, check_seen);
+	return s;
+}
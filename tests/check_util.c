@@ -168,6 +168,29 @@ START_TEST(test_http_encode)
 	fail_unless( strcmp( s, "ee%C3%ABee%21%21..." ) == 0 );
 END_TEST
 
+START_TEST(test_strip_html)
+	int i;
+	const char *tests[][2] = {
+		{ "plain text", "plain text" },
+		{ "<b>bold</b> and <I>italic</I><br>", "\x02" "bold\x02 and \x1fitalic\x1f\n" },
+		{ "<a href=\"x\">link</a> <font>", "link " },
+		{ "a < b && c<d", "a < b && c<d" },
+		{ "&lt;tag&gt; &AMP; &quot;x&quot; &bogus;", "<tag> & \"x\" &bogus;" },
+		{ "<unterminated", "<unterminated" },
+		{ "", "" },
+	};
+	
+	for( i = 0; i < sizeof( tests ) / sizeof( tests[0] ); i ++ )
+	{
+		char *s = g_strdup( tests[i][0] );
+		
+		strip_html( s );
+		fail_unless( strcmp( s, tests[i][1] ) == 0,
+		             "%s: expected \"%s\", got \"%s\"", tests[i][0], tests[i][1], s );
+		g_free( s );
+	}
+END_TEST
+
 Suite *util_suite (void)
 {
 	Suite *s = suite_create("Util");
@@ -182,5 +205,6 @@ Suite *util_suite (void)
 	tcase_add_test (tc_core, test_set_url_username_pwd);
 	tcase_add_test (tc_core, test_word_wrap);
 	tcase_add_test (tc_core, test_http_encode);
+	tcase_add_test (tc_core, test_strip_html);
 	return s;
 }
@@ -0,0 +1,143 @@
+#include <stdlib.h>
+#include <glib.h>
+#include <gmodule.h>
+#include <check.h>
+#include <string.h>
+#include <stdio.h>
+#include "xmltree.h"
+
+static GString *trace;
+
+static xt_status check_any( struct xt_node *node, gpointer data )
+{
+	g_string_append_printf( trace, "any:%s ", node->name );
+	return XT_NEXT;
+}
+
+static xt_status check_stream( struct xt_node *node, gpointer data )
+{
+	g_string_append_printf( trace, "stream:%s ", node->name );
+	return XT_NEXT;
+}
+
+static xt_status check_presence( struct xt_node *node, gpointer data )
+{
+	g_string_append_printf( trace, "presence:%s ", node->name );
+	return XT_HANDLED;
+}
+
+static xt_status check_never( struct xt_node *node, gpointer data )
+{
+	g_string_append_printf( trace, "never:%s ", node->name );
+	return XT_HANDLED;
+}
+
+static xt_status check_body( struct xt_node *node, gpointer data )
+{
+	g_string_append_printf( trace, "body:%s ", node->name );
+	return XT_HANDLED;
+}
+
+static xt_status check_count( struct xt_node *node, gpointer data )
+{
+	( *(int*) data ) ++;
+	return XT_HANDLED;
+}
+
+static const struct xt_handler_entry order_handlers[] = {
+	{ NULL,                 "stream:stream",        check_any },
+	{ "presence",           "stream:stream",        check_presence },
+	{ NULL,                 NULL,                   check_stream },
+	{ "presence",           NULL,                   check_never },
+	{ "body",               NULL,                   check_body },
+	{ "stream:stream",      "<root>",               check_never },
+	{ NULL,                 NULL,                   NULL }
+};
+
+static void check_order(int l)
+{
+	struct xt_parser *xt;
+	char *in = "<stream:stream><PRESENCE><body/></PRESENCE><message/>";
+
+	trace = g_string_new( "" );
+	xt = xt_new( order_handlers, NULL );
+
+	fail_unless( xt_feed( xt, in, strlen( in ) ) == 1 );
+	fail_unless( xt_handle( xt, NULL, -1 ) == 1 );
+
+	/* Table order has to be kept across exact and wildcard entries, and
+	   XT_HANDLED has to stop the search. The root element isn't complete
+	   yet so it mustn't be handled. */
+	fail_if( strcmp( trace->str, "stream:body body:body any:PRESENCE presence:PRESENCE "
+	                             "any:message stream:message " ) != 0,
+	         "Unexpected dispatch order: %s", trace->str );
+
+	g_string_free( trace, TRUE );
+	xt_free( xt );
+}
+
+static const struct xt_handler_entry count_handlers[] = {
+	{ "message",            "stream:stream",        check_never },
+	{ "iq",                 "stream:stream",        check_never },
+	{ "presence",           "stream:stream",        check_count },
+	{ NULL,                 NULL,                   NULL }
+};
+
+static void check_presence_flood(int l)
+{
+	struct xt_parser *xt;
+	char *in = "<presence from='user@example.com/res'><show>away</show>"
+	           "<status>Flooding</status><priority>5</priority></presence>";
+	int i, handled = 0;
+
+	xt = xt_new( count_handlers, &handled );
+	xt_feed( xt, "<stream:stream>", 15 );
+
+	for( i = 0; i < 10000; i ++ )
+	{
+		fail_unless( xt_feed( xt, in, strlen( in ) ) == 1 );
+		fail_unless( xt_handle( xt, NULL, 1 ) == 1 );
+		xt_cleanup( xt, NULL, 1 );
+	}
+
+	fail_unless( handled == 10000 );
+	fail_unless( xt->root->children == NULL );
+
+	xt_free( xt );
+}
+
+static void check_to_string(int l)
+{
+	struct xt_node *node;
+	GString *str;
+	char *out;
+
+	node = xt_new_node( "message", NULL, xt_new_node( "body", "<b>Tom & \"Jerry\"</b>", NULL ) );
+	xt_add_attr( node, "to", "a'b@example.com" );
+	xt_add_child( node, xt_new_node( "active", NULL, NULL ) );
+
+	out = xt_to_string( node );
+	fail_if( strcmp( out, "<message to=\"a&apos;b@example.com\"><body>&lt;b&gt;Tom &amp; "
+	                      "&quot;Jerry&quot;&lt;/b&gt;</body><active/></message>" ) != 0,
+	         "Unexpected output: %s", out );
+
+	/* xt_to_gstring() has to append, not overwrite. */
+	str = g_string_new( "<x/>" );
+	xt_to_gstring( node, str );
+	fail_if( strncmp( str->str, "<x/>", 4 ) != 0 || strcmp( str->str + 4, out ) != 0 );
+
+	g_string_free( str, TRUE );
+	g_free( out );
+	xt_free_node( node );
+}
+
+Suite *xmltree_suite (void)
+{
+	Suite *s = suite_create("XMLTree");
+	TCase *tc_core = tcase_create("Core");
+	suite_add_tcase (s, tc_core);
+	tcase_add_test (tc_core, check_order);
+	tcase_add_test (tc_core, check_presence_flood);
+	tcase_add_test (tc_core, check_to_string);
+	return s;
+}